@@ -0,0 +1,344 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "text.hpp"
+#include "library.hpp"
+
+#include <condition_variable>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 多模式匹配自动机，以字符（码位）为单位，一次线性扫描找出文本中所有词的所有出现位置。模式和文本都会先经过 text::fold 处理。构造后只读，可以在多个线程中同时扫描。
+	/// </summary>
+	class aho_corasick final
+	{
+	public:
+		/// <summary>
+		/// 一次匹配。
+		/// </summary>
+		struct hit
+		{
+			size_t offset{}; // 在文本中的位置（字符数）。
+			size_t length{};
+			id_t lib_id{};
+			id_t item_id{};
+		};
+
+	private:
+		static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+		struct pattern
+		{
+			uint32_t length{};
+			id_t lib_id{};
+			id_t item_id{};
+		};
+		struct node
+		{
+			uint32_t edge_begin{}; // 出边在 edges 中的范围，按字符排序。
+			uint32_t edge_count{};
+			uint32_t fail{};
+			uint32_t dict{ npos }; // 沿失配链第一个有输出的节点。
+			uint32_t out_begin{}; // 以该节点结尾的模式在 outputs 中的范围。
+			uint32_t out_count{};
+		};
+
+		std::vector<node> nodes;
+		std::vector<std::pair<char32_t, uint32_t>> edges;
+		std::vector<uint32_t> root_next; // 根节点在 BMP 上的转移表，npos 表示没有转移。
+		std::vector<uint32_t> outputs; // 模式下标。
+		std::vector<pattern> patterns;
+
+		[[nodiscard]] uint32_t child(uint32_t s, char32_t ch) const
+		{
+			if (!s && ch < root_next.size())
+				return root_next[ch];
+			const auto* b = edges.data() + nodes[s].edge_begin;
+			const auto* e = b + nodes[s].edge_count;
+			auto it = std::lower_bound(b, e, ch, [](const auto& edge, char32_t c) { return edge.first < c; });
+			return it != e && it->first == ch ? it->second : npos;
+		}
+
+	public:
+		bool whole_word{ true }; // 由拉丁字母等组成的词是否只匹配完整的单词，例如 cat 不匹配 catalog 中的 cat。
+
+		/// <summary>
+		/// 构造自动机。
+		/// </summary>
+		/// <param name="words">(词, 库 id, item id) 的列表。同一个词可以对应多个 item。</param>
+		void build(const std::vector<std::tuple<std::u32string, id_t, id_t>>& words)
+		{
+			// 先构造以有序表为边的字典树。
+			std::vector<std::map<char32_t, uint32_t>> trie(1);
+			std::vector<std::vector<uint32_t>> ends(1);
+			patterns.clear();
+			for (const auto& [word, lib_id, item_id] : words)
+			{
+				if (word.empty())
+					continue;
+				uint32_t s = 0;
+				for (char32_t ch : word)
+				{
+					ch = text::fold(ch);
+					auto it = trie[s].find(ch);
+					if (it == trie[s].end())
+					{
+						uint32_t t = static_cast<uint32_t>(trie.size());
+						trie[s].emplace(ch, t);
+						trie.emplace_back();
+						ends.emplace_back();
+						s = t;
+					}
+					else
+						s = it->second;
+				}
+				ends[s].push_back(static_cast<uint32_t>(patterns.size()));
+				patterns.push_back({ static_cast<uint32_t>(word.length()), lib_id, item_id });
+			}
+
+			// 展开为紧凑的数组。
+			nodes.assign(trie.size(), node());
+			edges.clear();
+			outputs.clear();
+			for (size_t s = 0; s < trie.size(); s++)
+			{
+				nodes[s].edge_begin = static_cast<uint32_t>(edges.size());
+				nodes[s].edge_count = static_cast<uint32_t>(trie[s].size());
+				edges.insert(edges.end(), trie[s].begin(), trie[s].end());
+				nodes[s].out_begin = static_cast<uint32_t>(outputs.size());
+				nodes[s].out_count = static_cast<uint32_t>(ends[s].size());
+				outputs.insert(outputs.end(), ends[s].begin(), ends[s].end());
+			}
+			trie = {};
+			ends = {};
+			root_next.assign(0x10000, npos);
+			for (uint32_t i = 0; i < nodes[0].edge_count; i++)
+			{
+				const auto& [ch, t] = edges[nodes[0].edge_begin + i];
+				if (ch < root_next.size())
+					root_next[ch] = t;
+			}
+
+			// 按层计算失配指针和输出链。
+			std::vector<uint32_t> queue;
+			queue.reserve(nodes.size());
+			for (uint32_t i = 0; i < nodes[0].edge_count; i++)
+				queue.push_back(edges[nodes[0].edge_begin + i].second);
+			for (size_t head = 0; head < queue.size(); head++)
+			{
+				uint32_t s = queue[head];
+				for (uint32_t i = 0; i < nodes[s].edge_count; i++)
+				{
+					auto [ch, t] = edges[nodes[s].edge_begin + i];
+					uint32_t f = nodes[s].fail;
+					uint32_t next;
+					while ((next = child(f, ch)) == npos && f)
+						f = nodes[f].fail;
+					nodes[t].fail = next == npos ? 0 : next;
+					uint32_t ft = nodes[t].fail;
+					nodes[t].dict = nodes[ft].out_count ? ft : nodes[ft].dict;
+					queue.push_back(t);
+				}
+			}
+		}
+
+		/// <returns>
+		/// 模式的数量。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			return patterns.size();
+		}
+
+		/// <summary>
+		/// 扫描文本，对每次匹配调用 callback(hit)。匹配按结束位置的顺序给出。
+		/// </summary>
+		/// <param name="content">文本。</param>
+		/// <param name="callback">形如 void(const hit&) 的回调。</param>
+		template <typename callback_t>
+		void scan(std::u32string_view content, callback_t&& callback) const
+		{
+			if (nodes.empty())
+				return;
+			auto emit = [&](uint32_t s, size_t end)
+			{
+				for (uint32_t i = 0; i < nodes[s].out_count; i++)
+				{
+					const auto& p = patterns[outputs[nodes[s].out_begin + i]];
+					size_t begin = end - p.length;
+					if (whole_word)
+					{
+						// 词的首尾是非 CJK 的字符时，要求它们不与相邻的字符连成一个单词。
+						if (begin > 0 && !text::is_cjk(content[begin]) && text::is_word_char(content[begin])
+							&& text::is_word_char(content[begin - 1]) && !text::is_cjk(content[begin - 1]))
+							continue;
+						if (end < content.length() && !text::is_cjk(content[end - 1]) && text::is_word_char(content[end - 1])
+							&& text::is_word_char(content[end]) && !text::is_cjk(content[end]))
+							continue;
+					}
+					callback(hit{ begin, p.length, p.lib_id, p.item_id });
+				}
+			};
+
+			uint32_t s = 0;
+			for (size_t i = 0; i < content.length(); i++)
+			{
+				char32_t ch = text::fold(content[i]);
+				uint32_t next;
+				while ((next = child(s, ch)) == npos && s)
+					s = nodes[s].fail;
+				s = next == npos ? 0 : next;
+				for (uint32_t t = s; t != npos; t = nodes[t].dict)
+					if (nodes[t].out_count)
+						emit(t, i + 1);
+			}
+		}
+		/// <summary>
+		/// 扫描文本，返回所有匹配。
+		/// </summary>
+		[[nodiscard]] std::vector<hit> scan(std::u32string_view content) const
+		{
+			std::vector<hit> ret;
+			scan(content, [&ret](const hit& h) { ret.push_back(h); });
+			return ret;
+		}
+	};
+
+	/// <summary>
+	/// 维护若干库中所有 item 的一般式和变体，并在后台线程中重新构造 aho_corasick。item 变化时只需要更新对应的词，扫描总是使用最近一次构造完成的自动机，不会等待构造。
+	/// </summary>
+	class item_matcher final
+	{
+	private:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+		mutable std::mutex mutex;
+		std::condition_variable cv;
+		std::map<key_t, std::vector<std::u32string>> headwords;
+		std::shared_ptr<const aho_corasick> current{ std::make_shared<aho_corasick>() };
+		uint64_t generation{}; // headwords 的版本。
+		uint64_t built_generation{}; // current 对应的版本。
+		bool stopping{};
+		std::thread worker;
+
+		void work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				cv.wait(lock, [this]() { return stopping || built_generation != generation; });
+				if (stopping)
+					return;
+
+				uint64_t target = generation;
+				std::vector<std::tuple<std::u32string, id_t, id_t>> words;
+				for (const auto& [key, ws] : headwords)
+					for (const auto& w : ws)
+						words.emplace_back(w, key.first, key.second);
+				lock.unlock();
+
+				auto ac = std::make_shared<aho_corasick>();
+				ac->build(words);
+
+				lock.lock();
+				current = std::move(ac);
+				built_generation = target;
+				cv.notify_all();
+			}
+		}
+		void touch()
+		{
+			generation++;
+			cv.notify_all();
+		}
+
+	public:
+		item_matcher() : worker(&item_matcher::work, this) {}
+		~item_matcher()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			cv.notify_all();
+			worker.join();
+		}
+		item_matcher(const item_matcher&) = delete;
+		item_matcher& operator=(const item_matcher&) = delete;
+
+		/// <summary>
+		/// 添加或更新一个 item 的词。
+		/// </summary>
+		void update(id_t lib_id, const item& it)
+		{
+			std::vector<std::u32string> ws;
+			ws.reserve(1 + it.variants.size());
+			ws.push_back(it.origin);
+			ws.insert(ws.end(), it.variants.begin(), it.variants.end());
+			std::lock_guard<std::mutex> lock(mutex);
+			headwords[{ lib_id, it.id }] = std::move(ws);
+			touch();
+		}
+		/// <summary>
+		/// 移除一个 item 的词。
+		/// </summary>
+		void remove(id_t lib_id, id_t item_id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (headwords.erase({ lib_id, item_id }))
+				touch();
+		}
+		/// <summary>
+		/// 添加库中所有 item 的词。库中已有的词会被替换。
+		/// </summary>
+		void add_library(const library& lib)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			headwords.erase(headwords.lower_bound({ lib.id, 0 }), headwords.upper_bound({ lib.id, std::numeric_limits<id_t>::max() }));
+			for (const auto& [id, it] : lib.items)
+			{
+				auto& ws = headwords[{ lib.id, id }];
+				ws.push_back(it.origin);
+				ws.insert(ws.end(), it.variants.begin(), it.variants.end());
+			}
+			touch();
+		}
+		/// <summary>
+		/// 移除库中所有 item 的词。
+		/// </summary>
+		void remove_library(id_t lib_id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			headwords.erase(headwords.lower_bound({ lib_id, 0 }), headwords.upper_bound({ lib_id, std::numeric_limits<id_t>::max() }));
+			touch();
+		}
+		/// <summary>
+		/// 移除所有词。
+		/// </summary>
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			headwords.clear();
+			touch();
+		}
+
+		/// <returns>
+		/// 最近一次构造完成的自动机。可能不包含最新的修改。
+		/// </returns>
+		[[nodiscard]] std::shared_ptr<const aho_corasick> snapshot() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return current;
+		}
+		/// <summary>
+		/// 等待后台构造完成，返回包含所有修改的自动机。
+		/// </summary>
+		[[nodiscard]] std::shared_ptr<const aho_corasick> wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this]() { return built_generation == generation; });
+			return current;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+﻿#pragma once
+
+#include <set>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <filesystem>
+#include <atomic>
+#include <thread>
+
+#include "cppver.hpp"
+
+#if __windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace miao::core
+{
+	/// <summary>
+	/// 原子地替换文件：先写入同一目录下的临时文件并同步到磁盘，再重命名为目标文件。写入时程序崩溃或磁盘已满，目标文件仍然是完整的旧内容。
+	/// 重命名后还需要同步所在的目录，重命名才能在断电后保留。大量写入时可以用 directory_batch 把同一目录的同步合并为一次。
+	/// </summary>
+	namespace atomic_file
+	{
+		/// <summary>
+		/// 在当前线程中合并目录的同步。存在时，write 只记录目录，在 commit 或析构时每个目录同步一次。可以嵌套，只有最内层的生效。
+		/// </summary>
+		class directory_batch final
+		{
+		private:
+			std::set<std::filesystem::path> dirs;
+			directory_batch* previous;
+
+			static directory_batch*& current()
+			{
+				thread_local directory_batch* ret{};
+				return ret;
+			}
+
+		public:
+			directory_batch() : previous(current())
+			{
+				current() = this;
+			}
+			~directory_batch()
+			{
+				commit();
+				current() = previous;
+			}
+			directory_batch(const directory_batch&) = delete;
+			directory_batch& operator=(const directory_batch&) = delete;
+
+			/// <returns>
+			/// 当前线程中的 directory_batch。如果不存在，返回 nullptr。
+			/// </returns>
+			[[nodiscard]] static directory_batch* active()
+			{
+				return current();
+			}
+			void add(std::filesystem::path dir)
+			{
+				dirs.insert(std::move(dir));
+			}
+			/// <summary>
+			/// 同步记录的所有目录。
+			/// </summary>
+			/// <returns>全部成功返回 true，否则返回 false。</returns>
+			bool commit();
+		};
+
+		/// <summary>
+		/// 把目录同步到磁盘，使其中的重命名在断电后保留。Windows 下重命名时已经同步，不需要操作。
+		/// </summary>
+		/// <returns>成功返回 true，否则返回 false。</returns>
+		inline bool sync_directory(const std::filesystem::path& dir)
+		{
+#if __windows
+			(void)dir;
+			return true;
+#else
+			int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+			bool ret = ::fsync(fd) == 0;
+			::close(fd);
+			return ret;
+#endif
+		}
+
+		inline bool directory_batch::commit()
+		{
+			bool ret = true;
+			for (const auto& dir : dirs)
+				ret &= sync_directory(dir);
+			dirs.clear();
+			return ret;
+		}
+
+		/// <returns>
+		/// 目标文件同一目录下的临时文件名。名字包含进程 id、线程 id 和进程内的序号，同时写入同一个文件的线程或进程不会共用临时文件。
+		/// </returns>
+		inline std::filesystem::path temp_path(const std::filesystem::path& path)
+		{
+			static std::atomic<uint64_t> serial{};
+#if __windows
+			auto pid = GetCurrentProcessId();
+#else
+			auto pid = ::getpid();
+#endif
+			auto ret = path;
+			ret += "." + std::to_string(pid) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "." + std::to_string(serial++) + ".tmp";
+			return ret;
+		}
+
+		/// <summary>
+		/// 用 data 原子地替换文件的内容。如果失败，抛出 std::runtime_error 异常，目标文件不变。
+		/// </summary>
+		/// <param name="path">目标文件。所在的目录需要已经存在。</param>
+		/// <param name="data">文件的全部内容。</param>
+		inline void write(std::filesystem::path path, std::string_view data)
+		{
+			path.make_preferred();
+			auto temp = temp_path(path);
+
+#if __windows
+			HANDLE file = CreateFileW(temp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("fail to create the temporary file.");
+			bool ok = true;
+			for (size_t pos = 0; ok && pos < data.size();)
+			{
+				DWORD n{};
+				DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - pos, 1u << 30));
+				ok = WriteFile(file, data.data() + pos, chunk, &n, nullptr) && n;
+				pos += n;
+			}
+			ok = ok && FlushFileBuffers(file);
+			CloseHandle(file);
+			if (!ok || !MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+			{
+				DeleteFileW(temp.c_str());
+				throw std::runtime_error("fail to replace the file.");
+			}
+#else
+			int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0)
+				throw std::runtime_error("fail to create the temporary file.");
+			bool ok = true;
+			for (size_t pos = 0; ok && pos < data.size();)
+			{
+				ssize_t n = ::write(fd, data.data() + pos, data.size() - pos);
+				if (n < 0 && errno == EINTR)
+					continue;
+				ok = n > 0;
+				if (ok)
+					pos += static_cast<size_t>(n);
+			}
+			ok = ok && ::fsync(fd) == 0;
+			ok = ::close(fd) == 0 && ok;
+			if (!ok || ::rename(temp.c_str(), path.c_str()) != 0)
+			{
+				::unlink(temp.c_str());
+				throw std::runtime_error("fail to replace the file.");
+			}
+#endif
+
+			if (auto batch = directory_batch::active())
+				batch->add(path.parent_path());
+			else
+				sync_directory(path.parent_path());
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core::binary
+{
+	/// <summary>
+	/// 以小端序将整数追加到字节缓冲区。
+	/// </summary>
+	template <typename T>
+	void put(std::string& out, T v)
+	{
+		static_assert(std::is_unsigned_v<T>);
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			out.push_back(static_cast<char>(v & 0xFF));
+			v = static_cast<T>(v >> 8);
+		}
+	}
+	/// <summary>
+	/// 以小端序从字节缓冲区读取整数。调用者需保证缓冲区足够长。
+	/// </summary>
+	template <typename T>
+	[[nodiscard]] T get(const char* p)
+	{
+		static_assert(std::is_unsigned_v<T>);
+		T v{};
+		for (size_t i = sizeof(T); i-- > 0;)
+			v = static_cast<T>((v << 8) | static_cast<unsigned char>(p[i]));
+		return v;
+	}
+
+	/// <summary>
+	/// 以 LEB128 变长编码将无符号整数追加到字节缓冲区，每字节 7 位，小的数占用的字节少。
+	/// </summary>
+	inline void put_varint(std::string& out, uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<char>(v));
+	}
+	/// <summary>
+	/// 从 [p, end) 读取一个 LEB128 变长编码的整数，成功时 p 移动到整数之后。
+	/// </summary>
+	/// <returns>如果缓冲区中的整数不完整或超过 64 位，返回 false，p 不变。</returns>
+	[[nodiscard]] inline bool get_varint(const char*& p, const char* end, uint64_t& v)
+	{
+		uint64_t ret{};
+		for (const char* q = p; q != end && q - p < 10; q++)
+		{
+			auto byte = static_cast<unsigned char>(*q);
+			ret |= static_cast<uint64_t>(byte & 0x7F) << (7 * (q - p));
+			if (!(byte & 0x80))
+			{
+				v = ret;
+				p = q + 1;
+				return true;
+			}
+		}
+		return false;
+	}
+	/// <summary>
+	/// ZigZag 编码，使绝对值小的有符号整数变为小的无符号整数。
+	/// </summary>
+	[[nodiscard]] constexpr uint64_t zigzag(int64_t v)
+	{
+		return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+	}
+	[[nodiscard]] constexpr int64_t unzigzag(uint64_t v)
+	{
+		return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+	}
+
+	/// <summary>
+	/// 64 位 FNV-1a 哈希。结果与平台无关，可以保存到文件中。
+	/// </summary>
+	[[nodiscard]] constexpr uint64_t fnv1a(std::string_view data, uint64_t h = 0xCBF29CE484222325ull)
+	{
+		for (char ch : data)
+		{
+			h ^= static_cast<unsigned char>(ch);
+			h *= 0x100000001B3ull;
+		}
+		return h;
+	}
+	/// <summary>
+	/// 64 位 xxHash（XXH64）。每次处理 32 字节，比 fnv1a 快得多，适合校验整个文件的内容。结果与平台无关，可以保存到文件中。
+	/// </summary>
+	[[nodiscard]] inline uint64_t xxh64(std::string_view data, uint64_t seed = 0)
+	{
+		constexpr uint64_t p1 = 0x9E3779B185EBCA87ull, p2 = 0xC2B2AE3D27D4EB4Full, p3 = 0x165667B19E3779F9ull, p4 = 0x85EBCA77C2B2AE63ull, p5 = 0x27D4EB2F165667C5ull;
+		auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+		auto round = [rotl](uint64_t acc, uint64_t input) { return rotl(acc + input * p2, 31) * p1; };
+		auto merge = [round](uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * p1 + p4; };
+
+		const char* p = data.data();
+		const char* end = p + data.size();
+		uint64_t h;
+		if (data.size() >= 32)
+		{
+			uint64_t v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+			for (; end - p >= 32; p += 32)
+			{
+				v1 = round(v1, get<uint64_t>(p));
+				v2 = round(v2, get<uint64_t>(p + 8));
+				v3 = round(v3, get<uint64_t>(p + 16));
+				v4 = round(v4, get<uint64_t>(p + 24));
+			}
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		}
+		else
+			h = seed + p5;
+		h += data.size();
+
+		for (; end - p >= 8; p += 8)
+			h = rotl(h ^ round(0, get<uint64_t>(p)), 27) * p1 + p4;
+		if (end - p >= 4)
+		{
+			h = rotl(h ^ get<uint32_t>(p) * p1, 23) * p2 + p3;
+			p += 4;
+		}
+		for (; p != end; p++)
+			h = rotl(h ^ static_cast<unsigned char>(*p) * p5, 11) * p1;
+
+		h ^= h >> 33;
+		h *= p2;
+		h ^= h >> 29;
+		h *= p3;
+		h ^= h >> 32;
+		return h;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 布隆过滤器，用于快速排除不在集合中的元素。元素以 64 位哈希值给出，由它派生出 k 个位置。不支持删除，可能误报但不会漏报。
+	/// </summary>
+	class bloom_filter final
+	{
+	private:
+		std::vector<uint64_t> bits;
+		uint64_t mask{}; // 位数减一，位数总是 2 的幂。
+		uint32_t k{ 1 };
+		size_t count{};
+
+		/// <summary>
+		/// 第 i 个位置。使用双重哈希，高 32 位为步长，步长总是奇数，保证在 2 的幂的表上不退化。
+		/// </summary>
+		[[nodiscard]] uint64_t position(uint64_t h, uint32_t i) const
+		{
+			uint64_t step = (h >> 32) | 1;
+			return (h + i * step) & mask;
+		}
+
+	public:
+		bloom_filter()
+		{
+			reset(0);
+		}
+		/// <param name="expected">预计的元素个数。</param>
+		/// <param name="fpp">预计元素个数下的误报率。</param>
+		explicit bloom_filter(size_t expected, double fpp = 0.01)
+		{
+			reset(expected, fpp);
+		}
+
+		/// <summary>
+		/// 清空并按新的容量重新分配。
+		/// </summary>
+		/// <param name="expected">预计的元素个数。</param>
+		/// <param name="fpp">预计元素个数下的误报率。</param>
+		void reset(size_t expected, double fpp = 0.01)
+		{
+			constexpr double ln2 = 0.69314718055994530942;
+			fpp = std::clamp(fpp, 1e-9, 0.5);
+			double m = -static_cast<double>(std::max<size_t>(expected, 64)) * std::log(fpp) / (ln2 * ln2);
+			uint64_t n_bits = 64;
+			while (n_bits < m)
+				n_bits <<= 1;
+			bits.assign(n_bits / 64, 0);
+			mask = n_bits - 1;
+			k = std::clamp(static_cast<uint32_t>(std::lround(-std::log(fpp) / ln2)), 1u, 16u);
+			count = 0;
+		}
+		/// <summary>
+		/// 清空所有元素，保留容量。
+		/// </summary>
+		void clear()
+		{
+			std::fill(bits.begin(), bits.end(), 0);
+			count = 0;
+		}
+
+		void insert(uint64_t h)
+		{
+			for (uint32_t i = 0; i < k; i++)
+			{
+				uint64_t p = position(h, i);
+				bits[p >> 6] |= 1ull << (p & 63);
+			}
+			count++;
+		}
+		/// <returns>
+		/// 如果返回 false，元素一定不在集合中；如果返回 true，元素可能在集合中。
+		/// </returns>
+		[[nodiscard]] bool possibly_contains(uint64_t h) const
+		{
+			for (uint32_t i = 0; i < k; i++)
+			{
+				uint64_t p = position(h, i);
+				if (!(bits[p >> 6] >> (p & 63) & 1))
+					return false;
+			}
+			return true;
+		}
+
+		/// <returns>
+		/// 插入过的次数（包括重复插入）。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			return count;
+		}
+		/// <returns>
+		/// 位数。
+		/// </returns>
+		[[nodiscard]] size_t bit_count() const
+		{
+			return static_cast<size_t>(mask + 1);
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,258 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "library.hpp"
+#include "ring_buffer.hpp"
+#include "resident_scheduler.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 轮巡显示的调度器。按顺序循环显示选中的词，每个词的等待时间由出现次数（n_flick）、手动暂停次数（n_pause）和要求朗读次数（n_pronounce）决定：出现得越多越快，暂停和朗读得越多越慢。
+	/// 接下来的若干个词和它们的等待时间成批预先计算；最近显示过的词保存在固定大小的环形缓冲区中，供暂停时显示。调度器只保存计数的副本，不保存 item 的字符串，所有操作都不访问磁盘，耗时只与预取的个数有关，与词的总数无关。调用者负责把计数写回 item。不是线程安全的。
+	/// </summary>
+	class carousel_scheduler final
+	{
+	public:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+		/// <summary>
+		/// 轮巡显示相关的计数。
+		/// </summary>
+		struct counters
+		{
+			uint_t n_flick{};
+			uint_t n_pause{};
+			uint_t n_pronounce{};
+		};
+		/// <summary>
+		/// 一次显示。
+		/// </summary>
+		struct entry
+		{
+			key_t key{};
+			uint_t dwell{}; // 等待时间（毫秒）。
+		};
+
+	private:
+		struct word
+		{
+			size_t index{}; // 在 order 中的下标。
+			counters c;
+		};
+
+		std::vector<key_t> order; // 轮巡的顺序。
+		std::unordered_map<key_t, word, item_key_hash> words;
+		size_t cursor{}; // order 中下一个要预取的下标。
+
+		std::deque<entry> upcoming; // 预先计算的接下来的词。
+		ring_buffer<entry> history; // 最近显示过的词。
+		std::optional<entry> current;
+
+		/// <summary>
+		/// 预取一批词，直到预取的个数达到 prefetch_size。
+		/// </summary>
+		void refill()
+		{
+			if (order.empty())
+				return;
+			while (upcoming.size() < prefetch_size)
+			{
+				if (cursor >= order.size())
+					cursor = 0;
+				const auto& key = order[cursor++];
+				upcoming.push_back({ key, dwell_of(words[key].c) });
+			}
+		}
+		/// <summary>
+		/// 计数改变后，更新已经预取的等待时间。
+		/// </summary>
+		void refresh(const key_t& key, const counters& c)
+		{
+			uint_t dwell = dwell_of(c);
+			for (auto& e : upcoming)
+				if (e.key == key)
+					e.dwell = dwell;
+		}
+
+	public:
+		uint_t base_dwell{ 3000 }; // 新词的等待时间（毫秒）。
+		uint_t min_dwell{ 800 };
+		uint_t max_dwell{ 15000 };
+		double flick_weight{ 0.25 }; // 出现次数每翻一倍，等待时间缩短的比例。
+		double pause_weight{ 0.5 }; // 每次暂停增加的等待时间的比例。
+		double pronounce_weight{ 0.25 }; // 每次朗读增加的等待时间的比例。
+		size_t prefetch_size{ 32 }; // 预先计算的词的个数。
+
+		/// <param name="history_size">暂停时显示的最近的词的个数。</param>
+		explicit carousel_scheduler(size_t history_size = 8) : history(history_size) {}
+
+		/// <returns>
+		/// 给定计数时的等待时间（毫秒）。
+		/// </returns>
+		[[nodiscard]] uint_t dwell_of(const counters& c) const
+		{
+			double t = static_cast<double>(base_dwell);
+			t /= 1.0 + flick_weight * std::log2(1.0 + static_cast<double>(c.n_flick));
+			t *= 1.0 + pause_weight * static_cast<double>(c.n_pause) + pronounce_weight * static_cast<double>(c.n_pronounce);
+			return std::clamp(static_cast<uint_t>(t), min_dwell, std::max(min_dwell, max_dwell));
+		}
+
+		/// <returns>
+		/// 参与轮巡的词的个数。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			return order.size();
+		}
+		/// <summary>
+		/// 移除所有词和最近显示的记录。
+		/// </summary>
+		void clear()
+		{
+			order.clear();
+			words.clear();
+			upcoming.clear();
+			history.clear();
+			current.reset();
+			cursor = 0;
+		}
+		/// <summary>
+		/// 把 item 加到轮巡的末尾。如果已经存在，只更新计数。
+		/// </summary>
+		void add(id_t lib_id, const item& it)
+		{
+			key_t key{ lib_id, it.id };
+			counters c{ it.n_flick, it.n_pause, it.n_pronounce };
+			auto [w, inserted] = words.try_emplace(key, word{ order.size(), c });
+			if (inserted)
+				order.push_back(key);
+			else
+			{
+				w->second.c = c;
+				refresh(key, c);
+			}
+		}
+		/// <summary>
+		/// 把库中所有 item 加到轮巡的末尾。
+		/// </summary>
+		void add_library(const library& lib)
+		{
+			order.reserve(order.size() + lib.items.size());
+			words.reserve(words.size() + lib.items.size());
+			for (const auto& [id, it] : lib.items)
+				add(lib.id, it);
+		}
+		/// <summary>
+		/// 移除一个词。这一轮还没有预取的最后一个词会被移到它的位置上，因此这一轮中其他的词都不会被跳过。已经预取的这个词也会被移除。
+		/// </summary>
+		void remove(id_t lib_id, id_t item_id)
+		{
+			key_t key{ lib_id, item_id };
+			auto w = words.find(key);
+			if (w == words.end())
+				return;
+			size_t i = w->second.index;
+			words.erase(w);
+			if (i < cursor)
+			{
+				// 这一轮已经预取过的位置。先与 cursor 前一个位置上的词交换，使空出的位置成为这一轮还没有预取的第一个位置。
+				cursor--;
+				if (i != cursor)
+				{
+					order[i] = order[cursor];
+					words[order[i]].index = i;
+				}
+				i = cursor;
+			}
+			if (i != order.size() - 1)
+			{
+				order[i] = order.back();
+				words[order[i]].index = i;
+			}
+			order.pop_back();
+			if (cursor > order.size())
+				cursor = 0;
+			upcoming.erase(std::remove_if(upcoming.begin(), upcoming.end(),
+				[&key](const entry& e) { return e.key == key; }), upcoming.end());
+		}
+
+		/// <summary>
+		/// 切换到下一个词，并增加它的出现次数。
+		/// </summary>
+		/// <returns>要显示的词和等待时间。如果没有词，返回 std::nullopt。</returns>
+		std::optional<entry> next()
+		{
+			if (upcoming.size() * 2 <= prefetch_size)
+				refill();
+			if (upcoming.empty())
+				return std::nullopt;
+			entry e = upcoming.front();
+			upcoming.pop_front();
+			auto& c = words[e.key].c;
+			c.n_flick++;
+			refresh(e.key, c);
+			history.push(e);
+			current = e;
+			return e;
+		}
+		/// <returns>
+		/// 当前显示的词。
+		/// </returns>
+		[[nodiscard]] std::optional<entry> current_entry() const
+		{
+			return current;
+		}
+		/// <returns>
+		/// 已经预取的接下来的词，按显示的顺序。
+		/// </returns>
+		[[nodiscard]] const std::deque<entry>& upcoming_entries() const
+		{
+			return upcoming;
+		}
+		/// <returns>
+		/// 最近显示过的词，从新到旧，最多 history_size 个，供暂停时显示。
+		/// </returns>
+		[[nodiscard]] std::vector<entry> recent() const
+		{
+			return history.to_vector();
+		}
+
+		/// <summary>
+		/// 记录用户在显示某个词时暂停。
+		/// </summary>
+		/// <returns>更新后的计数。如果词不存在，返回 std::nullopt。</returns>
+		std::optional<counters> paused(id_t lib_id, id_t item_id)
+		{
+			auto w = words.find({ lib_id, item_id });
+			if (w == words.end())
+				return std::nullopt;
+			w->second.c.n_pause++;
+			refresh(w->first, w->second.c);
+			return w->second.c;
+		}
+		/// <summary>
+		/// 记录用户要求朗读某个词。
+		/// </summary>
+		/// <returns>更新后的计数。如果词不存在，返回 std::nullopt。</returns>
+		std::optional<counters> pronounced(id_t lib_id, id_t item_id)
+		{
+			auto w = words.find({ lib_id, item_id });
+			if (w == words.end())
+				return std::nullopt;
+			w->second.c.n_pronounce++;
+			refresh(w->first, w->second.c);
+			return w->second.c;
+		}
+		/// <returns>
+		/// 词的计数。如果词不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<counters> counters_of(id_t lib_id, id_t item_id) const
+		{
+			auto w = words.find({ lib_id, item_id });
+			if (w == words.end())
+				return std::nullopt;
+			return w->second.c;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "binary.hpp"
+#include "atomic_file.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 一个库中文件的校验和索引，保存在库目录下的 checksums.idx 中。加载时检查文件前先与索引比较：内容的长度、xxHash 和版本都一致的文件上次检查时是完好的，不需要再解析和修复。
+	/// 索引只用于加快检查，内容丢失或与文件不一致时只会使对应的文件被完整地检查一次。
+	/// </summary>
+	/// <remarks>
+	/// 文件以 8 字节的文件头开始（"MDCK" 和 u32 版本号），之后是记录的个数（变长整数）和若干记录，最后是之前所有字节的 xxh64（u64）。每条记录依次是：文件种类（u8）、id（变长整数）、内容的字节数（变长整数）、检查时的最新版本（变长整数）、内容的 xxh64（u64）。
+	/// </remarks>
+	class checksum_index final
+	{
+	public:
+		/// <summary>
+		/// 文件的种类。
+		/// </summary>
+		enum class file_kind : uint8_t
+		{
+			item,
+			passage,
+			raw_items, // raw_items.json，id 总是 0。
+		};
+
+		/// <summary>
+		/// 一个文件检查时的内容。
+		/// </summary>
+		struct entry
+		{
+			uint64_t size{};
+			uint64_t hash{};
+			uint32_t ver_tag{}; // 检查时这种文件的最新版本。版本更新后需要重新检查。
+
+			[[nodiscard]] bool operator==(const entry& rhs) const
+			{
+				return size == rhs.size && hash == rhs.hash && ver_tag == rhs.ver_tag;
+			}
+			[[nodiscard]] bool operator!=(const entry& rhs) const
+			{
+				return !(*this == rhs);
+			}
+		};
+
+	private:
+		static constexpr char magic[4]{ 'M', 'D', 'C', 'K' };
+		static constexpr uint32_t version = 1;
+		static constexpr size_t file_header_size = 8;
+		static constexpr uint8_t max_kind = static_cast<uint8_t>(file_kind::raw_items);
+
+		std::map<std::pair<file_kind, id_t>, entry> entries;
+
+		[[nodiscard]] static entry make_entry(std::string_view content, int ver_tag)
+		{
+			return { content.size(), binary::xxh64(content), static_cast<uint32_t>(ver_tag) };
+		}
+
+	public:
+		/// <summary>
+		/// 读取整个文件。
+		/// </summary>
+		/// <returns>成功返回 true，否则返回 false。</returns>
+		static bool read_file(const std::filesystem::path& path, std::string& out)
+		{
+			std::ifstream ifs(path, std::ios::binary);
+			if (!ifs)
+				return false;
+			ifs.seekg(0, std::ios::end);
+			auto size = ifs.tellg();
+			if (size < 0)
+				return false;
+			ifs.seekg(0, std::ios::beg);
+			out.resize(static_cast<size_t>(size));
+			ifs.read(out.data(), out.size());
+			return static_cast<size_t>(ifs.gcount()) == out.size();
+		}
+
+		/// <summary>
+		/// 从文件中读取索引，替换当前的内容。文件不存在或损坏时索引为空。
+		/// </summary>
+		/// <returns>成功读取返回 true，否则返回 false。</returns>
+		bool load(const std::filesystem::path& path)
+		{
+			entries.clear();
+			std::string buf;
+			if (!read_file(path, buf) || buf.size() < file_header_size + 8
+				|| buf.compare(0, 4, magic, 4) != 0
+				|| binary::get<uint32_t>(buf.data() + 4) != version
+				|| binary::get<uint64_t>(buf.data() + buf.size() - 8) != binary::xxh64(std::string_view(buf.data(), buf.size() - 8)))
+				return false;
+
+			const char* p = buf.data() + file_header_size;
+			const char* end = buf.data() + buf.size() - 8;
+			uint64_t n;
+			if (!binary::get_varint(p, end, n))
+				return false;
+			for (uint64_t i = 0; i < n; i++)
+			{
+				if (p == end)
+					break;
+				auto kind = static_cast<uint8_t>(*p++);
+				uint64_t id, size, ver_tag;
+				if (kind > max_kind
+					|| !binary::get_varint(p, end, id)
+					|| !binary::get_varint(p, end, size)
+					|| !binary::get_varint(p, end, ver_tag)
+					|| end - p < 8)
+					break;
+				entries[{ static_cast<file_kind>(kind), static_cast<id_t>(id) }] = { size, binary::get<uint64_t>(p), static_cast<uint32_t>(ver_tag) };
+				p += 8;
+			}
+			if (entries.size() != n)
+			{
+				entries.clear();
+				return false;
+			}
+			return true;
+		}
+		/// <summary>
+		/// 原子地把索引写入文件。如果失败，抛出 std::runtime_error 异常，文件不变。
+		/// </summary>
+		void save(const std::filesystem::path& path) const
+		{
+			std::string buf(magic, 4);
+			binary::put<uint32_t>(buf, version);
+			binary::put_varint(buf, entries.size());
+			for (const auto& [key, e] : entries)
+			{
+				buf.push_back(static_cast<char>(key.first));
+				binary::put_varint(buf, key.second);
+				binary::put_varint(buf, e.size);
+				binary::put_varint(buf, e.ver_tag);
+				binary::put<uint64_t>(buf, e.hash);
+			}
+			binary::put<uint64_t>(buf, binary::xxh64(buf));
+			atomic_file::write(path, buf);
+		}
+
+		/// <param name="content">文件现在的内容。</param>
+		/// <param name="ver_tag">这种文件现在的最新版本。</param>
+		/// <returns>
+		/// 文件是否与索引中的记录一致。没有记录时返回 false。
+		/// </returns>
+		[[nodiscard]] bool verify(file_kind kind, id_t id, std::string_view content, int ver_tag) const
+		{
+			auto it = entries.find({ kind, id });
+			if (it == entries.end())
+				return false;
+			const auto& e = it->second;
+			return e.size == content.size() && e.ver_tag == static_cast<uint32_t>(ver_tag) && e.hash == binary::xxh64(content);
+		}
+		/// <summary>
+		/// 记录一个检查过的文件的内容。
+		/// </summary>
+		void record(file_kind kind, id_t id, std::string_view content, int ver_tag)
+		{
+			entries[{ kind, id }] = make_entry(content, ver_tag);
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return entries.size();
+		}
+		[[nodiscard]] bool operator==(const checksum_index& rhs) const
+		{
+			return entries == rhs.entries;
+		}
+		[[nodiscard]] bool operator!=(const checksum_index& rhs) const
+		{
+			return !(*this == rhs);
+		}
+	};
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include "include.hpp"
+#include "snapshot.hpp"
+#include "write_queue.hpp"
 
 namespace miao::core
 {
@@ -52,6 +54,16 @@ namespace miao::core
 	};
 	class config final : protected Json::Value, public serializable_base
 	{
+	public:
+		/// <summary>
+		/// 已经解码的设置项。发布后不再修改，可以在任意线程中读取。
+		/// </summary>
+		struct settings
+		{
+			std::filesystem::path working_dir; // 工作目录。
+			std::u32string preferred_lang; // 本地语言。
+		};
+
 	public:
 		[[nodiscard]] virtual Json::Value to_json() const
 		{
@@ -60,18 +72,61 @@ namespace miao::core
 		virtual void from_json(const Json::Value& value)
 		{
 			Json::Value::operator=(value);
+			publish();
+		}
+
+	private:
+		write_queue writer; // 修改后在后台写入设置文件。
+		static config& instance()
+		{
+			static config _;
+			return _;
+		}
+		static atomic_shared_ptr<const settings>& published()
+		{
+			static atomic_shared_ptr<const settings> _;
+			return _;
+		}
+		/// <summary>
+		/// 解码所有设置项，替换当前的快照。在修改设置后调用，调用时持有视图的锁。
+		/// </summary>
+		void publish()
+		{
+			auto next = std::make_shared<settings>();
+			next->working_dir = working_dir();
+			next->preferred_lang = preferred_lang();
+			published().store(std::move(next));
+		}
+		/// <summary>
+		/// 登记写入设置文件。在修改设置后调用，调用时持有视图的锁。
+		/// </summary>
+		void save()
+		{
+			writer.enqueue("miao_dict_config.json", [v = to_json()](const std::filesystem::path& p)
+				{
+					std::u8string str = Json::write(v);
+					atomic_file::write(p, { reinterpret_cast<const char*>(str.data()), str.length() });
+				});
 		}
 
 	public:
 		/// <summary>
-		/// 返回一个自动为配置对象加锁的视图。如果接下来要在对象上进行一系列操作，应当将返回值保存在一个变量中。同一线程中不可同时存在两个这样的视图，否则会产生死锁。
+		/// 返回一个自动为配置对象加锁的视图，用于修改设置。如果接下来要在对象上进行一系列操作，应当将返回值保存在一个变量中。同一线程中不可同时存在两个这样的视图，否则会产生死锁。只读取设置时应当使用 current。
 		/// </summary>
 		/// <returns>自动加锁视图。</returns>
 		[[nodiscard]] static lock_view<config> view()
 		{
 			static lock_view_maker<config> lv_maker;
-			static config _;
-			return lv_maker.make_lock_view(_);
+			return lv_maker.make_lock_view(instance());
+		}
+		/// <summary>
+		/// 返回设置的快照。不持有全局互斥锁、不会因视图而死锁，也不分配内存，可以在任意线程中调用，也可以在持有视图时调用。读取快照指针本身可能使用标准库内部的短暂锁（std::atomic_load 和 std::atomic<std::shared_ptr> 都不是无锁的）。通过视图修改设置后，之后取得的快照反映修改，已经取得的快照不变。
+		/// </summary>
+		/// <returns>设置的快照。</returns>
+		[[nodiscard]] static std::shared_ptr<const settings> current()
+		{
+			instance(); // 确保已经从文件中加载。
+			return published().load();
 		}
 	private:
 		config()
@@ -84,11 +139,20 @@ namespace miao::core
 			{
 				Json::Value::operator[]("working_dir") = reinterpret_cast<const char*>(U""_u8.c_str());
 			}
+			publish();
 		}
 	public:
 		~config()
 		{
-			to_file("miao_dict_config.json");
+			writer.flush(); // 之后不会再写入较旧的设置。
+			try
+			{
+				to_file("miao_dict_config.json");
+			}
+			catch (const std::runtime_error&) // 无法写入时保留上次写入的设置。
+			{
+
+			}
 		}
 		config(const config&) = delete;
 		config(config&&) = delete;
@@ -103,6 +167,8 @@ namespace miao::core
 		void working_dir(std::filesystem::path new_dir)
 		{
 			Json::Value::operator[]("working_dir") = utf_conv<char32_t, char>::convert(new_dir.u32string());
+			publish();
+			save();
 		}
 
 		[[nodiscard]] std::u32string preferred_lang() const
@@ -112,6 +178,8 @@ namespace miao::core
 		void preferred_lang(std::u32string_view new_lang)
 		{
 			Json::Value::operator[]("preferred_lang") = utf_conv<char32_t, char>::convert(new_lang);
+			publish();
+			save();
 		}
 	};
 }
\ No newline at end of file
@@ -1,7 +1,40 @@
 ﻿#pragma once
 
+#include "atomic_file.hpp"
+#include "snapshot.hpp"
+#include "write_queue.hpp"
+#include "load_task.hpp"
+#include "directory_scan.hpp"
+#include "checksum_index.hpp"
+#include "file_watcher.hpp"
+#include "file_lock.hpp"
+#include "dictionary_image.hpp"
 #include "config.hpp"
 #include "utf_conv.hpp"
+#include "text.hpp"
 #include "item.hpp"
+#include "bloom_filter.hpp"
+#include "persistent_map.hpp"
+#include "raw_item_index.hpp"
 #include "library.hpp"
+#include "sentence.hpp"
+#include "segment_file.hpp"
+#include "tinylfu_cache.hpp"
+#include "sentence_store.hpp"
+#include "extractor.hpp"
+#include "double_array_trie.hpp"
+#include "segmenter.hpp"
+#include "aho_corasick.hpp"
+#include "indexed_heap.hpp"
+#include "random.hpp"
+#include "weighted_sampler.hpp"
+#include "resident_scheduler.hpp"
+#include "ring_buffer.hpp"
+#include "carousel_scheduler.hpp"
+#include "review_queue.hpp"
+#include "learning_events.hpp"
+#include "event_log.hpp"
+#include "mapped_file.hpp"
+#include "pronunciation_store.hpp"
+#include "query_cache.hpp"
 #include "system.hpp"
\ No newline at end of file
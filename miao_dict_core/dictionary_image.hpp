@@ -0,0 +1,429 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "binary.hpp"
+#include "atomic_file.hpp"
+#include "mapped_file.hpp"
+#include "file_lock.hpp"
+#include "snapshot.hpp"
+#include "directory_scan.hpp"
+#include "library.hpp"
+#include "query_cache.hpp"
+#include "utf_conv.hpp"
+
+#include <cstring>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 只读的词典映像。所有库的 item 和词形索引保存在一个文件中，多个进程可以同时把它映射到内存中直接查询，不需要读取和解析库目录，映射的页面由各个进程共享。
+	/// 映像目录中，每次生成的映像是一个新的文件（代数.img），generation 文件记录最新的代数，lock 文件协调各个进程：生成时独占，打开时共享，因此映像不会在打开的过程中被删除。已经打开映像的进程用 stale 检查是否有新的代数，用 refresh 重新映射。
+	/// 查询在映射的内存中进行，只解析查到的 item。所有成员函数都是线程安全的；重新映射时，已经开始的查询继续使用旧的映射。
+	/// </summary>
+	/// <remarks>
+	/// 映像文件以 64 字节的文件头开始："MDIM"、u32 版本号，之后依次是 u64 的代数、记录个数、记录表的位置、键的个数、键表的位置、数据区的位置、数据区的字节数。
+	/// 记录表中每条记录 32 字节：库 id、item id、item 的 JSON 在数据区中的位置和字节数（都是 u64），按（库 id，item id）排序。
+	/// 键表中每个键 16 字节：规范形式的 UTF-8 在数据区中的位置（u64）、字节数（u32）、记录的序号（u32），按（键，记录的序号）排序。
+	/// generation 文件为 "MDGN"、u32 版本号和 u64 的代数。
+	/// </remarks>
+	class dictionary_image final
+	{
+	public:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+	private:
+		static constexpr char magic[4]{ 'M', 'D', 'I', 'M' };
+		static constexpr char generation_magic[4]{ 'M', 'D', 'G', 'N' };
+		static constexpr uint32_t version = 1;
+		static constexpr size_t header_size = 64;
+		static constexpr size_t record_size = 32;
+		static constexpr size_t key_size = 16;
+
+		/// <summary>
+		/// 一个映射的映像。
+		/// </summary>
+		struct mapping
+		{
+			mapped_file file;
+			uint64_t generation{};
+			uint64_t n_records{};
+			uint64_t n_keys{};
+			const char* records{};
+			const char* keys{};
+			const char* blob{};
+			uint64_t blob_size{};
+
+			/// <summary>
+			/// 映射并检查文件头。如果失败，抛出 std::runtime_error 异常。
+			/// </summary>
+			explicit mapping(const std::filesystem::path& path) : file(path)
+			{
+				auto data = file.data();
+				uint64_t size = file.size();
+				if (size < header_size || std::memcmp(data, magic, 4) != 0 || binary::get<uint32_t>(data + 4) != version)
+					throw std::runtime_error("invalid dictionary image.");
+				generation = binary::get<uint64_t>(data + 8);
+				n_records = binary::get<uint64_t>(data + 16);
+				uint64_t records_offset = binary::get<uint64_t>(data + 24);
+				n_keys = binary::get<uint64_t>(data + 32);
+				uint64_t keys_offset = binary::get<uint64_t>(data + 40);
+				uint64_t blob_offset = binary::get<uint64_t>(data + 48);
+				blob_size = binary::get<uint64_t>(data + 56);
+				auto fits = [size](uint64_t offset, uint64_t count, uint64_t unit)
+				{
+					return offset <= size && count <= (size - offset) / unit;
+				};
+				if (!fits(records_offset, n_records, record_size) || !fits(keys_offset, n_keys, key_size) || !fits(blob_offset, blob_size, 1))
+					throw std::runtime_error("invalid dictionary image.");
+				records = data + records_offset;
+				keys = data + keys_offset;
+				blob = data + blob_offset;
+			}
+
+			[[nodiscard]] key_t record_key(uint64_t i) const
+			{
+				auto p = records + i * record_size;
+				return { binary::get<uint64_t>(p), binary::get<uint64_t>(p + 8) };
+			}
+			/// <returns>
+			/// 记录中 item 的 JSON。位置越界时返回空。
+			/// </returns>
+			[[nodiscard]] std::string_view record_json(uint64_t i) const
+			{
+				auto p = records + i * record_size;
+				uint64_t offset = binary::get<uint64_t>(p + 16), size = binary::get<uint64_t>(p + 24);
+				if (offset > blob_size || size > blob_size - offset)
+					return {};
+				return { blob + offset, static_cast<size_t>(size) };
+			}
+			[[nodiscard]] std::string_view key_text(uint64_t i) const
+			{
+				auto p = keys + i * key_size;
+				uint64_t offset = binary::get<uint64_t>(p);
+				uint32_t size = binary::get<uint32_t>(p + 8);
+				if (offset > blob_size || size > blob_size - offset)
+					return {};
+				return { blob + offset, size };
+			}
+			[[nodiscard]] uint32_t key_record(uint64_t i) const
+			{
+				return binary::get<uint32_t>(keys + i * key_size + 12);
+			}
+			/// <returns>
+			/// 规范形式为 word 的所有记录的序号。
+			/// </returns>
+			[[nodiscard]] std::vector<uint32_t> find(std::string_view word) const
+			{
+				uint64_t l = 0, r = n_keys;
+				while (l < r)
+				{
+					uint64_t mid = l + (r - l) / 2;
+					if (key_text(mid) < word)
+						l = mid + 1;
+					else
+						r = mid;
+				}
+				std::vector<uint32_t> ret;
+				for (; l < n_keys && key_text(l) == word; l++)
+					if (key_record(l) < n_records)
+						ret.push_back(key_record(l));
+				return ret;
+			}
+			/// <returns>
+			/// 记录的序号。如果不存在，返回 std::nullopt。
+			/// </returns>
+			[[nodiscard]] std::optional<uint64_t> find(key_t key) const
+			{
+				uint64_t l = 0, r = n_records;
+				while (l < r)
+				{
+					uint64_t mid = l + (r - l) / 2;
+					if (record_key(mid) < key)
+						l = mid + 1;
+					else
+						r = mid;
+				}
+				if (l < n_records && record_key(l) == key)
+					return l;
+				return std::nullopt;
+			}
+			/// <summary>
+			/// 解析一条记录。如果失败，抛出 std::runtime_error 异常。
+			/// </summary>
+			[[nodiscard]] item parse(uint64_t i) const
+			{
+				auto json = record_json(i);
+				item ret;
+				ret.from_string({ reinterpret_cast<const char8_t*>(json.data()), json.size() });
+				return ret;
+			}
+		};
+
+		std::filesystem::path dir;
+		atomic_shared_ptr<const mapping> current;
+		mutable std::mutex remap_mutex; // 保护 dir，attach、refresh 和 detach 之间互斥。
+
+		[[nodiscard]] static std::filesystem::path image_path(const std::filesystem::path& dir, uint64_t generation)
+		{
+			return dir / (std::to_string(generation) + ".img");
+		}
+		[[nodiscard]] static std::filesystem::path generation_path(const std::filesystem::path& dir)
+		{
+			return dir / "generation";
+		}
+		[[nodiscard]] static std::filesystem::path lock_path(const std::filesystem::path& dir)
+		{
+			return dir / "lock";
+		}
+		/// <returns>
+		/// 最新的代数。还没有生成映像或 generation 文件损坏时返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] static std::optional<uint64_t> read_generation(const std::filesystem::path& dir)
+		{
+			char buf[16]{};
+			std::ifstream ifs(generation_path(dir), std::ios::binary);
+			if (!ifs.read(buf, sizeof(buf)) || std::memcmp(buf, generation_magic, 4) != 0 || binary::get<uint32_t>(buf + 4) != version)
+				return std::nullopt;
+			return binary::get<uint64_t>(buf + 8);
+		}
+		[[nodiscard]] bool stale_locked() const
+		{
+			auto generation = read_generation(dir);
+			return generation && *generation != this->generation();
+		}
+		/// <summary>
+		/// 映射最新的映像。需要持有 remap_mutex。
+		/// </summary>
+		bool remap()
+		{
+			try
+			{
+				file_lock lock_file(lock_path(dir));
+				std::shared_lock<file_lock> lock(lock_file);
+				auto generation = read_generation(dir);
+				if (!generation)
+					return false;
+				current.store(std::make_shared<const mapping>(image_path(dir, *generation)));
+				return true;
+			}
+			catch (const std::runtime_error&)
+			{
+				return false;
+			}
+		}
+
+	public:
+		dictionary_image() = default;
+		dictionary_image(const dictionary_image&) = delete;
+		dictionary_image& operator=(const dictionary_image&) = delete;
+
+		/// <summary>
+		/// 打开映像目录中最新的映像。
+		/// </summary>
+		/// <param name="image_dir">映像目录。</param>
+		/// <returns>成功返回 true。目录中还没有映像或映像损坏时返回 false，之前打开的映像不变。</returns>
+		bool attach(std::filesystem::path image_dir)
+		{
+			std::lock_guard<std::mutex> lock(remap_mutex);
+			dir = std::move(image_dir);
+			return remap();
+		}
+		/// <summary>
+		/// 关闭映像。正在进行的查询结束后解除映射。
+		/// </summary>
+		void detach()
+		{
+			std::lock_guard<std::mutex> lock(remap_mutex);
+			current.store(nullptr);
+		}
+		[[nodiscard]] bool attached() const
+		{
+			return current.load() != nullptr;
+		}
+		/// <returns>
+		/// 打开的映像的代数。没有打开时返回 0。
+		/// </returns>
+		[[nodiscard]] uint64_t generation() const
+		{
+			auto m = current.load();
+			return m ? m->generation : 0;
+		}
+		/// <returns>
+		/// 是否已经生成了比打开的映像更新的映像。只读取 generation 文件。
+		/// </returns>
+		[[nodiscard]] bool stale() const
+		{
+			std::lock_guard<std::mutex> lock(remap_mutex);
+			return stale_locked();
+		}
+		/// <summary>
+		/// 如果有更新的映像，重新映射。
+		/// </summary>
+		/// <returns>重新映射了返回 true，否则返回 false。</returns>
+		bool refresh()
+		{
+			std::lock_guard<std::mutex> lock(remap_mutex);
+			if (!stale_locked())
+				return false;
+			return remap();
+		}
+
+		/// <returns>
+		/// 映像中 item 的个数。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			auto m = current.load();
+			return m ? static_cast<size_t>(m->n_records) : 0;
+		}
+		/// <summary>
+		/// 查询词语，与 system::query 相同：查询和 item 的一般式、变体、注音都经过规范化后比较。没有打开映像时返回空。
+		/// </summary>
+		/// <param name="text">查询的内容。</param>
+		/// <param name="lib_ids">查询的库。为空表示所有库。</param>
+		/// <returns>查到的 item，按（库 id，item id）排序。翻译中为空的含义由翻译指向的 item 的一般式补全。无法解析的记录被跳过。</returns>
+		[[nodiscard]] std::vector<item> query(std::u32string_view text, const std::vector<id_t>& lib_ids = {}) const
+		{
+			std::vector<item> ret;
+			auto m = current.load();
+			if (!m)
+				return ret;
+			auto word = utf_conv<char32_t, char>::convert(headword_index::normalize(text));
+			for (uint32_t i : m->find(word))
+			{
+				if (!lib_ids.empty() && std::find(lib_ids.begin(), lib_ids.end(), m->record_key(i).first) == lib_ids.end())
+					continue;
+				try
+				{
+					ret.push_back(m->parse(i));
+				}
+				catch (const std::runtime_error&)
+				{
+					continue;
+				}
+				for (auto& [trans_id, trans_lib_id, tag, meaning] : ret.back().translations)
+				{
+					if (!meaning.empty())
+						continue;
+					auto j = m->find(key_t{ trans_lib_id, trans_id });
+					if (!j)
+						continue;
+					try
+					{
+						meaning = m->parse(*j).origin;
+					}
+					catch (const std::runtime_error&) // 无法解析时含义保持为空。
+					{
+					}
+				}
+			}
+			return ret;
+		}
+		/// <returns>
+		/// 映像中的 item。如果不存在、无法解析或没有打开映像，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<item> get(id_t lib_id, id_t item_id) const
+		{
+			auto m = current.load();
+			if (!m)
+				return std::nullopt;
+			auto i = m->find(key_t{ lib_id, item_id });
+			if (!i)
+				return std::nullopt;
+			try
+			{
+				return m->parse(*i);
+			}
+			catch (const std::runtime_error&)
+			{
+				return std::nullopt;
+			}
+		}
+
+		/// <summary>
+		/// 用若干库生成新的映像，代数加一，之后删除旧的映像（仍然被映射的文件在无法删除时留到下次）。如果失败，抛出 std::runtime_error 异常，最新的映像不变。
+		/// </summary>
+		/// <param name="image_dir">映像目录，需要已经存在。</param>
+		/// <param name="libraries">库 id 到库的映射。</param>
+		/// <returns>新的映像的代数。</returns>
+		static uint64_t publish(const std::filesystem::path& image_dir, const std::map<id_t, std::shared_ptr<const library>>& libraries)
+		{
+			file_lock lock_file(lock_path(image_dir));
+			std::lock_guard<file_lock> lock(lock_file);
+			uint64_t generation = read_generation(image_dir).value_or(0) + 1;
+
+			Json::StreamWriterBuilder builder;
+			builder.settings_["emitUTF8"] = true;
+			builder.settings_["indentation"] = "";
+			std::unique_ptr<Json::StreamWriter> const writer(builder.newStreamWriter());
+			std::ostringstream ss;
+
+			std::string records, blob;
+			std::vector<std::pair<std::string, uint32_t>> keys;
+			uint32_t n_records = 0;
+			for (const auto& [lib_id, lib] : libraries)
+			{
+				for (const auto& [item_id, it] : lib->items)
+				{
+					ss.str({});
+					writer->write(it.to_json(), &ss);
+					auto json = ss.str();
+					binary::put<uint64_t>(records, lib_id);
+					binary::put<uint64_t>(records, item_id);
+					binary::put<uint64_t>(records, blob.size());
+					binary::put<uint64_t>(records, json.size());
+					blob += json;
+					for (const auto& form : headword_index::forms_of(it))
+						keys.emplace_back(utf_conv<char32_t, char>::convert(form), n_records);
+					if (++n_records == std::numeric_limits<uint32_t>::max())
+						throw std::runtime_error("too many items for a dictionary image.");
+				}
+			}
+			std::sort(keys.begin(), keys.end());
+
+			std::string key_table;
+			uint64_t key_offset = 0;
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				if (!i || keys[i].first != keys[i - 1].first) // 相同的键只保存一次。
+				{
+					key_offset = blob.size();
+					blob += keys[i].first;
+				}
+				binary::put<uint64_t>(key_table, key_offset);
+				binary::put<uint32_t>(key_table, static_cast<uint32_t>(keys[i].first.size()));
+				binary::put<uint32_t>(key_table, keys[i].second);
+			}
+
+			std::string buf(magic, 4);
+			binary::put<uint32_t>(buf, version);
+			binary::put<uint64_t>(buf, generation);
+			binary::put<uint64_t>(buf, n_records);
+			binary::put<uint64_t>(buf, header_size);
+			binary::put<uint64_t>(buf, keys.size());
+			binary::put<uint64_t>(buf, header_size + records.size());
+			binary::put<uint64_t>(buf, header_size + records.size() + key_table.size());
+			binary::put<uint64_t>(buf, blob.size());
+			buf += records;
+			buf += key_table;
+			buf += blob;
+			atomic_file::write(image_path(image_dir, generation), buf);
+
+			std::string g(generation_magic, 4);
+			binary::put<uint32_t>(g, version);
+			binary::put<uint64_t>(g, generation);
+			atomic_file::write(generation_path(image_dir), g);
+
+			for (const auto& e : directory_scan::list(image_dir))
+			{
+				auto old = directory_scan::parse_numbered(e.name, ".img");
+				if (!e.is_directory && old && *old < generation)
+				{
+					std::error_code ec;
+					std::filesystem::remove(image_dir / e.name, ec);
+				}
+			}
+			return generation;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+#if __windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace miao::core
+{
+	/// <summary>
+	/// 批量读取目录项。每次系统调用取得尽可能多的目录项（Linux 下为 getdents64，Windows 下为 FindFirstFileEx 的 FIND_FIRST_EX_LARGE_FETCH），并直接使用目录项中的类型，不需要为每个文件再查询一次属性。
+	/// </summary>
+	namespace directory_scan
+	{
+		using string_t = std::filesystem::path::string_type;
+
+		/// <summary>
+		/// 一个目录项。
+		/// </summary>
+		struct entry
+		{
+			string_t name; // 文件名，不含目录。
+			bool is_directory{};
+		};
+
+		/// <summary>
+		/// 列出目录下的所有项，不包括 "." 和 ".."，不递归，顺序不确定。如果无法打开目录，抛出 std::runtime_error 异常。
+		/// </summary>
+		inline std::vector<entry> list(const std::filesystem::path& dir)
+		{
+			std::vector<entry> ret;
+			auto add = [&ret](string_t name, bool is_directory)
+			{
+				if (name[0] == '.' && (name.size() == 1 || (name.size() == 2 && name[1] == '.')))
+					return;
+				ret.push_back({ std::move(name), is_directory });
+			};
+
+#if __windows
+			WIN32_FIND_DATAW data{};
+			HANDLE find = FindFirstFileExW((dir / L"*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+			if (find == INVALID_HANDLE_VALUE)
+			{
+				if (GetLastError() == ERROR_FILE_NOT_FOUND)
+					return ret;
+				throw std::runtime_error("fail to open the directory.");
+			}
+			do
+				add(data.cFileName, data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+			while (FindNextFileW(find, &data));
+			FindClose(find);
+#elif defined(__linux__)
+			int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0)
+				throw std::runtime_error("fail to open the directory.");
+			struct linux_dirent64
+			{
+				uint64_t d_ino;
+				int64_t d_off;
+				unsigned short d_reclen;
+				unsigned char d_type;
+				char d_name[1];
+			};
+			constexpr size_t buffer_size = 64 << 10;
+			std::unique_ptr<uint64_t[]> buf(new uint64_t[buffer_size / sizeof(uint64_t)]); // 目录项按 8 字节对齐。
+			while (true)
+			{
+				long n = ::syscall(SYS_getdents64, fd, buf.get(), buffer_size);
+				if (n < 0)
+				{
+					::close(fd);
+					throw std::runtime_error("fail to read the directory.");
+				}
+				if (!n)
+					break;
+				const char* base = reinterpret_cast<const char*>(buf.get());
+				for (long pos = 0; pos < n;)
+				{
+					auto d = reinterpret_cast<const linux_dirent64*>(base + pos);
+					bool is_directory = d->d_type == DT_DIR;
+					if (d->d_type == DT_UNKNOWN) // 部分文件系统不提供类型。
+					{
+						struct stat st {};
+						is_directory = ::fstatat(fd, d->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+					}
+					add(d->d_name, is_directory);
+					pos += d->d_reclen;
+				}
+			}
+			::close(fd);
+#else
+			DIR* d = ::opendir(dir.c_str());
+			if (!d)
+				throw std::runtime_error("fail to open the directory.");
+			while (auto e = ::readdir(d))
+			{
+				bool is_directory = e->d_type == DT_DIR;
+				if (e->d_type == DT_UNKNOWN)
+				{
+					struct stat st {};
+					is_directory = ::fstatat(::dirfd(d), e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+				}
+				add(e->d_name, is_directory);
+			}
+			::closedir(d);
+#endif
+			return ret;
+		}
+
+		/// <summary>
+		/// 解析形如 "123.json" 的文件名。
+		/// </summary>
+		/// <param name="name">文件名。</param>
+		/// <param name="extension">扩展名，包括 "."。</param>
+		/// <returns>文件名中的数字。如果文件名不是这种形式，返回 std::nullopt。</returns>
+		[[nodiscard]] inline std::optional<id_t> parse_numbered(const string_t& name, std::string_view extension)
+		{
+			if (name.size() <= extension.size())
+				return std::nullopt;
+			size_t n = name.size() - extension.size();
+			for (size_t i = 0; i < extension.size(); i++)
+				if (name[n + i] != static_cast<string_t::value_type>(extension[i]))
+					return std::nullopt;
+			id_t ret{};
+			for (size_t i = 0; i < n; i++)
+			{
+				auto ch = name[i];
+				if (ch < '0' || ch > '9' || ret > (std::numeric_limits<id_t>::max() - 9) / 10)
+					return std::nullopt;
+				ret = ret * 10 + static_cast<id_t>(ch - '0');
+			}
+			return ret;
+		}
+		/// <returns>
+		/// 分片目录的名字：id 的最低字节，两位小写十六进制数字。
+		/// </returns>
+		[[nodiscard]] inline std::string shard_name(id_t id)
+		{
+			constexpr char digits[] = "0123456789abcdef";
+			return { digits[id >> 4 & 0xF], digits[id & 0xF] };
+		}
+		/// <returns>
+		/// name 是否是分片目录的名字。
+		/// </returns>
+		[[nodiscard]] inline bool is_shard_name(const string_t& name)
+		{
+			auto hex = [](auto ch) { return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f'); };
+			return name.size() == 2 && hex(name[0]) && hex(name[1]);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,323 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 双数组字典树。键是 UTF-32 字符串，值是 uint32_t。构造后只读，可以在多个线程中同时查询。
+	/// 字符先按出现次数映射到稠密的编码上，再把编码按类似 UTF-8 的方式拆成 1 到 3 个标号作为转移，使每个状态最多只有 256 个子状态，常用字符只占一个标号。
+	/// </summary>
+	class double_array_trie final
+	{
+	private:
+		static constexpr int32_t npos = -1;
+
+		std::vector<uint32_t> bmp_code; // BMP 字符到编码的映射，0 表示不存在。
+		std::unordered_map<char32_t, uint32_t> astral_code; // 其他字符到编码的映射。
+		std::vector<int32_t> base;
+		std::vector<int32_t> check; // 父状态，npos 表示空闲。
+		std::vector<int32_t> values; // 状态对应的值，npos 表示不是终止状态。
+
+		[[nodiscard]] uint32_t code(char32_t ch) const
+		{
+			if (ch < 0x10000)
+				return ch < bmp_code.size() ? bmp_code[ch] : 0;
+			auto it = astral_code.find(ch);
+			return it == astral_code.end() ? 0 : it->second;
+		}
+		/// <summary>
+		/// 把字符编码拆成转移标号。标号的取值为 1 到 256，第一个标号决定了标号的个数。
+		/// </summary>
+		/// <returns>标号个数。如果字符不在字典中，返回 0。</returns>
+		[[nodiscard]] size_t labels(char32_t ch, std::array<uint32_t, 3>& out) const
+		{
+			uint32_t c = code(ch);
+			if (!c)
+				return 0;
+			if (c < 0xC0)
+			{
+				out[0] = c + 1;
+				return 1;
+			}
+			if (c < 0x30C0)
+			{
+				c -= 0xC0;
+				out[0] = 0xC0 + (c >> 8) + 1;
+				out[1] = (c & 0xFF) + 1;
+				return 2;
+			}
+			c -= 0x30C0;
+			out[0] = 0xF0 + (c >> 16) + 1;
+			out[1] = ((c >> 8) & 0xFF) + 1;
+			out[2] = (c & 0xFF) + 1;
+			return 3;
+		}
+		/// <summary>
+		/// 从状态 s 沿标号 l 转移。
+		/// </summary>
+		/// <returns>转移后的状态。如果转移不存在，返回 npos。</returns>
+		[[nodiscard]] int32_t next(int32_t s, uint32_t l) const
+		{
+			size_t t = static_cast<size_t>(base[s]) + l;
+			if (t >= check.size() || check[t] != s)
+				return npos;
+			return static_cast<int32_t>(t);
+		}
+		/// <summary>
+		/// 从状态 s 沿字符 ch 转移。
+		/// </summary>
+		/// <returns>转移后的状态。如果转移不存在，返回 npos。</returns>
+		[[nodiscard]] int32_t next_char(int32_t s, char32_t ch) const
+		{
+			std::array<uint32_t, 3> ls;
+			size_t n = labels(ch, ls);
+			if (!n)
+				return npos;
+			for (size_t i = 0; i < n && s != npos; i++)
+				s = next(s, ls[i]);
+			return s;
+		}
+
+		// 构造时使用的空闲位置双向链表，只遍历空闲位置以加速 base 的搜索。
+		std::vector<int32_t> next_free;
+		std::vector<int32_t> prev_free;
+		int32_t free_head{ npos };
+		int32_t free_tail{ npos };
+
+		void ensure(size_t size)
+		{
+			if (size <= check.size())
+				return;
+			size_t old = check.size();
+			size_t n = std::max(size, old * 2);
+			base.resize(n, 0);
+			check.resize(n, npos);
+			values.resize(n, npos);
+			next_free.resize(n, npos);
+			prev_free.resize(n, npos);
+			for (size_t i = old; i < n; i++)
+			{
+				prev_free[i] = free_tail;
+				if (free_tail == npos)
+					free_head = static_cast<int32_t>(i);
+				else
+					next_free[free_tail] = static_cast<int32_t>(i);
+				free_tail = static_cast<int32_t>(i);
+			}
+		}
+		void occupy(size_t t, int32_t parent)
+		{
+			check[t] = parent;
+			int32_t p = prev_free[t], n = next_free[t];
+			if (p == npos)
+				free_head = n;
+			else
+				next_free[p] = n;
+			if (n == npos)
+				free_tail = p;
+			else
+				prev_free[n] = p;
+		}
+
+	public:
+		/// <summary>
+		/// 构造字典树。
+		/// </summary>
+		/// <param name="keys">键和值。键可以重复，重复时保留最后一个值。空键会被忽略。</param>
+		void build(std::vector<std::pair<std::u32string, uint32_t>> keys)
+		{
+			// 按出现次数分配字符编码，常用字符编码较小，只占一个标号。
+			std::unordered_map<char32_t, size_t> count;
+			for (const auto& k : keys)
+				for (char32_t ch : k.first)
+					count[ch]++;
+			std::vector<std::pair<size_t, char32_t>> order;
+			order.reserve(count.size());
+			for (auto [ch, n] : count)
+				order.emplace_back(n, ch);
+			std::sort(order.begin(), order.end(), std::greater<>());
+			bmp_code.assign(0x10000, 0);
+			astral_code.clear();
+			for (size_t i = 0; i < order.size(); i++)
+				if (order[i].second < 0x10000)
+					bmp_code[order[i].second] = static_cast<uint32_t>(i + 1);
+				else
+					astral_code[order[i].second] = static_cast<uint32_t>(i + 1);
+
+			// 把键转换为标号序列，排序并去重，重复时保留最后一个值。
+			std::vector<std::pair<std::vector<uint16_t>, uint32_t>> seqs;
+			seqs.reserve(keys.size());
+			for (const auto& [key, value] : keys)
+			{
+				if (key.empty())
+					continue;
+				std::vector<uint16_t> seq;
+				seq.reserve(key.length() * 2);
+				std::array<uint32_t, 3> ls;
+				for (char32_t ch : key)
+				{
+					size_t n = labels(ch, ls);
+					for (size_t i = 0; i < n; i++)
+						seq.push_back(static_cast<uint16_t>(ls[i]));
+				}
+				seqs.emplace_back(std::move(seq), value);
+			}
+			keys = {};
+			std::stable_sort(seqs.begin(), seqs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+			{
+				size_t n{};
+				for (size_t i = 0; i < seqs.size(); i++)
+				{
+					if (n && seqs[n - 1].first == seqs[i].first)
+						seqs[n - 1].second = seqs[i].second;
+					else if (n++ != i)
+						seqs[n - 1] = std::move(seqs[i]);
+				}
+				seqs.resize(n);
+			}
+
+			base.clear();
+			check.clear();
+			values.clear();
+			next_free.clear();
+			prev_free.clear();
+			free_head = free_tail = npos;
+			ensure(std::max<size_t>(1024, seqs.size() * 2));
+			occupy(0, 0);
+
+			struct range
+			{
+				int32_t state;
+				size_t l, r; // seqs 中的下标范围。
+				size_t depth;
+			};
+			std::vector<range> stack{ { 0, 0, seqs.size(), 0 } };
+			std::vector<std::tuple<uint32_t, size_t, size_t>> children; // (标号, l, r)
+			size_t next_check = 1; // 搜索 base 的起点，它之前的位置几乎都已被占用。
+			while (!stack.empty())
+			{
+				auto [s, l, r, depth] = stack.back();
+				stack.pop_back();
+
+				children.clear();
+				for (size_t i = l; i < r; i++)
+				{
+					if (seqs[i].first.size() == depth)
+					{
+						values[s] = static_cast<int32_t>(seqs[i].second);
+						continue;
+					}
+					uint32_t c = seqs[i].first[depth];
+					if (children.empty() || std::get<0>(children.back()) != c)
+						children.emplace_back(c, i, i + 1);
+					else
+						std::get<2>(children.back()) = i + 1;
+				}
+				if (children.empty())
+					continue;
+
+				// 在空闲位置中寻找所有子状态都空闲的 base。
+				uint32_t c0 = std::get<0>(children.front());
+				while (next_check < check.size() && check[next_check] != npos)
+					next_check++;
+				int32_t start = next_check < check.size() ? static_cast<int32_t>(next_check) : free_head;
+				size_t n_free{}; // 搜索过的空闲位置数。
+				int32_t b{};
+				for (int32_t pos = start;; pos = next_free[pos], n_free++)
+				{
+					if (pos == npos) // 没有合适的空闲位置，扩容后从新的部分开始。
+					{
+						size_t old = check.size();
+						ensure(old + 1);
+						pos = static_cast<int32_t>(old);
+					}
+					if (static_cast<uint32_t>(pos) < c0)
+						continue;
+					b = static_cast<int32_t>(pos - c0);
+					bool ok = true;
+					for (const auto& ch : children)
+					{
+						size_t t = b + std::get<0>(ch);
+						ensure(t + 1);
+						if (check[t] != npos)
+						{
+							ok = false;
+							break;
+						}
+					}
+					if (ok)
+						break;
+				}
+
+				// 如果搜索过的区间中空闲位置很少，下次直接从这里开始搜索。
+				size_t pos = static_cast<size_t>(b) + c0;
+				if (pos >= next_check && n_free * 20 <= pos - next_check + 1)
+					next_check = pos;
+
+				base[s] = b;
+				for (const auto& [c, cl, cr] : children)
+					occupy(b + c, s);
+				for (const auto& [c, cl, cr] : children)
+					stack.push_back({ static_cast<int32_t>(b + c), cl, cr, depth + 1 });
+			}
+
+			// 去掉末尾未使用的部分。
+			size_t used = check.size();
+			while (used > 1 && check[used - 1] == npos)
+				used--;
+			base.resize(used);
+			check.resize(used);
+			values.resize(used);
+			base.shrink_to_fit();
+			check.shrink_to_fit();
+			values.shrink_to_fit();
+			next_free = {};
+			prev_free = {};
+			free_head = free_tail = npos;
+		}
+
+		/// <returns>
+		/// 是否没有任何键。
+		/// </returns>
+		[[nodiscard]] bool empty() const
+		{
+			return check.size() <= 1;
+		}
+		/// <summary>
+		/// 精确查找键。
+		/// </summary>
+		/// <returns>如果找到，返回对应的值，否则返回 std::nullopt。</returns>
+		[[nodiscard]] std::optional<uint32_t> find(std::u32string_view key) const
+		{
+			if (empty())
+				return std::nullopt;
+			int32_t s = 0;
+			for (char32_t ch : key)
+				if ((s = next_char(s, ch)) == npos)
+					return std::nullopt;
+			if (values[s] == npos)
+				return std::nullopt;
+			return static_cast<uint32_t>(values[s]);
+		}
+		/// <summary>
+		/// 查找 text 的所有是键的前缀，按长度从短到长对每个前缀调用 callback(长度, 值)。
+		/// </summary>
+		/// <param name="text">文本。</param>
+		/// <param name="callback">形如 void(size_t, uint32_t) 的回调。</param>
+		template <typename callback_t>
+		void common_prefix_search(std::u32string_view text, callback_t&& callback) const
+		{
+			if (empty())
+				return;
+			int32_t s = 0;
+			for (size_t i = 0; i < text.length(); i++)
+			{
+				if ((s = next_char(s, text[i])) == npos)
+					return;
+				if (values[s] != npos)
+					callback(i + 1, static_cast<uint32_t>(values[s]));
+			}
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,357 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "binary.hpp"
+#include "segment_file.hpp"
+#include "atomic_file.hpp"
+#include "learning_events.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 一个库的学习事件日志。事件以追加的方式保存在库的 events 目录下的若干段文件（0.log、1.log、……）中，段文件超过一定大小后换用新的段文件。追加的事件先写入内存中的缓冲区，缓冲区满或调用 flush 时才写入文件。所有成员函数都是线程安全的。
+	/// </summary>
+	/// <remarks>
+	/// 段文件以 8 字节的文件头开始（"MDEV" 和 u32 版本号），之后是若干批次，每次写入缓冲区为一个批次。每个批次依次是：记录的字节数（u32）、校验和（u32，记录的 xxh64 的低 32 位）、若干记录。
+	/// 每条记录依次是：事件种类（u8）、与上一条记录的时间差（ZigZag 编码后的变长整数，段中第一条记录与 0 相比）、item id（变长整数）、值（变长整数）。整数为小端序，变长整数为 LEB128 编码。
+	/// 每个段文件可以单独解析。不完整或校验和不符的批次（如断电后末尾未写入的零）及之后的部分被忽略，打开时从最后一个段中截去。版本 1 的段文件没有批次，打开时被原子地改写为当前版本。
+	/// </remarks>
+	class event_log final
+	{
+	private:
+		static constexpr segment_format format{ "MDEV", 2 };
+		static constexpr segment_format format_v1{ "MDEV", 1 };
+		static constexpr size_t file_header_size = segment_format::header_size;
+		static constexpr size_t batch_header_size = 4 + 4;
+		static constexpr uint8_t max_kind = static_cast<uint8_t>(learning_event_kind::query);
+
+	public:
+		uint64_t max_segment_size{ 16ull << 20 }; // 段文件的最大字节数。
+		size_t buffer_size{ 64 << 10 }; // 缓冲区的字节数，超过后写入文件。
+
+	private:
+		std::mutex mutex;
+		std::filesystem::path dir;
+		id_t lib_id{};
+
+		std::ofstream writer;
+		uint32_t writer_segment{};
+		uint64_t writer_size{}; // 段文件的字节数，包括缓冲区中的记录，不包括它们的批次头。
+		uint64_t last_time{}; // 段中最后一条记录的时间。
+		std::string pending; // 还没有写入文件的记录。
+
+		std::filesystem::path segment_path(uint32_t segment) const
+		{
+			return dir / (std::to_string(segment) + ".log");
+		}
+		static void encode(std::string& out, const learning_event& e, uint64_t prev_time)
+		{
+			out.push_back(static_cast<char>(e.kind));
+			binary::put_varint(out, binary::zigzag(static_cast<int64_t>(e.time - prev_time)));
+			binary::put_varint(out, e.item_id);
+			binary::put_varint(out, e.value);
+		}
+		[[nodiscard]] static uint32_t checksum(std::string_view records)
+		{
+			return static_cast<uint32_t>(binary::xxh64(records));
+		}
+		/// <summary>
+		/// 解析 [p, end) 中连续的记录，对每个事件调用 callback。遇到不完整或无法识别的记录时停止。
+		/// </summary>
+		/// <param name="time">上一条记录的时间，解析后为最后一条记录的时间。</param>
+		/// <returns>停止的位置。</returns>
+		template <typename callback_t>
+		static const char* parse_records(const char* p, const char* end, id_t lib_id, uint64_t& time, callback_t&& callback)
+		{
+			learning_event e;
+			e.lib_id = lib_id;
+			while (p != end)
+			{
+				const char* q = p;
+				auto kind = static_cast<uint8_t>(*q++);
+				uint64_t delta, item_id, value;
+				if (kind > max_kind
+					|| !binary::get_varint(q, end, delta)
+					|| !binary::get_varint(q, end, item_id)
+					|| !binary::get_varint(q, end, value)
+					|| value > std::numeric_limits<uint32_t>::max())
+					break;
+				e.kind = static_cast<learning_event_kind>(kind);
+				e.time = time + static_cast<uint64_t>(binary::unzigzag(delta));
+				e.item_id = item_id;
+				e.value = static_cast<uint32_t>(value);
+				time = e.time;
+				callback(e);
+				p = q;
+			}
+			return p;
+		}
+		/// <summary>
+		/// 解析一个段文件的内容，对每个事件调用 callback。遇到不完整或校验和不符的批次时停止。
+		/// </summary>
+		/// <returns>有效部分的长度。文件头不完整（创建段文件时中断）时返回 0；文件头无法识别（损坏、版本 1 或由更新的版本写入）时返回 std::nullopt。</returns>
+		template <typename callback_t>
+		static std::optional<uint64_t> parse(const std::string& buf, id_t lib_id, uint64_t& time, callback_t&& callback)
+		{
+			time = 0;
+			auto state = format.check(buf);
+			if (state == segment_format::header_state::invalid)
+				return std::nullopt;
+			if (state == segment_format::header_state::incomplete)
+				return 0;
+
+			const char* p = buf.data() + file_header_size;
+			const char* end = buf.data() + buf.size();
+			while (static_cast<size_t>(end - p) >= batch_header_size)
+			{
+				uint32_t length = binary::get<uint32_t>(p);
+				uint32_t sum = binary::get<uint32_t>(p + 4);
+				if (!length || length > static_cast<size_t>(end - p) - batch_header_size)
+					break;
+				std::string_view records(p + batch_header_size, length);
+				if (checksum(records) != sum)
+					break;
+				if (parse_records(records.data(), records.data() + records.size(), lib_id, time, callback) != records.data() + records.size())
+					break; // 校验和相符的批次中的记录总是完整的，这里只防御写入方的错误。
+				p += batch_header_size + length;
+			}
+			return static_cast<uint64_t>(p - buf.data());
+		}
+		/// <summary>
+		/// 把版本 1 的段文件原子地改写为当前版本：有效的记录作为一个批次，末尾不完整的记录被丢弃。如果失败，抛出 std::runtime_error 异常，文件不变。
+		/// </summary>
+		static void upgrade_segment(const std::filesystem::path& path)
+		{
+			auto buf = read_file(path);
+			const char* begin = buf.data() + file_header_size;
+			uint64_t time = 0;
+			const char* valid = parse_records(begin, buf.data() + buf.size(), 0, time, [](const learning_event&) {});
+			std::string out = format.header();
+			if (valid != begin)
+				append_batch(out, { begin, static_cast<size_t>(valid - begin) });
+			atomic_file::write(path, out);
+		}
+		static void append_batch(std::string& out, std::string_view records)
+		{
+			binary::put<uint32_t>(out, static_cast<uint32_t>(records.size()));
+			binary::put<uint32_t>(out, checksum(records));
+			out.append(records);
+		}
+		static std::string read_file(const std::filesystem::path& path, uint64_t limit = std::numeric_limits<uint64_t>::max())
+		{
+			std::ifstream ifs(path, std::ios::binary);
+			if (!ifs)
+				return {};
+			ifs.seekg(0, std::ios::end);
+			uint64_t size = std::min<uint64_t>(static_cast<uint64_t>(ifs.tellg()), limit);
+			ifs.seekg(0, std::ios::beg);
+			std::string buf(size, '\0');
+			ifs.read(buf.data(), buf.size());
+			buf.resize(static_cast<size_t>(ifs.gcount()));
+			return buf;
+		}
+		void open_writer(uint32_t segment, uint64_t size)
+		{
+			writer_segment = segment;
+			if (!size)
+				last_time = 0;
+			writer_size = format.open_writer(writer, segment_path(segment), size);
+		}
+		void flush_locked()
+		{
+			if (pending.empty())
+				return;
+			std::string batch;
+			batch.reserve(batch_header_size + pending.size());
+			append_batch(batch, pending);
+			writer.write(batch.data(), batch.size());
+			writer.flush();
+			if (!writer)
+				throw std::runtime_error("fail to write event segment.");
+			writer_size += batch_header_size;
+			pending.clear();
+		}
+		void append_locked(const learning_event& e)
+		{
+			size_t before = pending.size();
+			encode(pending, e, last_time);
+			size_t length = pending.size() - before;
+			if (writer_size + batch_header_size + length > max_segment_size && writer_size > file_header_size)
+			{
+				// 换用新的段文件，时间差从 0 开始重新计算。
+				pending.resize(before);
+				flush_locked();
+				open_writer(writer_segment + 1, 0);
+				encode(pending, e, last_time);
+				length = pending.size();
+			}
+			writer_size += length;
+			last_time = e.time;
+			if (pending.size() >= buffer_size)
+				flush_locked();
+		}
+		void close_locked()
+		{
+			if (writer.is_open())
+			{
+				try
+				{
+					flush_locked();
+				}
+				catch (const std::runtime_error&)
+				{
+				}
+				writer.close();
+			}
+			pending.clear();
+			writer_segment = 0;
+			writer_size = 0;
+			last_time = 0;
+		}
+
+	public:
+		event_log() = default;
+		event_log(const event_log&) = delete;
+		event_log& operator=(const event_log&) = delete;
+		~event_log()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			close_locked();
+		}
+
+		/// <summary>
+		/// 打开指定目录下的事件日志，目录需要已经存在。之前打开的日志会被关闭。最后一个段末尾不完整或校验和不符的批次（例如写入时程序崩溃或断电）会被截去，版本 1 的段文件被改写为当前版本。
+		/// </summary>
+		/// <param name="path">事件目录。</param>
+		/// <param name="lib_id">日志所属的库，读取的事件以它作为库 id。</param>
+		/// <returns>成功返回 true，否则返回 false。最后一个段文件的文件头无法识别（损坏或由更新的版本写入）时失败，文件不会被修改。</returns>
+		bool open(std::filesystem::path path, id_t lib_id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			close_locked();
+			path.make_preferred();
+			dir = path;
+			this->lib_id = lib_id;
+			if (!std::filesystem::is_directory(dir))
+				return false;
+
+			try
+			{
+				// 之前的段在换用新的段前已经完整写入，只需要检查最后一个段。版本 1 的段先被改写为当前版本。
+				uint32_t segment = 0;
+				for (uint32_t i = 0; std::filesystem::exists(segment_path(i)); i++)
+				{
+					segment = i;
+					if (format_v1.check(read_file(segment_path(i), file_header_size)) == segment_format::header_state::valid)
+						upgrade_segment(segment_path(i));
+				}
+				uint64_t size = 0;
+				if (std::filesystem::exists(segment_path(segment)))
+				{
+					auto valid = parse(read_file(segment_path(segment)), lib_id, last_time, [](const learning_event&) {});
+					if (!valid) // 无法识别的段文件不被修改。
+					{
+						close_locked();
+						return false;
+					}
+					size = *valid;
+					if (size < std::filesystem::file_size(segment_path(segment)))
+						std::filesystem::resize_file(segment_path(segment), size);
+				}
+				open_writer(segment, size < file_header_size ? 0 : size);
+			}
+			catch (const std::exception&)
+			{
+				close_locked();
+				return false;
+			}
+			return true;
+		}
+		/// <summary>
+		/// 写入缓冲的事件并关闭日志。
+		/// </summary>
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			close_locked();
+		}
+		/// <summary>
+		/// 将缓冲的事件写入文件。
+		/// </summary>
+		void flush()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (writer.is_open())
+				flush_locked();
+		}
+
+		/// <summary>
+		/// 追加一个事件。事件的库 id 会被忽略。
+		/// </summary>
+		void append(const learning_event& e)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!writer.is_open())
+				throw std::runtime_error("call open() before append.");
+			append_locked(e);
+		}
+		/// <summary>
+		/// 追加若干事件。事件的库 id 会被忽略。
+		/// </summary>
+		void append(const std::vector<learning_event>& events)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!writer.is_open())
+				throw std::runtime_error("call open() before append.");
+			for (const auto& e : events)
+				append_locked(e);
+		}
+
+		/// <summary>
+		/// 按追加的顺序对日志中的所有事件调用 callback(const learning_event&)。调用前追加的事件都会被读取；读取时不持有锁，不会阻塞追加。
+		/// </summary>
+		/// <returns>读取的事件个数。</returns>
+		template <typename callback_t>
+		size_t scan(callback_t&& callback)
+		{
+			uint32_t n_segments;
+			uint64_t last_size;
+			id_t id;
+			std::filesystem::path d;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!writer.is_open())
+					throw std::runtime_error("call open() before scan.");
+				flush_locked();
+				n_segments = writer_segment + 1;
+				last_size = writer_size;
+				id = lib_id;
+				d = dir;
+			}
+
+			size_t ret{};
+			for (uint32_t i = 0; i < n_segments; i++)
+			{
+				auto path = d / (std::to_string(i) + ".log");
+				uint64_t time;
+				parse(read_file(path, i + 1 == n_segments ? last_size : std::numeric_limits<uint64_t>::max()), id, time,
+					[&](const learning_event& e)
+					{
+						callback(e);
+						ret++;
+					});
+			}
+			return ret;
+		}
+		/// <summary>
+		/// 从日志中重新计算每个 item 的学习计数。
+		/// </summary>
+		/// <returns>item id 到计数的映射，只包含出现过的 item。</returns>
+		[[nodiscard]] std::unordered_map<id_t, learning_counters> totals()
+		{
+			std::unordered_map<id_t, learning_counters> ret;
+			scan([&ret](const learning_event& e) { ret[e.item_id].apply(e); });
+			return ret;
+		}
+	};
+}
\ No newline at end of file
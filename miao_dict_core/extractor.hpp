@@ -0,0 +1,244 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "item.hpp"
+#include "passage.hpp"
+#include "persistent_map.hpp"
+#include "text.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 从片段中提取未处理过的词（raw_item）。文本被切分成块后由多个线程并行分词和计数，每个线程使用独立的哈希表，表满后再合并到全局表中，最后按出现次数排序输出。
+	/// </summary>
+	class raw_item_extractor final
+	{
+	public:
+		using emit_t = std::function<void(std::u32string_view)>;
+		/// <summary>
+		/// 分词器，对文本中的每个候选词调用 emit。会在多个线程中同时调用。
+		/// </summary>
+		using tokenizer_t = std::function<void(std::u32string_view, const emit_t&)>;
+		/// <summary>
+		/// 流式文本源，每次调用将下一块文本写入参数；没有更多文本时返回 false。保证被串行调用。
+		/// </summary>
+		using source_t = std::function<bool(std::u32string&)>;
+		/// <summary>
+		/// 过滤器，返回 false 的词不会出现在结果中（例如已经是 item 的词）。只在合并完成后对每个不同的词调用一次。
+		/// </summary>
+		using filter_t = std::function<bool(std::u32string_view)>;
+
+		/// <summary>
+		/// 默认的分词器，按空白和标点分词，见 text::split_words。
+		/// </summary>
+		static void default_tokenizer(std::u32string_view content, const emit_t& emit)
+		{
+			text::split_words(content, emit);
+		}
+
+	public:
+		tokenizer_t tokenizer{ default_tokenizer };
+		filter_t filter;
+		size_t n_threads{ std::max<size_t>(1, std::thread::hardware_concurrency()) }; // 工作线程数。
+		size_t chunk_length{ 1 << 20 }; // 长片段按此长度（字符数）在词边界处切块。
+		size_t max_token_length{ 64 }; // 超过此长度的词被认为不是词，直接跳过。
+		size_t max_local_entries{ 1 << 16 }; // 每个线程的局部表的最大条目数，超过后合并到全局表。
+		size_t max_entries{ 1 << 22 }; // 全局表的最大条目数，超过后淘汰低频词，此时低频部分的结果是近似的。
+		uint_t min_frequency{ 1 }; // 结果中的最小出现次数。
+
+	private:
+		using counter_t = std::unordered_map<std::u32string, uint_t>;
+		/// <summary>
+		/// 取下一块文本。chunk 可以指向 storage，也可以指向调用者持有的内存。保证被串行调用。
+		/// </summary>
+		using next_t = std::function<bool(std::u32string& storage, std::u32string_view& chunk)>;
+
+		std::mutex mutex_source;
+		std::mutex mutex_total;
+		counter_t total;
+		uint_t prune_floor{}; // 被淘汰过的最大出现次数。
+
+		/// <summary>
+		/// 找到不超过 limit 的切分位置，使得切分不落在词中间。如果在 limit 附近找不到词边界，直接在 limit 处切分。
+		/// </summary>
+		static size_t split_point(std::u32string_view s, size_t limit)
+		{
+			if (s.length() <= limit)
+				return s.length();
+			for (size_t i = limit; i > limit / 2; i--)
+				if (!text::is_word_char(s[i]))
+					return i;
+			return limit;
+		}
+		/// <summary>
+		/// 将局部表合并到全局表，并清空局部表。全局表过大时淘汰低频词。
+		/// </summary>
+		void merge(counter_t& local)
+		{
+			std::lock_guard<std::mutex> lock(mutex_total);
+			if (total.empty())
+				total.swap(local);
+			else
+				for (auto& [word, n] : local)
+					total[word] += n;
+			local.clear();
+
+			while (total.size() > max_entries)
+			{
+				prune_floor++;
+				for (auto it = total.begin(); it != total.end();)
+					if (it->second <= prune_floor)
+						it = total.erase(it);
+					else
+						++it;
+			}
+		}
+		void work(const next_t& next)
+		{
+			counter_t local;
+			std::u32string key;
+			std::u32string storage;
+			std::u32string_view chunk;
+			emit_t emit = [&](std::u32string_view word)
+			{
+				if (word.length() > max_token_length)
+					return;
+				key.assign(word);
+				++local[key];
+				if (local.size() >= max_local_entries)
+					merge(local);
+			};
+			while (true)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex_source);
+					if (!next(storage, chunk))
+						break;
+				}
+				tokenizer(chunk, emit);
+			}
+			merge(local);
+		}
+		std::vector<raw_item> run(const next_t& next)
+		{
+			total.clear();
+			prune_floor = 0;
+
+			std::vector<std::thread> threads;
+			std::vector<std::exception_ptr> errors(n_threads);
+			for (size_t i = 0; i < n_threads; i++)
+				threads.emplace_back([this, &next, &errors, i]()
+					{
+						try
+						{
+							work(next);
+						}
+						catch (...)
+						{
+							errors[i] = std::current_exception();
+						}
+					});
+			for (auto& t : threads)
+				t.join();
+			for (auto& e : errors)
+				if (e)
+					std::rethrow_exception(e);
+
+			std::vector<raw_item> ret;
+			ret.reserve(total.size());
+			for (auto& [word, n] : total)
+			{
+				if (n < min_frequency || (filter && !filter(word)))
+					continue;
+				raw_item ri;
+				ri.origin = word;
+				ri.frequency = n;
+				ret.push_back(std::move(ri));
+			}
+			total.clear();
+			sort(ret);
+			return ret;
+		}
+
+	public:
+		/// <summary>
+		/// 将 raw_item 按出现次数降序排序，次数相同时按字典序排序。
+		/// </summary>
+		static void sort(std::vector<raw_item>& raw_items)
+		{
+			std::sort(raw_items.begin(), raw_items.end(), [](const raw_item& a, const raw_item& b)
+				{
+					if (a.frequency != b.frequency)
+						return a.frequency > b.frequency;
+					return a.origin < b.origin;
+				});
+		}
+
+		/// <summary>
+		/// 从若干段文本中提取 raw_item。文本不会被复制，长文本会被切块后分给多个线程。
+		/// </summary>
+		/// <param name="contents">文本。在函数返回前不可修改。</param>
+		/// <returns>按出现次数降序排序的 raw_item。</returns>
+		[[nodiscard]] std::vector<raw_item> extract(const std::vector<std::u32string_view>& contents)
+		{
+			size_t index{};
+			size_t offset{};
+			return run([&](std::u32string&, std::u32string_view& chunk)
+				{
+					while (index < contents.size() && offset >= contents[index].length())
+					{
+						index++;
+						offset = 0;
+					}
+					if (index >= contents.size())
+						return false;
+					std::u32string_view rest = contents[index].substr(offset);
+					size_t len = split_point(rest, chunk_length);
+					chunk = rest.substr(0, len);
+					offset += len;
+					return true;
+				});
+		}
+		/// <summary>
+		/// 从片段中提取 raw_item。片段内容不会被复制。
+		/// </summary>
+		/// <param name="passages">片段。在函数返回前不可修改。</param>
+		/// <returns>按出现次数降序排序的 raw_item。</returns>
+		[[nodiscard]] std::vector<raw_item> extract(const std::vector<passage>& passages)
+		{
+			std::vector<std::u32string_view> contents;
+			contents.reserve(passages.size());
+			for (const auto& p : passages)
+				contents.push_back(p.content);
+			return extract(contents);
+		}
+		/// <summary>
+		/// 从库的片段中提取 raw_item。片段内容不会被复制。
+		/// </summary>
+		/// <param name="passages">片段 id 到片段的映射。在函数返回前不可修改。</param>
+		/// <returns>按出现次数降序排序的 raw_item。</returns>
+		[[nodiscard]] std::vector<raw_item> extract(const persistent_map<id_t, passage>& passages)
+		{
+			std::vector<std::u32string_view> contents;
+			contents.reserve(passages.size());
+			for (const auto& [id, p] : passages)
+				contents.push_back(p.content);
+			return extract(contents);
+		}
+		/// <summary>
+		/// 从流式文本源中提取 raw_item。同一时刻只有 n_threads 块文本在内存中，适合处理不能整体载入内存的语料。
+		/// </summary>
+		/// <param name="source">文本源。每块文本应当在词边界处结束。</param>
+		/// <returns>按出现次数降序排序的 raw_item。</returns>
+		[[nodiscard]] std::vector<raw_item> extract(const source_t& source)
+		{
+			return run([&](std::u32string& storage, std::u32string_view& chunk)
+				{
+					if (!source(storage))
+						return false;
+					chunk = storage;
+					return true;
+				});
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+#if __windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace miao::core
+{
+	/// <summary>
+	/// 进程之间的读写锁，锁住一个文件（POSIX 下为 flock，Windows 下为 LockFileEx）。满足 Lockable 和 SharedLockable，可以与 std::unique_lock 和 std::shared_lock 一起使用。
+	/// 锁属于打开的文件：同一进程中需要互斥的各方应当各自构造 file_lock 对象。进程退出时锁自动释放。
+	/// </summary>
+	class file_lock final
+	{
+	private:
+#if __windows
+		HANDLE file{ INVALID_HANDLE_VALUE };
+
+		bool acquire(DWORD flags)
+		{
+			OVERLAPPED ov{};
+			return LockFileEx(file, flags, 0, MAXDWORD, MAXDWORD, &ov);
+		}
+		void release()
+		{
+			OVERLAPPED ov{};
+			UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &ov);
+		}
+#else
+		int fd{ -1 };
+
+		bool acquire(int operation)
+		{
+			while (::flock(fd, operation) != 0)
+				if (errno != EINTR)
+					return false;
+			return true;
+		}
+		void release()
+		{
+			::flock(fd, LOCK_UN);
+		}
+#endif
+
+	public:
+		/// <summary>
+		/// 打开锁文件，不存在时创建。如果无法打开，抛出 std::runtime_error 异常。
+		/// </summary>
+		explicit file_lock(const std::filesystem::path& path)
+		{
+#if __windows
+			file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("fail to open the lock file.");
+#else
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+			if (fd < 0)
+				throw std::runtime_error("fail to open the lock file.");
+#endif
+		}
+		~file_lock()
+		{
+#if __windows
+			CloseHandle(file);
+#else
+			::close(fd);
+#endif
+		}
+		file_lock(const file_lock&) = delete;
+		file_lock& operator=(const file_lock&) = delete;
+
+		/// <summary>
+		/// 独占地加锁。如果失败，抛出 std::runtime_error 异常。
+		/// </summary>
+		void lock()
+		{
+#if __windows
+			if (!acquire(LOCKFILE_EXCLUSIVE_LOCK))
+#else
+			if (!acquire(LOCK_EX))
+#endif
+				throw std::runtime_error("fail to lock the file.");
+		}
+		[[nodiscard]] bool try_lock()
+		{
+#if __windows
+			return acquire(LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY);
+#else
+			return acquire(LOCK_EX | LOCK_NB);
+#endif
+		}
+		void unlock()
+		{
+			release();
+		}
+		/// <summary>
+		/// 共享地加锁。如果失败，抛出 std::runtime_error 异常。
+		/// </summary>
+		void lock_shared()
+		{
+#if __windows
+			if (!acquire(0))
+#else
+			if (!acquire(LOCK_SH))
+#endif
+				throw std::runtime_error("fail to lock the file.");
+		}
+		[[nodiscard]] bool try_lock_shared()
+		{
+#if __windows
+			return acquire(LOCKFILE_FAIL_IMMEDIATELY);
+#else
+			return acquire(LOCK_SH | LOCK_NB);
+#endif
+		}
+		void unlock_shared()
+		{
+			release();
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,365 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "directory_scan.hpp"
+
+#if __windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace miao::core
+{
+	/// <summary>
+	/// 在后台线程中监视一个目录树中文件的变化（Linux 下为 inotify，Windows 下为 ReadDirectoryChangesW），合并短时间内的连续变化后一次性报告。只在开始时列出一次目录树，之后新建的目录在收到通知时单独加入监视，不会重新扫描整个目录树。
+	/// </summary>
+	class file_watcher final
+	{
+	public:
+		/// <summary>
+		/// 一个文件的变化。
+		/// </summary>
+		struct change
+		{
+			std::filesystem::path path;
+			bool removed{}; // 文件被删除或移走。否则为被写入、创建或移入。
+		};
+		/// <summary>
+		/// 报告变化，在监视线程中调用。overflowed 为 true 表示系统丢弃了一部分通知，调用者需要自行重新读取整个目录树。
+		/// </summary>
+		using callback_t = std::function<void(const std::vector<change>& changes, bool overflowed)>;
+		/// <summary>
+		/// 判断一个目录是否需要监视。不需要监视的目录及其子目录中的变化不会被报告。
+		/// </summary>
+		using filter_t = std::function<bool(const std::filesystem::path& dir)>;
+
+		std::chrono::milliseconds debounce{ 200 }; // 没有新的变化这么长时间后报告。在 start 前设置。
+		std::chrono::milliseconds max_delay{ 1000 }; // 变化持续发生时，最多等待这么长时间就报告。在 start 前设置。
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		std::filesystem::path root;
+		callback_t callback;
+		filter_t filter;
+		std::thread worker;
+
+		std::map<std::filesystem::path, bool> batch; // 等待报告的变化，路径到是否被删除，后发生的覆盖先发生的。
+		bool overflowed{};
+		clock::time_point first_change, last_change;
+
+#if __windows
+		HANDLE dir_handle{ INVALID_HANDLE_VALUE };
+		HANDLE stop_event{};
+#elif defined(__linux__)
+		int inotify_fd{ -1 };
+		int stop_pipe[2]{ -1, -1 };
+		std::map<int, std::filesystem::path> watches; // 监视描述符到目录。
+#endif
+
+		void add(std::filesystem::path path, bool removed)
+		{
+			auto now = clock::now();
+			if (batch.empty() && !overflowed)
+				first_change = now;
+			last_change = now;
+			batch[std::move(path)] = removed;
+		}
+		void add_overflow()
+		{
+			auto now = clock::now();
+			if (batch.empty() && !overflowed)
+				first_change = now;
+			last_change = now;
+			overflowed = true;
+		}
+		/// <returns>
+		/// 距离应当报告的时刻还有多少毫秒。没有等待报告的变化时返回 -1。
+		/// </returns>
+		[[nodiscard]] long long remaining_ms() const
+		{
+			if (batch.empty() && !overflowed)
+				return -1;
+			auto due = std::min(last_change + debounce, first_change + max_delay);
+			auto ret = std::chrono::duration_cast<std::chrono::milliseconds>(due - clock::now()).count();
+			return std::max<long long>(ret, 0);
+		}
+		void report()
+		{
+			std::vector<change> changes;
+			changes.reserve(batch.size());
+			for (auto& [path, removed] : batch)
+				changes.push_back({ path, removed });
+			bool o = overflowed;
+			batch.clear();
+			overflowed = false;
+			if (callback)
+				callback(changes, o);
+		}
+
+#if __windows
+		void work()
+		{
+			std::unique_ptr<DWORD[]> buf(new DWORD[(64 << 10) / sizeof(DWORD)]); // FILE_NOTIFY_INFORMATION 按 DWORD 对齐。
+			OVERLAPPED ov{};
+			ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			constexpr DWORD filter_mask = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE;
+			bool reading = false;
+			while (true)
+			{
+				if (!reading)
+				{
+					ResetEvent(ov.hEvent);
+					if (!ReadDirectoryChangesW(dir_handle, buf.get(), 64 << 10, TRUE, filter_mask, nullptr, &ov, nullptr))
+						break;
+					reading = true;
+				}
+				HANDLE handles[2]{ ov.hEvent, stop_event };
+				long long ms = remaining_ms();
+				DWORD r = WaitForMultipleObjects(2, handles, FALSE, ms < 0 ? INFINITE : static_cast<DWORD>(ms));
+				if (r == WAIT_OBJECT_0 + 1)
+				{
+					CancelIoEx(dir_handle, &ov);
+					DWORD n{};
+					GetOverlappedResult(dir_handle, &ov, &n, TRUE);
+					break;
+				}
+				if (r == WAIT_TIMEOUT)
+				{
+					report();
+					continue;
+				}
+				if (r != WAIT_OBJECT_0)
+					break;
+
+				reading = false;
+				DWORD n{};
+				if (!GetOverlappedResult(dir_handle, &ov, &n, FALSE))
+					break;
+				if (!n) // 缓冲区不足以容纳所有通知。
+				{
+					add_overflow();
+					continue;
+				}
+				auto p = reinterpret_cast<const char*>(buf.get());
+				while (true)
+				{
+					auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+					auto path = root / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+					if (!filter || filter(path.parent_path()))
+					{
+						switch (info->Action)
+						{
+						case FILE_ACTION_ADDED:
+						case FILE_ACTION_MODIFIED:
+						case FILE_ACTION_RENAMED_NEW_NAME:
+							add(std::move(path), false);
+							break;
+						case FILE_ACTION_REMOVED:
+						case FILE_ACTION_RENAMED_OLD_NAME:
+							add(std::move(path), true);
+							break;
+						}
+					}
+					if (!info->NextEntryOffset)
+						break;
+					p += info->NextEntryOffset;
+				}
+			}
+			CloseHandle(ov.hEvent);
+		}
+#elif defined(__linux__)
+		static constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR;
+
+		/// <summary>
+		/// 监视目录及其子目录。
+		/// </summary>
+		/// <param name="report_files">是否把目录中已有的文件报告为变化。对于新建的目录，加入监视前写入的文件不会产生通知。</param>
+		void add_tree(const std::filesystem::path& dir, bool report_files)
+		{
+			if (filter && !filter(dir))
+				return;
+			int wd = inotify_add_watch(inotify_fd, dir.c_str(), watch_mask);
+			if (wd < 0)
+				return;
+			watches[wd] = dir;
+			std::vector<directory_scan::entry> entries;
+			try
+			{
+				entries = directory_scan::list(dir);
+			}
+			catch (const std::runtime_error&) // 目录已经被删除。
+			{
+				return;
+			}
+			for (const auto& e : entries)
+				if (e.is_directory)
+					add_tree(dir / e.name, report_files);
+				else if (report_files)
+					add(dir / e.name, false);
+		}
+		void work()
+		{
+			constexpr size_t buffer_size = 64 << 10;
+			std::unique_ptr<uint64_t[]> buf(new uint64_t[buffer_size / sizeof(uint64_t)]); // inotify_event 按 4 字节对齐。
+			while (true)
+			{
+				pollfd fds[2]{ { inotify_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+				long long ms = remaining_ms();
+				int r = ::poll(fds, 2, ms < 0 ? -1 : static_cast<int>(ms));
+				if (r < 0 && errno == EINTR)
+					continue;
+				if (r < 0 || fds[1].revents)
+					break;
+				if (!r)
+				{
+					report();
+					continue;
+				}
+
+				while (true)
+				{
+					ssize_t n = ::read(inotify_fd, buf.get(), buffer_size);
+					if (n <= 0)
+						break;
+					auto base = reinterpret_cast<const char*>(buf.get());
+					for (ssize_t pos = 0; pos < n;)
+					{
+						auto e = reinterpret_cast<const inotify_event*>(base + pos);
+						pos += sizeof(inotify_event) + e->len;
+
+						if (e->mask & IN_Q_OVERFLOW)
+						{
+							add_overflow();
+							continue;
+						}
+						if (e->mask & IN_IGNORED) // 目录被删除，监视自动移除。
+						{
+							watches.erase(e->wd);
+							continue;
+						}
+						auto it = watches.find(e->wd);
+						if (it == watches.end() || !e->len)
+							continue;
+						auto path = it->second / e->name;
+						if (e->mask & IN_ISDIR)
+						{
+							if (e->mask & (IN_CREATE | IN_MOVED_TO))
+								add_tree(path, true);
+						}
+						else if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+							add(std::move(path), false);
+						else if (e->mask & (IN_DELETE | IN_MOVED_FROM))
+							add(std::move(path), true);
+					}
+				}
+			}
+		}
+#endif
+
+	public:
+		file_watcher() = default;
+		~file_watcher()
+		{
+			stop();
+		}
+		file_watcher(const file_watcher&) = delete;
+		file_watcher& operator=(const file_watcher&) = delete;
+
+		/// <summary>
+		/// 开始监视。已经在监视时先停止。
+		/// </summary>
+		/// <param name="dir">目录树的根。</param>
+		/// <param name="on_change">报告变化的回调，在监视线程中调用，不应当再调用 start 或 stop。</param>
+		/// <param name="dir_filter">判断目录是否需要监视。为空表示监视所有目录。</param>
+		/// <returns>成功返回 true。无法监视或当前平台不支持时返回 false。</returns>
+		bool start(std::filesystem::path dir, callback_t on_change, filter_t dir_filter = {})
+		{
+			stop();
+			root = std::move(dir);
+			callback = std::move(on_change);
+			filter = std::move(dir_filter);
+			batch.clear();
+			overflowed = false;
+#if __windows
+			dir_handle = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+			if (dir_handle == INVALID_HANDLE_VALUE)
+				return false;
+			stop_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			worker = std::thread(&file_watcher::work, this);
+			return true;
+#elif defined(__linux__)
+			inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (inotify_fd < 0)
+				return false;
+			if (::pipe(stop_pipe) != 0)
+			{
+				::close(inotify_fd);
+				inotify_fd = -1;
+				return false;
+			}
+			add_tree(root, false);
+			if (watches.empty())
+			{
+				stop();
+				return false;
+			}
+			worker = std::thread(&file_watcher::work, this);
+			return true;
+#else
+			return false;
+#endif
+		}
+		/// <summary>
+		/// 停止监视并等待监视线程结束。还没有报告的变化被丢弃。
+		/// </summary>
+		void stop()
+		{
+#if __windows
+			if (stop_event)
+				SetEvent(stop_event);
+			if (worker.joinable())
+				worker.join();
+			if (dir_handle != INVALID_HANDLE_VALUE)
+				CloseHandle(dir_handle);
+			if (stop_event)
+				CloseHandle(stop_event);
+			dir_handle = INVALID_HANDLE_VALUE;
+			stop_event = nullptr;
+#elif defined(__linux__)
+			if (stop_pipe[1] >= 0)
+			{
+				char ch{};
+				(void)!::write(stop_pipe[1], &ch, 1);
+			}
+			if (worker.joinable())
+				worker.join();
+			auto close = [](int& fd)
+			{
+				if (fd >= 0)
+					::close(fd);
+				fd = -1;
+			};
+			close(inotify_fd);
+			close(stop_pipe[0]);
+			close(stop_pipe[1]);
+			watches.clear();
+#endif
+		}
+		[[nodiscard]] bool running() const
+		{
+			return worker.joinable();
+		}
+	};
+}
\ No newline at end of file
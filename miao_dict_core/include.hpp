@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include <vector>
+#include <deque>
 #include <string>
 #include <string_view>
 #include <set>
@@ -13,14 +14,21 @@
 #include <type_traits>
 #include <filesystem>
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
 #include <variant>
 #include <optional>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <cmath>
+#include <chrono>
 
 #include <json/json.h>
 
 #include "cppver.hpp"
 #include "utf_conv.hpp"
+#include "atomic_file.hpp"
 
 namespace miao::core
 {
@@ -145,12 +153,14 @@ namespace miao::core
 			fs.read(reinterpret_cast<char*>(buf.data()), len);
 			from_string(buf.data());
 		}
+		/// <summary>
+		/// 将 to_string 的结果原子地写入文件，写入失败时原来的文件不变。如果失败，将抛出 std::runtime_error。
+		/// </summary>
+		/// <param name="filename">文件名。</param>
 		void to_file(std::filesystem::path filename) const
 		{
-			filename.make_preferred();
-			std::ofstream fs(filename);
 			std::u8string str = to_string();
-			fs.write(reinterpret_cast<char*>(str.data()), str.length());
+			atomic_file::write(std::move(filename), { reinterpret_cast<const char*>(str.data()), str.length() });
 		}
 	};
 	/// <summary>
@@ -0,0 +1,153 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 可按键修改优先级的二叉堆。堆顶是 compare 意义下最小的元素。插入、删除和修改优先级都是 O(log n)，查询堆顶是 O(1)。
+	/// </summary>
+	/// <typeparam name="key_t">键，需要能作为 std::unordered_map 的键，hash_t 为其哈希。</typeparam>
+	/// <typeparam name="priority_t">优先级。</typeparam>
+	/// <typeparam name="compare_t">比较 (优先级, 键)，返回左边是否应当在上。</typeparam>
+	template <typename key_t, typename priority_t, typename compare_t, typename hash_t = std::hash<key_t>>
+	class indexed_heap final
+	{
+	private:
+		std::vector<std::pair<priority_t, key_t>> heap;
+		std::unordered_map<key_t, size_t, hash_t> position; // 键在 heap 中的下标。
+		compare_t compare;
+
+		[[nodiscard]] bool before(size_t a, size_t b) const
+		{
+			return compare(heap[a], heap[b]);
+		}
+		void swap_nodes(size_t a, size_t b)
+		{
+			std::swap(heap[a], heap[b]);
+			position[heap[a].second] = a;
+			position[heap[b].second] = b;
+		}
+		void sift_up(size_t i)
+		{
+			while (i)
+			{
+				size_t p = (i - 1) / 2;
+				if (!before(i, p))
+					break;
+				swap_nodes(i, p);
+				i = p;
+			}
+		}
+		void sift_down(size_t i)
+		{
+			while (true)
+			{
+				size_t l = i * 2 + 1, r = l + 1, m = i;
+				if (l < heap.size() && before(l, m))
+					m = l;
+				if (r < heap.size() && before(r, m))
+					m = r;
+				if (m == i)
+					break;
+				swap_nodes(i, m);
+				i = m;
+			}
+		}
+
+	public:
+		indexed_heap() = default;
+		explicit indexed_heap(compare_t compare) : compare(std::move(compare)) {}
+
+		[[nodiscard]] size_t size() const
+		{
+			return heap.size();
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return heap.empty();
+		}
+		[[nodiscard]] bool contains(const key_t& key) const
+		{
+			return position.count(key);
+		}
+		void clear()
+		{
+			heap.clear();
+			position.clear();
+		}
+		void reserve(size_t n)
+		{
+			heap.reserve(n);
+			position.reserve(n);
+		}
+
+		/// <returns>
+		/// 堆顶的 (优先级, 键)。堆为空时行为未定义。
+		/// </returns>
+		[[nodiscard]] const std::pair<priority_t, key_t>& top() const
+		{
+			return heap.front();
+		}
+		/// <returns>
+		/// 键的优先级。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<priority_t> priority_of(const key_t& key) const
+		{
+			auto it = position.find(key);
+			if (it == position.end())
+				return std::nullopt;
+			return heap[it->second].first;
+		}
+
+		/// <summary>
+		/// 插入键，或修改已有键的优先级。
+		/// </summary>
+		void set(const key_t& key, priority_t priority)
+		{
+			auto it = position.find(key);
+			if (it == position.end())
+			{
+				position.emplace(key, heap.size());
+				heap.emplace_back(std::move(priority), key);
+				sift_up(heap.size() - 1);
+				return;
+			}
+			size_t i = it->second;
+			heap[i].first = std::move(priority);
+			sift_up(i);
+			sift_down(i); // 如果已经上移，i 处是原来的父节点，不会再下移。
+		}
+		/// <summary>
+		/// 删除键。
+		/// </summary>
+		/// <returns>是否存在。</returns>
+		bool erase(const key_t& key)
+		{
+			auto it = position.find(key);
+			if (it == position.end())
+				return false;
+			size_t i = it->second;
+			size_t last = heap.size() - 1;
+			if (i != last)
+				swap_nodes(i, last);
+			position.erase(heap.back().second);
+			heap.pop_back();
+			if (i < heap.size())
+			{
+				sift_up(i);
+				sift_down(i);
+			}
+			return true;
+		}
+		/// <summary>
+		/// 删除并返回堆顶。堆为空时行为未定义。
+		/// </summary>
+		std::pair<priority_t, key_t> pop()
+		{
+			auto ret = heap.front();
+			erase(ret.second);
+			return ret;
+		}
+	};
+}
\ No newline at end of file
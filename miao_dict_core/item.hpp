@@ -8,7 +8,7 @@ namespace miao::core
 	{
 	public:
 		// 版本标记
-		static constexpr int latest_ver_tag = 1;
+		static constexpr int latest_ver_tag = 3;
 		int ver_tag = latest_ver_tag;
 
 		// 基础数据
@@ -18,6 +18,7 @@ namespace miao::core
 		std::vector<std::u32string> notations;
 		std::vector<std::tuple<id_t, id_t, std::u32string, std::u32string>> translations; // (id, lib_id, tag, meaning)
 		std::vector<std::tuple<id_t, id_t>> sentences; // (id, trans_id)
+		std::vector<id_t> pronunciations; // 版本 3：发音 id，对应库的语音库中的音频。
 
 		// 常驻显示
 		uint_t showing_time{};
@@ -31,6 +32,13 @@ namespace miao::core
 		// 查询
 		uint_t n_query{};
 
+		// 版本 2：复习
+		uint_t review_due{}; // 下次复习的时间（自 1970 年起的毫秒数），0 表示还没有开始复习。
+		uint_t review_interval{}; // 当前的复习间隔（毫秒）。
+		uint_t review_ease{}; // 难度系数（千分之一），0 表示使用默认值。
+		uint_t n_reviews{};
+		uint_t n_lapses{}; // 复习时忘记的次数。
+
 	public:
 		[[nodiscard]] virtual Json::Value to_json() const override
 		{
@@ -66,6 +74,10 @@ namespace miao::core
 				root["sentences"].append(trans);
 			}
 
+			root["pronunciations"].resize(0);
+			for (const auto& t : pronunciations)
+				root["pronunciations"].append(t);
+
 			root["showing_time"] = showing_time;
 			root["n_skips"] = n_skips;
 			root["n_flick"] = n_flick;
@@ -73,6 +85,12 @@ namespace miao::core
 			root["n_pronounce"] = n_pronounce;
 			root["n_query"] = n_query;
 
+			root["review_due"] = review_due;
+			root["review_interval"] = review_interval;
+			root["review_ease"] = review_ease;
+			root["n_reviews"] = n_reviews;
+			root["n_lapses"] = n_lapses;
+
 			return root;
 		}
 		virtual void from_json(const Json::Value& value) override
@@ -117,6 +135,24 @@ namespace miao::core
 				n_query = value["n_query"].asUInt64();
 
 				ver_tag = 1;
+
+				if (!value.isMember("review_due"))
+					throw deserialize_error("review state is missing.");
+				review_due = value["review_due"].asUInt64();
+				review_interval = value["review_interval"].asUInt64();
+				review_ease = value["review_ease"].asUInt64();
+				n_reviews = value["n_reviews"].asUInt64();
+				n_lapses = value["n_lapses"].asUInt64();
+
+				ver_tag = 2;
+
+				if (!value.isMember("pronunciations"))
+					throw deserialize_error("pronunciations are missing.");
+				pronunciations.resize(value["pronunciations"].size());
+				for (size_t i = 0; i < pronunciations.size(); i++)
+					pronunciations[i] = value["pronunciations"][static_cast<Json::ArrayIndex>(i)].asUInt64();
+
+				ver_tag = 3;
 			}
 			catch (...)
 			{
@@ -0,0 +1,532 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "item.hpp"
+#include "library.hpp"
+#include "resident_scheduler.hpp"
+
+#include <condition_variable>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 学习事件的种类。
+	/// </summary>
+	enum class learning_event_kind : uint8_t
+	{
+		show = 0, // 常驻显示，value 为显示的时间（毫秒）。
+		skip = 1, // 常驻显示中手动跳过。
+		flick = 2, // 轮巡显示中出现。
+		pause = 3, // 轮巡显示中手动暂停。
+		pronounce = 4, // 要求朗读。
+		query = 5, // 查询。
+	};
+
+	/// <summary>
+	/// 一次学习事件。
+	/// </summary>
+	struct learning_event
+	{
+		id_t lib_id{};
+		id_t item_id{};
+		uint64_t time{}; // 自 1970 年起的毫秒数。
+		uint32_t value{};
+		learning_event_kind kind{};
+	};
+
+	/// <summary>
+	/// item 的学习计数。
+	/// </summary>
+	struct learning_counters
+	{
+		uint_t showing_time{};
+		uint_t n_skips{};
+		uint_t n_flick{};
+		uint_t n_pause{};
+		uint_t n_pronounce{};
+		uint_t n_query{};
+
+		[[nodiscard]] static learning_counters of(const item& it)
+		{
+			return { it.showing_time, it.n_skips, it.n_flick, it.n_pause, it.n_pronounce, it.n_query };
+		}
+		learning_counters& operator+=(const learning_counters& rhs)
+		{
+			showing_time += rhs.showing_time;
+			n_skips += rhs.n_skips;
+			n_flick += rhs.n_flick;
+			n_pause += rhs.n_pause;
+			n_pronounce += rhs.n_pronounce;
+			n_query += rhs.n_query;
+			return *this;
+		}
+		/// <summary>
+		/// 把计数累加到 item 上。
+		/// </summary>
+		void add_to(item& it) const
+		{
+			it.showing_time += showing_time;
+			it.n_skips += n_skips;
+			it.n_flick += n_flick;
+			it.n_pause += n_pause;
+			it.n_pronounce += n_pronounce;
+			it.n_query += n_query;
+		}
+		/// <summary>
+		/// 累加一次事件。
+		/// </summary>
+		void apply(const learning_event& e)
+		{
+			switch (e.kind)
+			{
+			case learning_event_kind::show: showing_time += e.value; break;
+			case learning_event_kind::skip: n_skips++; break;
+			case learning_event_kind::flick: n_flick++; break;
+			case learning_event_kind::pause: n_pause++; break;
+			case learning_event_kind::pronounce: n_pronounce++; break;
+			case learning_event_kind::query: n_query++; break;
+			}
+		}
+	};
+
+	/// <summary>
+	/// 单生产者单消费者的无锁环形缓冲区，每个记录事件的线程有一个。
+	/// </summary>
+	class event_buffer final
+	{
+	private:
+		static constexpr size_t capacity = 4096; // 2 的幂。
+		std::unique_ptr<learning_event[]> data{ new learning_event[capacity] };
+		alignas(64) std::atomic<size_t> head{}; // 消费者读取的位置。
+		alignas(64) std::atomic<size_t> tail{}; // 生产者写入的位置。
+
+	public:
+		std::atomic<bool> closed{}; // 生产者线程已经退出。
+
+		/// <summary>
+		/// 由生产者调用。
+		/// </summary>
+		/// <returns>如果已满，返回 false。</returns>
+		bool try_push(const learning_event& e)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == capacity)
+				return false;
+			data[t & (capacity - 1)] = e;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+		/// <summary>
+		/// 由消费者调用，对所有已经写入的事件调用 callback。
+		/// </summary>
+		/// <returns>处理的事件个数。</returns>
+		template <typename callback_t>
+		size_t drain(callback_t&& callback)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			size_t t = tail.load(std::memory_order_acquire);
+			for (size_t i = h; i != t; i++)
+				callback(data[i & (capacity - 1)]);
+			head.store(t, std::memory_order_release);
+			return t - h;
+		}
+	};
+
+	/// <summary>
+	/// 汇总后的计数表，开放寻址，只有一个写者。每个槽有一个序号（seqlock），读者不加锁，读到写了一半的槽时重试，因此读者不会阻塞写者。只插入不删除，槽的键一旦写入就不再改变。
+	/// </summary>
+	class counter_table final
+	{
+	public:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+	private:
+		static constexpr uint64_t empty_key = std::numeric_limits<uint64_t>::max();
+		static constexpr size_t n_counters = 6;
+
+		struct slot
+		{
+			std::atomic<uint64_t> seq{}; // 奇数表示正在写入。
+			std::atomic<uint64_t> lib_id{ empty_key };
+			std::atomic<uint64_t> item_id{};
+			std::array<std::atomic<uint64_t>, n_counters> values{};
+		};
+
+		std::unique_ptr<slot[]> slots;
+		size_t mask;
+		size_t count{};
+
+		[[nodiscard]] size_t find_slot(const key_t& key) const
+		{
+			size_t i = item_key_hash()(key) & mask;
+			while (true)
+			{
+				uint64_t lib = slots[i].lib_id.load(std::memory_order_acquire);
+				if (lib == empty_key || (lib == key.first && slots[i].item_id.load(std::memory_order_relaxed) == key.second))
+					return i;
+				i = (i + 1) & mask;
+			}
+		}
+		[[nodiscard]] static std::array<uint64_t, n_counters> pack(const learning_counters& c)
+		{
+			return { c.showing_time, c.n_skips, c.n_flick, c.n_pause, c.n_pronounce, c.n_query };
+		}
+		[[nodiscard]] static learning_counters unpack(const std::array<uint64_t, n_counters>& v)
+		{
+			return { v[0], v[1], v[2], v[3], v[4], v[5] };
+		}
+
+	public:
+		explicit counter_table(size_t capacity)
+		{
+			size_t n = 16;
+			while (n < capacity)
+				n <<= 1;
+			slots.reset(new slot[n]);
+			mask = n - 1;
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return count;
+		}
+		[[nodiscard]] size_t capacity() const
+		{
+			return mask + 1;
+		}
+		/// <returns>
+		/// 是否应当扩容。只由写者调用。
+		/// </returns>
+		[[nodiscard]] bool full() const
+		{
+			return (count + 1) * 2 > capacity();
+		}
+
+		/// <summary>
+		/// 读取计数。可以在任意线程中调用，不加锁。
+		/// </summary>
+		/// <returns>计数。如果不存在，返回 std::nullopt。</returns>
+		[[nodiscard]] std::optional<learning_counters> read(const key_t& key) const
+		{
+			const auto& s = slots[find_slot(key)];
+			if (s.lib_id.load(std::memory_order_acquire) == empty_key)
+				return std::nullopt;
+			std::array<uint64_t, n_counters> v;
+			while (true)
+			{
+				uint64_t s1 = s.seq.load(std::memory_order_acquire);
+				if (s1 & 1)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				for (size_t i = 0; i < n_counters; i++)
+					v[i] = s.values[i].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (s.seq.load(std::memory_order_relaxed) == s1)
+					return unpack(v);
+			}
+		}
+		/// <summary>
+		/// 写入计数。只由写者调用，要求 full() 为 false 或键已经存在。
+		/// </summary>
+		void write(const key_t& key, const learning_counters& c)
+		{
+			auto& s = slots[find_slot(key)];
+			auto v = pack(c);
+			uint64_t seq = s.seq.load(std::memory_order_relaxed);
+			s.seq.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t i = 0; i < n_counters; i++)
+				s.values[i].store(v[i], std::memory_order_relaxed);
+			if (s.lib_id.load(std::memory_order_relaxed) == empty_key)
+			{
+				s.item_id.store(key.second, std::memory_order_relaxed);
+				s.lib_id.store(key.first, std::memory_order_release);
+				count++;
+			}
+			s.seq.store(seq + 2, std::memory_order_release);
+		}
+		/// <summary>
+		/// 对所有的计数调用 callback(key, counters)。只由写者调用。
+		/// </summary>
+		template <typename callback_t>
+		void for_each(callback_t&& callback) const
+		{
+			for (size_t i = 0; i <= mask; i++)
+			{
+				uint64_t lib = slots[i].lib_id.load(std::memory_order_relaxed);
+				if (lib == empty_key)
+					continue;
+				std::array<uint64_t, n_counters> v;
+				for (size_t j = 0; j < n_counters; j++)
+					v[j] = slots[i].values[j].load(std::memory_order_relaxed);
+				callback(key_t{ lib, slots[i].item_id.load(std::memory_order_relaxed) }, unpack(v));
+			}
+		}
+	};
+
+	/// <summary>
+	/// 学习事件的汇总器。各个线程把事件写入自己的无锁缓冲区，后台线程定期取出事件并累加到计数表中。
+	/// 记录事件不加锁（只在线程第一次记录时注册缓冲区）；读取计数也不加锁，总是得到某个时刻的一致的计数。计数表扩容后旧表仍然保留，供正在读取的线程使用，总内存不超过最终大小的两倍。
+	/// 除了总数，还单独累计上次 take_deltas 后的增量。写回 item 时只累加增量，因此不经过汇总器对 item 计数的修改（如直接修改 item、从文件重新读取）不会被覆盖。
+	/// </summary>
+	class event_aggregator final
+	{
+	public:
+		using key_t = counter_table::key_t;
+		using sink_t = std::function<void(const std::vector<learning_event>&)>;
+
+	private:
+		inline static std::atomic<uint64_t> next_serial{ 1 };
+		const uint64_t serial{ next_serial++ }; // 区分不同的汇总器，不会因为地址重用而混淆。
+
+		/// <summary>
+		/// 线程的缓冲区列表。线程退出时标记缓冲区，由后台线程处理完剩余事件后移除。
+		/// </summary>
+		struct thread_buffers
+		{
+			std::vector<std::pair<uint64_t, std::shared_ptr<event_buffer>>> list;
+			~thread_buffers()
+			{
+				for (auto& [serial, buffer] : list)
+					buffer->closed.store(true, std::memory_order_release);
+			}
+		};
+
+		std::mutex mutex; // 保护以下成员。
+		std::condition_variable cv;
+		std::vector<std::shared_ptr<event_buffer>> buffers;
+		std::vector<sink_t> sinks;
+		uint64_t requested{}; // flush 请求的序号。
+		uint64_t completed{};
+		bool stopping{};
+		std::atomic<bool> pressing{}; // 有缓冲区已满。
+
+		std::mutex write_mutex; // 计数表的写者之间互斥，读者不需要。同时保护 deltas。
+		std::unordered_map<key_t, learning_counters, item_key_hash> deltas; // 上次 take_deltas 后累加的增量。
+		std::vector<std::unique_ptr<counter_table>> tables; // 所有的表，最后一个是当前的表。
+		std::atomic<counter_table*> current{};
+
+		std::thread worker;
+
+		event_buffer& local_buffer()
+		{
+			thread_local thread_buffers local;
+			for (auto& [s, buffer] : local.list)
+				if (s == serial)
+					return *buffer;
+			auto buffer = std::make_shared<event_buffer>();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				buffers.push_back(buffer);
+			}
+			local.list.emplace_back(serial, buffer);
+			return *buffer;
+		}
+		/// <summary>
+		/// 用 item 的计数和还没有取出的增量作为总数。需要持有 write_mutex。
+		/// </summary>
+		void seed_locked(id_t lib_id, const item& it)
+		{
+			key_t key{ lib_id, it.id };
+			auto c = learning_counters::of(it);
+			if (auto d = deltas.find(key); d != deltas.end())
+				c += d->second;
+			write(key, c);
+		}
+		/// <summary>
+		/// 写入计数，必要时扩容。需要持有 write_mutex。
+		/// </summary>
+		void write(const key_t& key, const learning_counters& c)
+		{
+			auto* table = current.load(std::memory_order_relaxed);
+			if (table->full() && !table->read(key))
+			{
+				auto bigger = std::make_unique<counter_table>(table->capacity() * 2);
+				table->for_each([&bigger](const key_t& k, const learning_counters& v) { bigger->write(k, v); });
+				table = bigger.get();
+				tables.push_back(std::move(bigger));
+				current.store(table, std::memory_order_release);
+			}
+			table->write(key, c);
+		}
+		/// <summary>
+		/// 取出所有缓冲区中的事件并累加。
+		/// </summary>
+		void drain()
+		{
+			std::vector<std::shared_ptr<event_buffer>> list;
+			std::vector<sink_t> sink_list;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				list = buffers;
+				sink_list = sinks;
+			}
+
+			std::vector<learning_event> events;
+			std::vector<std::shared_ptr<event_buffer>> finished;
+			for (auto& buffer : list)
+			{
+				bool closed = buffer->closed.load(std::memory_order_acquire);
+				buffer->drain([&events](const learning_event& e) { events.push_back(e); });
+				if (closed) // 关闭后不会再有新的事件。
+					finished.push_back(buffer);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(write_mutex);
+				auto* table = current.load(std::memory_order_relaxed);
+				for (const auto& e : events)
+				{
+					key_t key{ e.lib_id, e.item_id };
+					auto c = table->read(key).value_or(learning_counters());
+					c.apply(e);
+					write(key, c);
+					table = current.load(std::memory_order_relaxed);
+					deltas[key].apply(e);
+				}
+			}
+
+			if (!finished.empty())
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+					buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [&finished](const auto& b)
+						{
+							return std::find(finished.begin(), finished.end(), b) != finished.end();
+						}), buffers.end());
+			}
+			if (!events.empty())
+				for (const auto& sink : sink_list)
+					sink(events);
+		}
+		void work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				cv.wait_for(lock, interval, [this]() { return stopping || requested != completed || pressing.load(); });
+				pressing.store(false);
+				bool stop = stopping;
+				uint64_t target = requested;
+				lock.unlock();
+				drain();
+				lock.lock();
+				completed = target;
+				cv.notify_all();
+				if (stop)
+					return;
+			}
+		}
+
+	public:
+		std::chrono::milliseconds interval{ 100 }; // 后台汇总的间隔。
+
+		event_aggregator()
+		{
+			tables.push_back(std::make_unique<counter_table>(1024));
+			current.store(tables.back().get());
+			worker = std::thread(&event_aggregator::work, this);
+		}
+		~event_aggregator()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			cv.notify_all();
+			worker.join();
+		}
+		event_aggregator(const event_aggregator&) = delete;
+		event_aggregator& operator=(const event_aggregator&) = delete;
+
+		/// <summary>
+		/// 记录一次事件。不加锁，只在缓冲区满时等待后台线程。
+		/// </summary>
+		void record(const learning_event& e)
+		{
+			auto& buffer = local_buffer();
+			while (!buffer.try_push(e))
+			{
+				if (!pressing.exchange(true))
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					cv.notify_one();
+				}
+				std::this_thread::yield();
+			}
+		}
+		/// <summary>
+		/// 记录一次事件，时间为当前时间。
+		/// </summary>
+		void record(id_t lib_id, id_t item_id, learning_event_kind kind, uint32_t value = 0)
+		{
+			learning_event e;
+			e.lib_id = lib_id;
+			e.item_id = item_id;
+			e.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count());
+			e.value = value;
+			e.kind = kind;
+			record(e);
+		}
+
+		/// <summary>
+		/// 用库中 item 的计数加上还没有取出的增量作为总数，已有的总数会被覆盖。
+		/// </summary>
+		void seed(const library& lib)
+		{
+			std::lock_guard<std::mutex> lock(write_mutex);
+			for (const auto& [id, it] : lib.items)
+				seed_locked(lib.id, it);
+		}
+		/// <summary>
+		/// 用 item 的计数加上还没有取出的增量作为总数。item 的计数不经过汇总器改变后（如直接修改 item、从文件重新读取）调用，使读取的总数与 item 一致。
+		/// </summary>
+		void seed(id_t lib_id, const std::vector<item>& items)
+		{
+			std::lock_guard<std::mutex> lock(write_mutex);
+			for (const auto& it : items)
+				seed_locked(lib_id, it);
+		}
+		/// <summary>
+		/// 添加事件的接收者，每次汇总后在后台线程中以这次汇总的所有事件调用。
+		/// </summary>
+		void add_sink(sink_t sink)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			sinks.push_back(std::move(sink));
+		}
+
+		/// <summary>
+		/// 读取汇总后的计数。不加锁，不会阻塞记录和汇总。
+		/// </summary>
+		/// <returns>计数。如果没有初始值也没有事件，返回 std::nullopt。</returns>
+		[[nodiscard]] std::optional<learning_counters> counters_of(id_t lib_id, id_t item_id) const
+		{
+			return current.load(std::memory_order_acquire)->read({ lib_id, item_id });
+		}
+		/// <summary>
+		/// 等待调用前记录的所有事件汇总完成。
+		/// </summary>
+		void flush()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			uint64_t target = ++requested;
+			cv.notify_all();
+			cv.wait(lock, [this, target]() { return completed >= target; });
+		}
+		/// <summary>
+		/// 取出上次调用后汇总的增量。取出的增量应当累加到 item 上。
+		/// </summary>
+		/// <returns>计数改变过的 item 和增量，按 (lib_id, item_id) 排序。</returns>
+		std::vector<std::pair<key_t, learning_counters>> take_deltas()
+		{
+			std::lock_guard<std::mutex> lock(write_mutex);
+			std::vector<std::pair<key_t, learning_counters>> ret(deltas.begin(), deltas.end());
+			deltas.clear();
+			std::sort(ret.begin(), ret.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+			return ret;
+		}
+	};
+}
\ No newline at end of file
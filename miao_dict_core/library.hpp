@@ -3,6 +3,8 @@
 #include "include.hpp"
 #include "item.hpp"
 #include "passage.hpp"
+#include "raw_item_index.hpp"
+#include "persistent_map.hpp"
 
 namespace miao::core
 {
@@ -18,15 +20,16 @@ namespace miao::core
 		std::u32string tag;
 		std::u32string lang;
 
+		// 内容在库的副本之间共享：复制库不复制 item、片段和 raw_item，修改副本只复制改变的部分。
 		// dict
-		std::map<id_t, item> items;
-		std::vector<raw_item> raw_items;
+		persistent_map<id_t, item> items;
+		std::shared_ptr<const raw_item_index> raw_items = std::make_shared<const raw_item_index>(); // 修改时先复制，再替换指针。
 
 		// raw
-		std::vector<passage> passages;
+		persistent_map<id_t, passage> passages; // 片段 id 到片段的映射。
 
 		// pronunciations
-		// TODO
+		// 音频保存在库的语音库（pronunciation_store）中，由 system 打开，item 中只保存发音 id。
 
 	public:
 		[[nodiscard]] virtual Json::Value to_json() const override
@@ -0,0 +1,178 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+#include <condition_variable>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 加载进行到的阶段。
+	/// </summary>
+	enum class load_stage : uint8_t
+	{
+		prepare, // 创建目录，打开句子库，列出所有库。
+		check, // 检查并修复一个库的文件。
+		read, // 读取一个库的文件。
+		done, // 加载结束（成功、失败或被取消）。
+	};
+
+	/// <summary>
+	/// 加载的进度。
+	/// </summary>
+	struct load_progress
+	{
+		load_stage stage{ load_stage::prepare };
+		size_t n_libraries{}; // 要加载的库的个数，prepare 阶段结束后可用。
+		size_t n_published{}; // 已经可用的库的个数。
+		id_t lib_id{}; // 正在检查或读取的库。
+		size_t n_files{}; // 当前阶段中这个库的文件个数。
+		size_t n_done_files{}; // 当前阶段中这个库已经处理的文件个数。
+	};
+
+	/// <summary>
+	/// 加载被取消时在加载线程中抛出，由 system 捕获。
+	/// </summary>
+	class load_cancelled : public std::runtime_error { using std::runtime_error::runtime_error; };
+
+	/// <summary>
+	/// 一次加载的句柄，由 system::load_async 返回。可以在任意线程中查询进度、等待某个库可用、等待加载结束或取消加载。
+	/// 回调在加载线程中调用，不应当阻塞，也不应当再次加载。
+	/// </summary>
+	class load_task final
+	{
+	public:
+		using callback_t = std::function<void(const load_progress&)>;
+
+	private:
+		static constexpr size_t report_interval = 64; // 每处理这么多文件调用一次回调。
+
+		mutable std::mutex mutex;
+		mutable std::condition_variable cv;
+		load_progress current;
+		std::set<id_t> published_ids;
+		std::optional<bool> result; // 结束后有值。
+		std::atomic<bool> cancelling{};
+		callback_t callback;
+
+		/// <summary>
+		/// 在持有 mutex 时修改进度，之后在不持有 mutex 时调用回调。
+		/// </summary>
+		template <typename modify_t>
+		void update(modify_t&& modify, bool notify)
+		{
+			load_progress p;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!modify(current))
+					return;
+				p = current;
+			}
+			if (notify)
+				cv.notify_all();
+			if (callback)
+				callback(p);
+		}
+
+	public:
+		explicit load_task(callback_t callback = {}) : callback(std::move(callback)) {}
+		load_task(const load_task&) = delete;
+		load_task& operator=(const load_task&) = delete;
+
+		/// <summary>
+		/// 请求取消加载。加载线程在处理下一个文件前停止，已经可用的库仍然可用。
+		/// </summary>
+		void cancel()
+		{
+			cancelling = true;
+		}
+		[[nodiscard]] bool cancelled() const
+		{
+			return cancelling;
+		}
+		[[nodiscard]] load_progress progress() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return current;
+		}
+		[[nodiscard]] bool done() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return result.has_value();
+		}
+		/// <summary>
+		/// 等待加载结束。
+		/// </summary>
+		/// <returns>加载成功返回 true，失败或被取消返回 false。</returns>
+		bool wait() const
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this]() { return result.has_value(); });
+			return *result;
+		}
+		/// <summary>
+		/// 等待指定的库可用。本地库（id 为 0）总是最先可用。
+		/// </summary>
+		/// <returns>库可用返回 true；加载结束时库仍然不可用返回 false。</returns>
+		bool wait_library(id_t lib_id) const
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this, lib_id]() { return published_ids.count(lib_id) || result.has_value(); });
+			return published_ids.count(lib_id);
+		}
+
+	public: // 以下由 system 在加载线程中调用。
+		void begin(size_t n_libraries)
+		{
+			update([n_libraries](load_progress& p) { p.n_libraries = n_libraries; return true; }, false);
+		}
+		/// <summary>
+		/// 开始检查或读取一个库。
+		/// </summary>
+		void start(load_stage stage, id_t lib_id, size_t n_files)
+		{
+			update([=](load_progress& p)
+				{
+					p.stage = stage;
+					p.lib_id = lib_id;
+					p.n_files = n_files;
+					p.n_done_files = 0;
+					return true;
+				}, false);
+		}
+		/// <summary>
+		/// 处理一个文件前调用。如果已经请求取消，抛出 load_cancelled 异常。
+		/// </summary>
+		void step()
+		{
+			if (cancelling)
+				throw load_cancelled("load is cancelled.");
+			update([](load_progress& p)
+				{
+					p.n_done_files++;
+					return p.n_done_files % report_interval == 0 || p.n_done_files == p.n_files;
+				}, false);
+		}
+		/// <summary>
+		/// 库已经发布到快照中。
+		/// </summary>
+		void publish(id_t lib_id)
+		{
+			update([this, lib_id](load_progress& p)
+				{
+					published_ids.insert(lib_id);
+					p.n_published++;
+					return true;
+				}, true);
+		}
+		void finish(bool success)
+		{
+			update([this, success](load_progress& p)
+				{
+					p.stage = load_stage::done;
+					result = success;
+					return true;
+				}, true);
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+#if __windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace miao::core
+{
+	/// <summary>
+	/// 只读地映射到内存中的文件。映射时文件的内容之后追加的部分不可见，需要重新映射。
+	/// </summary>
+	class mapped_file final
+	{
+	private:
+		const char* _data{};
+		size_t _size{};
+#if __windows
+		HANDLE file{ INVALID_HANDLE_VALUE };
+		HANDLE mapping{};
+#endif
+
+		void release()
+		{
+#if __windows
+			if (_data)
+				UnmapViewOfFile(_data);
+			if (mapping)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (_data)
+				munmap(const_cast<char*>(_data), _size);
+#endif
+			_data = nullptr;
+			_size = 0;
+		}
+
+	public:
+		/// <summary>
+		/// 映射指定的文件。如果无法映射，抛出 std::runtime_error 异常。空文件不需要映射，data() 为 nullptr。
+		/// </summary>
+		explicit mapped_file(const std::filesystem::path& path)
+		{
+#if __windows
+			file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("fail to open the file to map.");
+			LARGE_INTEGER size{};
+			if (!GetFileSizeEx(file, &size))
+			{
+				release();
+				throw std::runtime_error("fail to get the size of the file to map.");
+			}
+			if (!size.QuadPart)
+				return;
+			mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!mapping)
+			{
+				release();
+				throw std::runtime_error("fail to map the file.");
+			}
+			_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!_data)
+			{
+				release();
+				throw std::runtime_error("fail to map the file.");
+			}
+			_size = static_cast<size_t>(size.QuadPart);
+#else
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw std::runtime_error("fail to open the file to map.");
+			struct stat st {};
+			if (fstat(fd, &st) != 0)
+			{
+				::close(fd);
+				throw std::runtime_error("fail to get the size of the file to map.");
+			}
+			if (st.st_size)
+			{
+				void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+				if (p == MAP_FAILED)
+				{
+					::close(fd);
+					throw std::runtime_error("fail to map the file.");
+				}
+				_data = static_cast<const char*>(p);
+				_size = static_cast<size_t>(st.st_size);
+			}
+			::close(fd); // 映射在关闭文件后仍然有效。
+#endif
+		}
+		~mapped_file()
+		{
+			release();
+		}
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		[[nodiscard]] const char* data() const
+		{
+			return _data;
+		}
+		[[nodiscard]] size_t size() const
+		{
+			return _size;
+		}
+		[[nodiscard]] std::string_view view() const
+		{
+			return { _data, _size };
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,344 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 持久化的有序映射（路径复制的 AVL 树）。复制映射只复制根的指针，是 O(1) 的，副本之间共享所有节点；修改时只复制从根到被修改的节点的路径，是 O(log n) 的，不影响其他副本。
+	/// 只被这个映射持有的节点直接原地修改，因此逐个插入构造映射时不会复制节点。可以在多个线程中同时读取和复制同一个映射；修改需要独占这个映射对象，其他副本不受影响。
+	/// </summary>
+	/// <typeparam name="key_t">键。</typeparam>
+	/// <typeparam name="value_t">值。</typeparam>
+	/// <typeparam name="compare_t">键的比较。</typeparam>
+	template <typename key_t, typename value_t, typename compare_t = std::less<key_t>>
+	class persistent_map final
+	{
+	public:
+		using value_type = std::pair<const key_t, value_t>;
+
+	private:
+		struct node
+		{
+			std::shared_ptr<const node> left, right;
+			value_type value;
+			int height{ 1 };
+
+			template <typename v_t>
+			node(const key_t& key, v_t&& v) : value(key, std::forward<v_t>(v)) {}
+		};
+		using ptr = std::shared_ptr<const node>;
+		static constexpr size_t max_height = 96; // n 个节点的 AVL 树的高度小于 1.45 log2(n + 2)。
+
+		ptr root;
+		size_t n_nodes{};
+		compare_t compare;
+
+		/// <summary>
+		/// 使 slot 指向的节点只被 slot 持有，返回可以修改的节点。被其他副本共享的节点先被复制。应当从根开始向下调用，这样父节点已经只被这个映射持有。
+		/// </summary>
+		static node& own(ptr& slot)
+		{
+			if (slot.use_count() != 1)
+				slot = std::make_shared<node>(*slot);
+			else
+				std::atomic_thread_fence(std::memory_order_acquire); // 其他副本释放节点前的读取先于之后的修改。
+			return const_cast<node&>(*slot); // 节点都由 make_shared<node> 创建，本身不是 const 对象。
+		}
+		[[nodiscard]] static int height_of(const ptr& p)
+		{
+			return p ? p->height : 0;
+		}
+		static void update(node& n)
+		{
+			n.height = 1 + std::max(height_of(n.left), height_of(n.right));
+		}
+		static void rotate_left(ptr& slot)
+		{
+			auto& n = own(slot);
+			ptr r = std::move(n.right);
+			auto& rn = own(r);
+			n.right = std::move(rn.left);
+			update(n);
+			rn.left = std::move(slot);
+			update(rn);
+			slot = std::move(r);
+		}
+		static void rotate_right(ptr& slot)
+		{
+			auto& n = own(slot);
+			ptr l = std::move(n.left);
+			auto& ln = own(l);
+			n.left = std::move(ln.right);
+			update(n);
+			ln.right = std::move(slot);
+			update(ln);
+			slot = std::move(l);
+		}
+		/// <summary>
+		/// 子树被修改后更新高度，必要时旋转。
+		/// </summary>
+		static void rebalance(ptr& slot)
+		{
+			auto& n = own(slot);
+			int balance = height_of(n.left) - height_of(n.right);
+			if (balance > 1)
+			{
+				if (height_of(n.left->left) < height_of(n.left->right))
+					rotate_left(n.left);
+				rotate_right(slot);
+			}
+			else if (balance < -1)
+			{
+				if (height_of(n.right->right) < height_of(n.right->left))
+					rotate_right(n.right);
+				rotate_left(slot);
+			}
+			else
+				update(n);
+		}
+
+		/// <returns>
+		/// 是否插入了新的节点。
+		/// </returns>
+		template <typename v_t>
+		bool insert(ptr& slot, const key_t& key, v_t&& v)
+		{
+			if (!slot)
+			{
+				slot = std::make_shared<node>(key, std::forward<v_t>(v));
+				return true;
+			}
+			if (compare(key, slot->value.first))
+			{
+				if (!insert(own(slot).left, key, std::forward<v_t>(v)))
+					return false;
+			}
+			else if (compare(slot->value.first, key))
+			{
+				if (!insert(own(slot).right, key, std::forward<v_t>(v)))
+					return false;
+			}
+			else
+			{
+				own(slot).value.second = std::forward<v_t>(v);
+				return false;
+			}
+			rebalance(slot);
+			return true;
+		}
+		/// <summary>
+		/// 从子树中取出最小的节点。
+		/// </summary>
+		static ptr take_min(ptr& slot)
+		{
+			if (!slot->left)
+			{
+				ptr ret = std::move(slot);
+				slot = ret->right;
+				return ret;
+			}
+			ptr ret = take_min(own(slot).left);
+			rebalance(slot);
+			return ret;
+		}
+		/// <summary>
+		/// 移除键，键应当存在于子树中。
+		/// </summary>
+		void erase(ptr& slot, const key_t& key)
+		{
+			if (compare(key, slot->value.first))
+				erase(own(slot).left, key);
+			else if (compare(slot->value.first, key))
+				erase(own(slot).right, key);
+			else if (!slot->left || !slot->right)
+			{
+				ptr child = slot->left ? slot->left : slot->right;
+				slot = std::move(child);
+				return;
+			}
+			else
+			{
+				auto& n = own(slot);
+				ptr m = take_min(n.right);
+				auto& mn = own(m);
+				mn.left = std::move(n.left);
+				mn.right = std::move(n.right);
+				slot = std::move(m);
+			}
+			rebalance(slot);
+		}
+
+	public:
+		/// <summary>
+		/// 按键的顺序遍历的迭代器。映射被修改后失效；映射的副本被修改时不失效。
+		/// </summary>
+		class const_iterator
+		{
+		private:
+			friend class persistent_map;
+
+			std::array<const node*, max_height> stack{}; // 当前节点和还没有访问的祖先，栈顶是当前节点。
+			size_t depth{};
+
+			void push_left(const node* n)
+			{
+				for (; n; n = n->left.get())
+					stack[depth++] = n;
+			}
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = persistent_map::value_type;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const value_type*;
+			using reference = const value_type&;
+
+			reference operator*() const
+			{
+				return stack[depth - 1]->value;
+			}
+			pointer operator->() const
+			{
+				return &stack[depth - 1]->value;
+			}
+			const_iterator& operator++()
+			{
+				push_left(stack[--depth]->right.get());
+				return *this;
+			}
+			const_iterator operator++(int)
+			{
+				auto ret = *this;
+				++*this;
+				return ret;
+			}
+			bool operator==(const const_iterator& rhs) const
+			{
+				return (depth ? stack[depth - 1] : nullptr) == (rhs.depth ? rhs.stack[rhs.depth - 1] : nullptr);
+			}
+			bool operator!=(const const_iterator& rhs) const
+			{
+				return !(*this == rhs);
+			}
+		};
+		using iterator = const_iterator;
+
+		persistent_map() = default;
+		explicit persistent_map(compare_t compare) : compare(std::move(compare)) {}
+
+		[[nodiscard]] size_t size() const
+		{
+			return n_nodes;
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return !n_nodes;
+		}
+		void clear()
+		{
+			root.reset();
+			n_nodes = 0;
+		}
+
+		/// <returns>
+		/// 是否与 other 共享同一个根，此时两者的内容一定相同。内容相同的映射不一定共享根。
+		/// </returns>
+		[[nodiscard]] bool shares_root(const persistent_map& other) const
+		{
+			return root == other.root;
+		}
+
+		[[nodiscard]] const_iterator begin() const
+		{
+			const_iterator ret;
+			ret.push_left(root.get());
+			return ret;
+		}
+		[[nodiscard]] const_iterator end() const
+		{
+			return {};
+		}
+		/// <returns>
+		/// 指向键的迭代器。如果不存在，返回 end()。
+		/// </returns>
+		[[nodiscard]] const_iterator find(const key_t& key) const
+		{
+			const_iterator ret;
+			for (const node* n = root.get(); n;)
+			{
+				if (compare(key, n->value.first))
+				{
+					ret.stack[ret.depth++] = n;
+					n = n->left.get();
+				}
+				else if (compare(n->value.first, key))
+					n = n->right.get();
+				else
+				{
+					ret.stack[ret.depth++] = n;
+					return ret;
+				}
+			}
+			return end();
+		}
+		[[nodiscard]] size_t count(const key_t& key) const
+		{
+			return find(key) != end();
+		}
+		/// <returns>
+		/// 键对应的值。如果不存在，抛出 std::out_of_range 异常。
+		/// </returns>
+		[[nodiscard]] const value_t& at(const key_t& key) const
+		{
+			auto it = find(key);
+			if (it == end())
+				throw std::out_of_range("persistent_map::at");
+			return it->second;
+		}
+
+		/// <summary>
+		/// 插入键，已经存在时替换值。
+		/// </summary>
+		/// <returns>是否插入了新的键。</returns>
+		template <typename v_t>
+		bool insert_or_assign(const key_t& key, v_t&& v)
+		{
+			bool ret = insert(root, key, std::forward<v_t>(v));
+			n_nodes += ret;
+			return ret;
+		}
+		/// <summary>
+		/// 原地修改键对应的值，不存在时插入默认值。从根到这个键的路径上被其他副本共享的节点先被复制。
+		/// </summary>
+		/// <returns>值的引用，在映射被修改或复制前有效。</returns>
+		value_t& edit(const key_t& key)
+		{
+			if (find(key) == end())
+				insert_or_assign(key, value_t());
+			ptr* slot = &root;
+			while (true)
+			{
+				auto& n = own(*slot);
+				if (compare(key, n.value.first))
+					slot = &n.left;
+				else if (compare(n.value.first, key))
+					slot = &n.right;
+				else
+					return n.value.second;
+			}
+		}
+		/// <summary>
+		/// 移除键。
+		/// </summary>
+		/// <returns>是否存在。</returns>
+		bool erase(const key_t& key)
+		{
+			if (find(key) == end())
+				return false;
+			erase(root, key);
+			n_nodes--;
+			return true;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,307 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "binary.hpp"
+#include "segment_file.hpp"
+#include "mapped_file.hpp"
+#include "atomic_file.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 一个库的语音库。音频片段以追加的方式打包保存在库的 pronunciations 目录下的若干段文件（0.pack、1.pack、……）中，段文件超过一定大小后换用新的段文件。
+	/// 段文件被映射到内存中，读取音频时直接返回映射中的数据，不复制，也不为每个片段打开文件。所有成员函数都是线程安全的。
+	/// </summary>
+	/// <remarks>
+	/// 段文件以 8 字节的文件头开始（"MDPR" 和 u32 版本号），之后是若干记录。每条记录依次是：发音 id（u64）、数据长度（u32）、校验和（u64，以发音 id 为种子的音频数据的 xxh64）、音频数据。整数均为小端序。
+	/// 同一发音 id 的记录出现多次时，以最后一条为准。打开时校验每条记录并建立偏移索引，校验和不符的记录（如断电后末尾未写入的零）及之后的部分被截去。
+	/// 版本 1 的段文件的记录没有校验和，打开时被原子地改写为当前版本。
+	/// </remarks>
+	class pronunciation_store final
+	{
+	private:
+		static constexpr segment_format format{ "MDPR", 2 };
+		static constexpr segment_format format_v1{ "MDPR", 1 };
+		static constexpr size_t file_header_size = segment_format::header_size;
+		static constexpr size_t record_header_size = 8 + 4 + 8;
+		static constexpr size_t record_header_size_v1 = 8 + 4;
+
+	public:
+		uint64_t max_segment_size{ 256ull << 20 }; // 段文件的最大字节数。
+
+		/// <summary>
+		/// 一个音频片段。data 指向映射的段文件，持有 clip 时映射保持有效。
+		/// </summary>
+		struct clip
+		{
+			std::shared_ptr<const mapped_file> file;
+			std::string_view data;
+		};
+
+	private:
+		struct location
+		{
+			uint32_t segment{};
+			uint64_t offset{}; // 数据在段文件中的位置。
+			uint32_t length{};
+		};
+
+		mutable std::mutex mutex;
+		std::filesystem::path dir;
+		std::unordered_map<id_t, location> index;
+		id_t next_id{};
+
+		std::ofstream writer;
+		uint32_t writer_segment{};
+		uint64_t writer_size{};
+		std::vector<std::shared_ptr<const mapped_file>> maps; // 按段编号。追加后最后一个段的映射可能过期，读取时重新映射。
+
+		std::filesystem::path segment_path(uint32_t segment) const
+		{
+			return dir / (std::to_string(segment) + ".pack");
+		}
+
+		static std::string record_header(id_t id, std::string_view data)
+		{
+			std::string ret;
+			binary::put<uint64_t>(ret, id);
+			binary::put<uint32_t>(ret, static_cast<uint32_t>(data.size()));
+			binary::put<uint64_t>(ret, binary::xxh64(data, id));
+			return ret;
+		}
+		/// <summary>
+		/// 把版本 1 的段文件原子地改写为当前版本，为每条记录加上校验和。末尾不完整的记录被丢弃。如果失败，抛出 std::runtime_error 异常，文件不变。
+		/// </summary>
+		void upgrade_segment(uint32_t segment)
+		{
+			std::string out = format.header();
+			{
+				mapped_file file(segment_path(segment));
+				auto buf = file.view();
+				uint64_t pos = file_header_size;
+				while (pos + record_header_size_v1 <= buf.size())
+				{
+					const char* p = buf.data() + pos;
+					id_t id = binary::get<uint64_t>(p);
+					uint32_t length = binary::get<uint32_t>(p + 8);
+					if (pos + record_header_size_v1 + length > buf.size())
+						break;
+					auto data = buf.substr(static_cast<size_t>(pos + record_header_size_v1), length);
+					out += record_header(id, data);
+					out.append(data);
+					pos += record_header_size_v1 + length;
+				}
+			} // 映射存在时无法替换文件。
+			atomic_file::write(segment_path(segment), out);
+		}
+		/// <summary>
+		/// 读取一个段文件中的所有记录，校验音频数据。遇到不完整或校验和不符的记录时停止。
+		/// </summary>
+		/// <returns>有效部分的长度。文件头不完整（创建段文件时中断）时返回 0；文件头无法识别（损坏或由更新的版本写入）时返回 std::nullopt。</returns>
+		std::optional<uint64_t> scan_segment(uint32_t segment, const mapped_file& file)
+		{
+			auto buf = file.view();
+			auto state = format.check(buf);
+			if (state == segment_format::header_state::invalid)
+				return std::nullopt;
+			if (state == segment_format::header_state::incomplete)
+				return 0;
+
+			uint64_t pos = file_header_size;
+			while (pos + record_header_size <= buf.size())
+			{
+				const char* p = buf.data() + pos;
+				id_t id = binary::get<uint64_t>(p);
+				uint32_t length = binary::get<uint32_t>(p + 8);
+				uint64_t checksum = binary::get<uint64_t>(p + 12);
+				if (pos + record_header_size + length > buf.size())
+					break;
+				if (binary::xxh64(buf.substr(static_cast<size_t>(pos + record_header_size), length), id) != checksum)
+					break;
+				record(id, { segment, pos + record_header_size, length });
+				pos += record_header_size + length;
+			}
+			return pos;
+		}
+		void record(id_t id, const location& loc)
+		{
+			index[id] = loc;
+			next_id = std::max(next_id, id + 1);
+		}
+		void open_writer(uint32_t segment, uint64_t size)
+		{
+			writer_segment = segment;
+			writer_size = format.open_writer(writer, segment_path(segment), size);
+			writer.flush();
+			if (maps.size() <= segment)
+				maps.resize(segment + 1);
+		}
+		void append(id_t id, std::string_view data)
+		{
+			if (data.size() > std::numeric_limits<uint32_t>::max())
+				throw std::runtime_error("pronunciation clip is too large.");
+			if (writer_size + record_header_size + data.size() > max_segment_size && writer_size > file_header_size)
+				open_writer(writer_segment + 1, 0);
+
+			auto header = record_header(id, data);
+			writer.write(header.data(), header.size());
+			writer.write(data.data(), data.size());
+			writer.flush(); // 之后可能立即通过映射读取。
+			if (!writer)
+				throw std::runtime_error("fail to write pronunciation segment.");
+
+			record(id, { writer_segment, writer_size + record_header_size, static_cast<uint32_t>(data.size()) });
+			writer_size += record_header_size + data.size();
+		}
+		std::optional<clip> get_locked(id_t id)
+		{
+			auto it = index.find(id);
+			if (it == index.end())
+				return std::nullopt;
+			const auto& loc = it->second;
+			auto& map = maps[loc.segment];
+			if (!map || map->size() < loc.offset + loc.length) // 映射之后追加的记录。
+				map = std::make_shared<const mapped_file>(segment_path(loc.segment));
+			if (map->size() < loc.offset + loc.length)
+				return std::nullopt;
+			return clip{ map, map->view().substr(static_cast<size_t>(loc.offset), loc.length) };
+		}
+		void close_locked()
+		{
+			if (writer.is_open())
+				writer.close();
+			maps.clear();
+			index.clear();
+			next_id = 0;
+			writer_segment = 0;
+			writer_size = 0;
+		}
+
+	public:
+		pronunciation_store() = default;
+		pronunciation_store(const pronunciation_store&) = delete;
+		pronunciation_store& operator=(const pronunciation_store&) = delete;
+
+		/// <summary>
+		/// 打开指定目录下的语音库，目录需要已经存在。之前打开的语音库会被关闭，已经取得的 clip 仍然有效。末尾不完整或校验和不符的记录（例如写入时程序崩溃或断电）会被截去，版本 1 的段文件被改写为当前版本。
+		/// </summary>
+		/// <param name="path">语音目录。</param>
+		/// <returns>成功返回 true，否则返回 false。段文件的文件头无法识别（损坏或由更新的版本写入）时失败，文件不会被修改。</returns>
+		bool open(std::filesystem::path path)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			close_locked();
+			path.make_preferred();
+			dir = path;
+			if (!std::filesystem::is_directory(dir))
+				return false;
+
+			try
+			{
+				// 依次扫描所有段文件，截去每个段末尾不完整的记录，之后向最后一个段追加。无法识别的段文件不被修改，打开失败。
+				uint32_t segment = 0;
+				uint64_t size = 0;
+				for (uint32_t i = 0; std::filesystem::exists(segment_path(i)); i++)
+				{
+					segment = i;
+					auto map = std::make_shared<const mapped_file>(segment_path(i));
+					if (format_v1.check(map->view()) == segment_format::header_state::valid)
+					{
+						map.reset();
+						upgrade_segment(i);
+						map = std::make_shared<const mapped_file>(segment_path(i));
+					}
+					auto valid = scan_segment(i, *map);
+					if (!valid)
+					{
+						close_locked();
+						return false;
+					}
+					size = *valid;
+					if (size < map->size())
+					{
+						map.reset(); // 映射存在时无法截短文件。
+						std::filesystem::resize_file(segment_path(i), size);
+					}
+					if (maps.size() <= i)
+						maps.resize(i + 1);
+					maps[i] = std::move(map);
+				}
+				open_writer(segment, size < file_header_size ? 0 : size);
+			}
+			catch (const std::exception&)
+			{
+				close_locked();
+				return false;
+			}
+			return true;
+		}
+		/// <summary>
+		/// 关闭语音库。已经取得的 clip 仍然有效。
+		/// </summary>
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			close_locked();
+		}
+
+		/// <returns>
+		/// 音频片段的数量。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return index.size();
+		}
+		[[nodiscard]] bool contains(id_t id) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return index.count(id);
+		}
+		/// <summary>
+		/// 添加一个音频片段。
+		/// </summary>
+		/// <param name="data">音频数据，格式由调用者决定。</param>
+		/// <returns>发音 id。</returns>
+		id_t add(std::string_view data)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!writer.is_open())
+				throw std::runtime_error("call open() before add.");
+			id_t id = next_id;
+			append(id, data);
+			return id;
+		}
+		/// <summary>
+		/// 添加或替换指定 id 的音频片段。旧的数据仍然留在段文件中。
+		/// </summary>
+		void set(id_t id, std::string_view data)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!writer.is_open())
+				throw std::runtime_error("call open() before set.");
+			append(id, data);
+		}
+		/// <returns>
+		/// 音频片段。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<clip> get(id_t id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return get_locked(id);
+		}
+		/// <returns>
+		/// 若干音频片段，跳过不存在的片段。
+		/// </returns>
+		[[nodiscard]] std::vector<clip> get(const std::vector<id_t>& ids)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<clip> ret;
+			ret.reserve(ids.size());
+			for (id_t id : ids)
+				if (auto c = get_locked(id))
+					ret.push_back(std::move(*c));
+			return ret;
+		}
+	};
+}
\ No newline at end of file
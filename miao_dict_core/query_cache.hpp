@@ -0,0 +1,353 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "text.hpp"
+#include "item.hpp"
+#include "library.hpp"
+#include "persistent_map.hpp"
+#include "resident_scheduler.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 查询的规范化和词形索引。索引是持久化的映射，复制是 O(1) 的，副本的修改只复制改变的部分。
+	/// </summary>
+	class headword_index final
+	{
+	public:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+	private:
+		persistent_map<std::u32string, std::vector<key_t>> index; // 规范化的词到 item 的映射。
+
+		/// <summary>
+		/// 对 item 的一般式、变体和注音的规范形式各调用一次 callback，相同的形式只调用一次。
+		/// </summary>
+		template <typename callback_t>
+		static void for_each_form(const item& it, callback_t&& callback)
+		{
+			std::vector<std::u32string> forms;
+			auto add = [&forms](std::u32string_view word)
+			{
+				auto n = normalize(word);
+				if (!n.empty() && std::find(forms.begin(), forms.end(), n) == forms.end())
+					forms.push_back(std::move(n));
+			};
+			add(it.origin);
+			for (const auto& t : it.variants)
+				add(t);
+			for (const auto& t : it.notations)
+				add(t);
+			for (const auto& f : forms)
+				callback(f);
+		}
+
+	public:
+		/// <summary>
+		/// 规范化查询：经过 text::fold，去掉首尾的空白，连续的空白合并为一个空格。
+		/// </summary>
+		[[nodiscard]] static std::u32string normalize(std::u32string_view query)
+		{
+			std::u32string ret;
+			ret.reserve(query.size());
+			bool space = false;
+			for (char32_t ch : query)
+			{
+				if (text::is_space(ch))
+				{
+					space = !ret.empty();
+					continue;
+				}
+				if (space)
+					ret.push_back(U' ');
+				space = false;
+				ret.push_back(text::fold(ch));
+			}
+			return ret;
+		}
+		/// <returns>
+		/// item 的所有规范形式。
+		/// </returns>
+		[[nodiscard]] static std::vector<std::u32string> forms_of(const item& it)
+		{
+			std::vector<std::u32string> ret;
+			for_each_form(it, [&ret](const std::u32string& f) { ret.push_back(f); });
+			return ret;
+		}
+
+		void clear()
+		{
+			index.clear();
+		}
+		void add(id_t lib_id, const item& it)
+		{
+			for_each_form(it, [&](const std::u32string& f) { index.edit(f).emplace_back(lib_id, it.id); });
+		}
+		void add_library(const library& lib)
+		{
+			for (const auto& [id, it] : lib.items)
+				add(lib.id, it);
+		}
+		void remove(id_t lib_id, const item& it)
+		{
+			for_each_form(it, [&](const std::u32string& f)
+				{
+					if (!index.count(f))
+						return;
+					auto& v = index.edit(f);
+					v.erase(std::remove(v.begin(), v.end(), key_t{ lib_id, it.id }), v.end());
+					if (v.empty())
+						index.erase(f);
+				});
+		}
+		/// <returns>
+		/// 规范形式为 word 的所有 item。
+		/// </returns>
+		[[nodiscard]] const std::vector<key_t>& find(const std::u32string& word) const
+		{
+			static const std::vector<key_t> empty;
+			auto p = index.find(word);
+			return p == index.end() ? empty : p->second;
+		}
+	};
+
+	/// <summary>
+	/// 查询结果的缓存，键为规范化的查询和库的选择。每个查询有一个代数，查询涉及的 item 改变时代数增加，只有这个查询的结果被作废。计算结果前记下代数，写入时代数已经改变则不写入，因此不会缓存过期的结果。
+	/// 重复的查询只需要一次哈希查找。所有成员函数都是线程安全的。
+	/// </summary>
+	class query_cache final
+	{
+	public:
+		/// <summary>
+		/// 一个查询结果。
+		/// </summary>
+		struct hit
+		{
+			id_t lib_id{};
+			item it; // 翻译中为空的含义已经由翻译指向的 item 的一般式补全。
+		};
+		using result_t = std::shared_ptr<const std::vector<hit>>;
+
+		/// <summary>
+		/// 缓存的统计信息。
+		/// </summary>
+		struct stats
+		{
+			uint64_t hits{};
+			uint64_t misses{};
+			uint64_t invalidations{}; // 被作废的结果。
+			size_t entries{};
+		};
+
+		size_t capacity{ 4096 }; // 缓存的查询（规范化的查询）个数。
+
+	private:
+		using key_t = headword_index::key_t;
+
+		struct entry
+		{
+			std::vector<id_t> selection; // 升序，空表示所有库。
+			result_t result;
+			std::vector<key_t> dependencies; // 结果涉及的 item。
+		};
+		struct slot
+		{
+			uint64_t generation{};
+			uint64_t last_used{};
+			std::vector<entry> entries; // 同一查询的不同选择，通常只有一个。
+		};
+
+		mutable std::mutex mutex;
+		std::unordered_map<std::u32string, slot> slots;
+		std::unordered_map<key_t, std::vector<std::u32string>, item_key_hash> dependents; // item 到涉及它的查询的映射。
+		uint64_t next_generation{ 1 };
+		uint64_t tick{};
+		stats counters;
+
+		void drop_dependencies(const std::u32string& query, const entry& e)
+		{
+			for (const auto& d : e.dependencies)
+			{
+				auto p = dependents.find(d);
+				if (p == dependents.end())
+					continue;
+				auto& v = p->second;
+				v.erase(std::remove(v.begin(), v.end(), query), v.end());
+				if (v.empty())
+					dependents.erase(p);
+			}
+		}
+		void invalidate_locked(const std::u32string& query)
+		{
+			auto p = slots.find(query);
+			if (p == slots.end())
+				return;
+			for (const auto& e : p->second.entries)
+				drop_dependencies(query, e);
+			counters.invalidations += p->second.entries.size();
+			p->second.entries.clear();
+			p->second.generation = next_generation++;
+		}
+		/// <summary>
+		/// 查询个数超过容量时，移除最久没有使用的一半。
+		/// </summary>
+		void shrink()
+		{
+			if (slots.size() <= capacity)
+				return;
+			std::vector<std::pair<uint64_t, const std::u32string*>> order;
+			order.reserve(slots.size());
+			for (const auto& [q, s] : slots)
+				order.emplace_back(s.last_used, &q);
+			auto mid = order.begin() + order.size() / 2;
+			std::nth_element(order.begin(), mid, order.end());
+			std::vector<std::u32string> victims;
+			for (auto p = order.begin(); p != mid; ++p)
+				victims.push_back(*p->second);
+			for (const auto& q : victims)
+			{
+				auto p = slots.find(q);
+				for (const auto& e : p->second.entries)
+					drop_dependencies(q, e);
+				slots.erase(p);
+			}
+		}
+
+	public:
+		/// <summary>
+		/// 规范化库的选择：升序并去重。空表示所有库。
+		/// </summary>
+		[[nodiscard]] static std::vector<id_t> normalize_selection(std::vector<id_t> selection)
+		{
+			std::sort(selection.begin(), selection.end());
+			selection.erase(std::unique(selection.begin(), selection.end()), selection.end());
+			return selection;
+		}
+
+		/// <summary>
+		/// 查找缓存的结果。
+		/// </summary>
+		/// <param name="query">规范化的查询。</param>
+		/// <param name="selection">规范化的库的选择。</param>
+		/// <returns>结果。如果没有缓存，返回 std::nullopt。</returns>
+		[[nodiscard]] std::optional<result_t> find(const std::u32string& query, const std::vector<id_t>& selection)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto p = slots.find(query);
+			if (p != slots.end())
+				for (const auto& e : p->second.entries)
+					if (e.selection == selection)
+					{
+						p->second.last_used = ++tick;
+						counters.hits++;
+						return e.result;
+					}
+			counters.misses++;
+			return std::nullopt;
+		}
+		/// <summary>
+		/// 在计算结果前调用，取得查询当前的代数。
+		/// </summary>
+		[[nodiscard]] uint64_t generation_of(const std::u32string& query)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& s = slots[query];
+			if (!s.generation)
+				s.generation = next_generation++;
+			s.last_used = ++tick;
+			return s.generation;
+		}
+		/// <summary>
+		/// 写入计算的结果。如果计算期间查询被作废（代数改变）或被移出缓存，则不写入。
+		/// </summary>
+		/// <param name="query">规范化的查询。</param>
+		/// <param name="selection">规范化的库的选择。</param>
+		/// <param name="generation">计算前由 generation_of 取得的代数。</param>
+		/// <param name="result">结果。</param>
+		/// <param name="dependencies">结果涉及的 item，它们改变时结果被作废。</param>
+		void store(const std::u32string& query, const std::vector<id_t>& selection, uint64_t generation,
+			result_t result, std::vector<key_t> dependencies)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto p = slots.find(query);
+			if (p == slots.end() || p->second.generation != generation)
+				return;
+			for (const auto& e : p->second.entries)
+				if (e.selection == selection)
+					return;
+			std::sort(dependencies.begin(), dependencies.end());
+			dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+			for (const auto& d : dependencies)
+				dependents[d].push_back(query);
+			p->second.entries.push_back({ selection, std::move(result), std::move(dependencies) });
+			shrink();
+		}
+
+		/// <summary>
+		/// 作废指定查询的结果。
+		/// </summary>
+		void invalidate(const std::u32string& query)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			invalidate_locked(query);
+		}
+		/// <summary>
+		/// item 被修改后调用。作废结果涉及这个 item 的查询（包括修改前的形式对应的查询），以及修改后的规范形式对应的查询。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="item_id">item id。</param>
+		/// <param name="forms">item 修改后的规范形式。</param>
+		void invalidate_item(id_t lib_id, id_t item_id, const std::vector<std::u32string>& forms)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (auto p = dependents.find({ lib_id, item_id }); p != dependents.end())
+			{
+				auto queries = p->second; // invalidate_locked 会修改 dependents。
+				for (const auto& q : queries)
+					invalidate_locked(q);
+			}
+			for (const auto& f : forms)
+				invalidate_locked(f);
+		}
+		/// <summary>
+		/// 库被创建后调用。作废选择了所有库或选择了这个库的结果。
+		/// </summary>
+		void invalidate_library(id_t lib_id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto& [q, s] : slots)
+			{
+				auto affected = std::stable_partition(s.entries.begin(), s.entries.end(), [lib_id](const entry& e)
+					{
+						return !e.selection.empty() && !std::binary_search(e.selection.begin(), e.selection.end(), lib_id);
+					});
+				if (affected == s.entries.end())
+					continue;
+				for (auto p = affected; p != s.entries.end(); ++p)
+					drop_dependencies(q, *p);
+				counters.invalidations += s.entries.end() - affected;
+				s.entries.erase(affected, s.entries.end());
+				s.generation = next_generation++;
+			}
+		}
+		/// <summary>
+		/// 移除所有结果。代数继续增加，正在计算的结果不会被写入。
+		/// </summary>
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots.clear();
+			dependents.clear();
+		}
+
+		[[nodiscard]] stats statistics() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stats ret = counters;
+			ret.entries = 0;
+			for (const auto& [q, s] : slots)
+				ret.entries += s.entries.size();
+			return ret;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// xoshiro256** 伪随机数生成器。标准库的分布在不同的实现中结果不同，这里的取值方法都是自己实现的，同一个种子在所有平台上给出相同的序列。
+	/// </summary>
+	class random_engine final
+	{
+	private:
+		std::array<uint64_t, 4> s{};
+
+		[[nodiscard]] static constexpr uint64_t rotl(uint64_t x, int k)
+		{
+			return (x << k) | (x >> (64 - k));
+		}
+
+	public:
+		using result_type = uint64_t;
+
+		explicit random_engine(uint64_t seed = 0)
+		{
+			this->seed(seed);
+		}
+		/// <summary>
+		/// 重新设置种子。用 splitmix64 把种子扩展为内部状态。
+		/// </summary>
+		void seed(uint64_t seed)
+		{
+			for (auto& x : s)
+			{
+				uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				x = z ^ (z >> 31);
+			}
+		}
+
+		[[nodiscard]] static constexpr uint64_t min()
+		{
+			return 0;
+		}
+		[[nodiscard]] static constexpr uint64_t max()
+		{
+			return std::numeric_limits<uint64_t>::max();
+		}
+		uint64_t operator()()
+		{
+			uint64_t ret = rotl(s[1] * 5, 7) * 9;
+			uint64_t t = s[1] << 17;
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+			return ret;
+		}
+
+		/// <returns>
+		/// [0, 1) 上均匀分布的实数。
+		/// </returns>
+		double uniform()
+		{
+			return static_cast<double>((*this)() >> 11) * 0x1.0p-53;
+		}
+		/// <returns>
+		/// [0, n) 上均匀分布的整数。要求 n 大于 0。
+		/// </returns>
+		uint64_t below(uint64_t n)
+		{
+			// 拒绝采样，避免取模带来的偏差。
+			uint64_t limit = max() - max() % n;
+			uint64_t x;
+			do
+				x = (*this)();
+			while (x >= limit);
+			return x % n;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,312 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "item.hpp"
+#include "text.hpp"
+#include "bloom_filter.hpp"
+#include "persistent_map.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 以一般式为键的 raw_item 集合。合并新的出现次数时原地更新，并增量维护按出现次数降序、次数相同时按字典序的排名，取前 k 个不需要排序。
+	/// 同时维护库中已有 item 的词（一般式和变体，经过 text::fold）的集合，这些词不会成为 raw_item。判断时先查布隆过滤器，只有可能存在时才查精确的集合。
+	/// 复制时次数和排名在副本之间共享，第一次修改时才复制（写时复制），不需要重新排序；词的集合是持久化的映射，复制是 O(1) 的。
+	/// </summary>
+	class raw_item_index final
+	{
+	private:
+		using rank_t = std::pair<uint_t, const std::u32string*>; // (出现次数, 一般式)，一般式指向 frequency 中的键。
+		struct by_rank
+		{
+			bool operator()(const rank_t& a, const rank_t& b) const
+			{
+				if (a.first != b.first)
+					return a.first > b.first;
+				return *a.second < *b.second;
+			}
+		};
+
+		/// <summary>
+		/// 出现次数和排名。
+		/// </summary>
+		struct counts_t
+		{
+			std::unordered_map<std::u32string, uint_t> frequency; // 一般式到出现次数的映射。
+			std::set<rank_t, by_rank> ranking;
+
+			counts_t() = default;
+			counts_t(const counts_t&) = delete; // ranking 指向 frequency 中的键，应当使用 clone。
+			counts_t& operator=(const counts_t&) = delete;
+
+			/// <summary>
+			/// 复制。按原有的顺序插入排名，不需要重新排序。
+			/// </summary>
+			[[nodiscard]] std::shared_ptr<counts_t> clone() const
+			{
+				auto ret = std::make_shared<counts_t>();
+				ret->frequency = frequency;
+				for (const auto& [n, origin] : ranking)
+					ret->ranking.emplace_hint(ret->ranking.end(), n, &ret->frequency.find(*origin)->first);
+				return ret;
+			}
+		};
+		std::shared_ptr<counts_t> counts{ std::make_shared<counts_t>() }; // 在副本之间共享，修改前由 edit_counts 复制。
+
+		bloom_filter headword_filter;
+		persistent_map<std::u32string, bool> headword_set; // 只使用键。
+
+		[[nodiscard]] static std::u32string fold(std::u32string_view word)
+		{
+			std::u32string ret(word);
+			for (auto& ch : ret)
+				ch = text::fold(ch);
+			return ret;
+		}
+		/// <summary>
+		/// 词经过 text::fold 后的哈希值。逐字符处理，不需要构造新的字符串。
+		/// </summary>
+		[[nodiscard]] static uint64_t hash(std::u32string_view word)
+		{
+			uint64_t h = 0xCBF29CE484222325ull;
+			for (char32_t ch : word)
+			{
+				h ^= text::fold(ch);
+				h *= 0x100000001B3ull;
+			}
+			return h ^ (h >> 29);
+		}
+
+		/// <returns>
+		/// 只被这个对象持有的次数和排名，可以修改。与其他副本共享时先复制。
+		/// </returns>
+		counts_t& edit_counts()
+		{
+			if (counts.use_count() != 1)
+				counts = counts->clone();
+			else
+				std::atomic_thread_fence(std::memory_order_acquire); // 其他副本释放前的读取先于之后的修改。
+			return *counts;
+		}
+		/// <summary>
+		/// 由 frequency 重新构造排名。
+		/// </summary>
+		static void rebuild_ranking(counts_t& c)
+		{
+			std::vector<rank_t> ranks;
+			ranks.reserve(c.frequency.size());
+			for (const auto& [origin, n] : c.frequency)
+				ranks.emplace_back(n, &origin);
+			std::sort(ranks.begin(), ranks.end(), by_rank());
+			c.ranking.clear();
+			for (const auto& r : ranks)
+				c.ranking.emplace_hint(c.ranking.end(), r);
+		}
+
+	public:
+
+		/// <returns>
+		/// raw_item 的个数。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			return counts->frequency.size();
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return counts->frequency.empty();
+		}
+		/// <summary>
+		/// 移除所有 raw_item。不影响已有 item 的词的集合。
+		/// </summary>
+		void clear()
+		{
+			counts = std::make_shared<counts_t>();
+		}
+
+		/// <returns>
+		/// 一般式的出现次数。如果不存在，返回 0。
+		/// </returns>
+		[[nodiscard]] uint_t frequency_of(const std::u32string& origin) const
+		{
+			auto it = counts->frequency.find(origin);
+			return it == counts->frequency.end() ? 0 : it->second;
+		}
+		/// <summary>
+		/// 设置一般式的出现次数。次数为 0 时移除。
+		/// </summary>
+		void set(const std::u32string& origin, uint_t n)
+		{
+			if (frequency_of(origin) == n)
+				return;
+			auto& c = edit_counts();
+			auto it = c.frequency.find(origin);
+			if (it != c.frequency.end())
+			{
+				c.ranking.erase({ it->second, &it->first });
+				if (!n)
+				{
+					c.frequency.erase(it);
+					return;
+				}
+				it->second = n;
+			}
+			else
+				it = c.frequency.emplace(origin, n).first;
+			c.ranking.emplace(n, &it->first);
+		}
+		/// <summary>
+		/// 移除一般式。
+		/// </summary>
+		/// <returns>是否存在。</returns>
+		bool erase(const std::u32string& origin)
+		{
+			if (!counts->frequency.count(origin))
+				return false;
+			auto& c = edit_counts();
+			auto it = c.frequency.find(origin);
+			c.ranking.erase({ it->second, &it->first });
+			c.frequency.erase(it);
+			return true;
+		}
+
+		/// <summary>
+		/// 合并新的出现次数，已有的 raw_item 累加次数，已经是 item 的词会被跳过。
+		/// </summary>
+		/// <param name="raw_items">新的 raw_item，可以无序。</param>
+		void merge(const std::vector<raw_item>& raw_items)
+		{
+			if (raw_items.size() * 4 < size())
+			{
+				// 少量更新时逐个调整排名。
+				for (const auto& ri : raw_items)
+					if (ri.frequency && !is_headword(ri.origin))
+						set(ri.origin, frequency_of(ri.origin) + ri.frequency);
+				return;
+			}
+			// 大量更新时先累加次数，再整体重建排名。
+			auto& c = edit_counts();
+			c.frequency.reserve(c.frequency.size() + raw_items.size());
+			for (const auto& ri : raw_items)
+				if (ri.frequency && !is_headword(ri.origin))
+					c.frequency[ri.origin] += ri.frequency;
+			rebuild_ranking(c);
+		}
+		/// <summary>
+		/// 用给定的 raw_item 替换所有 raw_item，已经是 item 的词会被跳过。一般式重复时累加次数。
+		/// </summary>
+		void assign(const std::vector<raw_item>& raw_items)
+		{
+			clear();
+			merge(raw_items);
+		}
+
+		/// <summary>
+		/// 按排名遍历 raw_item，对每个调用 callback(origin, frequency)。回调返回 false 时停止。
+		/// </summary>
+		/// <param name="callback">形如 bool(const std::u32string&amp;, uint_t) 的回调。</param>
+		template <typename callback_t>
+		void for_each(callback_t&& callback) const
+		{
+			for (const auto& [n, origin] : counts->ranking)
+				if (!callback(*origin, n))
+					return;
+		}
+		/// <returns>
+		/// 按出现次数降序、次数相同时按字典序的前 k 个 raw_item。
+		/// </returns>
+		[[nodiscard]] std::vector<raw_item> top(size_t k) const
+		{
+			const auto& ranking = counts->ranking;
+			std::vector<raw_item> ret;
+			ret.reserve(std::min(k, ranking.size()));
+			for (auto it = ranking.begin(); it != ranking.end() && ret.size() < k; ++it)
+			{
+				raw_item ri;
+				ri.origin = *it->second;
+				ri.frequency = it->first;
+				ret.push_back(std::move(ri));
+			}
+			return ret;
+		}
+		/// <returns>
+		/// 按排名排列的所有 raw_item。
+		/// </returns>
+		[[nodiscard]] std::vector<raw_item> to_vector() const
+		{
+			return top(size());
+		}
+
+	public:
+		/// <summary>
+		/// 重新设置已有 item 的词的集合，并移除已经是 item 的 raw_item。
+		/// </summary>
+		/// <param name="items">库中所有 item。</param>
+		void set_headwords(const persistent_map<id_t, item>& items)
+		{
+			size_t n{};
+			for (const auto& [id, it] : items)
+				n += 1 + it.variants.size();
+			headword_set.clear();
+			headword_filter.reset(n * 2); // 为之后添加的词预留空间。
+			for (const auto& [id, it] : items)
+				add_headwords(it);
+		}
+		/// <summary>
+		/// 添加 item 的一般式和变体，并移除对应的 raw_item。
+		/// </summary>
+		/// <returns>是否移除了 raw_item。</returns>
+		bool add_headwords(const item& it)
+		{
+			bool removed{};
+			auto add = [this, &removed](std::u32string_view word)
+			{
+				auto folded = fold(word);
+				// raw_item_extractor 给出的一般式已经经过 fold，旧文件中的一般式可能没有。
+				removed |= erase(folded);
+				removed |= erase(std::u32string(word));
+				if (headword_set.count(folded))
+					return;
+				headword_set.insert_or_assign(folded, true);
+				if (headword_set.size() > headword_filter.bit_count() / 10) // 误报率明显升高，扩容后重新插入。
+				{
+					headword_filter.reset(headword_set.size() * 2);
+					for (const auto& [w, present] : headword_set)
+						headword_filter.insert(hash(w));
+				}
+				else
+					headword_filter.insert(hash(folded));
+			};
+			add(it.origin);
+			for (const auto& v : it.variants)
+				add(v);
+			return removed;
+		}
+		/// <returns>
+		/// add_headwords(it) 是否不会有任何改变：item 的一般式和变体都已经在集合中，且都不是 raw_item。
+		/// </returns>
+		[[nodiscard]] bool covers(const item& it) const
+		{
+			auto covered = [this](std::u32string_view word)
+			{
+				auto folded = fold(word);
+				return headword_set.count(folded) && !counts->frequency.count(folded) && !counts->frequency.count(std::u32string(word));
+			};
+			if (!covered(it.origin))
+				return false;
+			for (const auto& v : it.variants)
+				if (!covered(v))
+					return false;
+			return true;
+		}
+		/// <returns>
+		/// 词是否是已有 item 的一般式或变体，忽略全角半角和大小写。
+		/// </returns>
+		[[nodiscard]] bool is_headword(std::u32string_view word) const
+		{
+			if (!headword_filter.possibly_contains(hash(word)))
+				return false;
+			return headword_set.count(fold(word));
+		}
+	};
+}
\ No newline at end of file
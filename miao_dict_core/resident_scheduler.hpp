@@ -0,0 +1,240 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "library.hpp"
+#include "indexed_heap.hpp"
+#include "weighted_sampler.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// (lib_id, item_id) 的哈希。
+	/// </summary>
+	struct item_key_hash
+	{
+		[[nodiscard]] size_t operator()(const std::pair<id_t, id_t>& key) const
+		{
+			uint64_t h = key.first * 0x9E3779B97F4A7C15ull ^ key.second;
+			h ^= h >> 31;
+			h *= 0xBF58476D1CE4E5B9ull;
+			return static_cast<size_t>(h ^ (h >> 32));
+		}
+	};
+
+	/// <summary>
+	/// 常驻显示的调度器。对选中的若干库中的所有 item，按显示时间（showing_time）和手动跳过次数（n_skips）维护优先队列：显示时间越短、跳过次数越多越优先。
+	/// 选出下一个词是 O(1)，显示或跳过后更新计数是 O(log n)，增删一个库只影响这个库中的 item。调度器保存计数的副本，不保存 item 的字符串，调用者负责把计数写回 item。不是线程安全的。
+	/// 严格按优先级显示容易重复，也可以用 draw 按同样的优先级加权随机抽取，权重为 1 / (1 + 分数 / 一分钟)。
+	/// </summary>
+	class resident_scheduler final
+	{
+	public:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+		/// <summary>
+		/// 常驻显示相关的计数。
+		/// </summary>
+		struct counters
+		{
+			uint_t showing_time{}; // 毫秒。
+			uint_t n_skips{};
+		};
+
+	private:
+		struct by_priority
+		{
+			bool operator()(const std::pair<double, key_t>& a, const std::pair<double, key_t>& b) const
+			{
+				if (a.first != b.first)
+					return a.first < b.first;
+				return a.second < b.second;
+			}
+		};
+
+		double skip_weight;
+		std::map<id_t, std::unordered_map<id_t, counters>> selected; // 选中的库中每个 item 的计数。
+		indexed_heap<key_t, double, by_priority, item_key_hash> queue;
+		weighted_sampler<key_t, item_key_hash> sampler;
+		random_engine rng;
+
+		/// <returns>
+		/// 排序用的分数，越小越优先。每次跳过相当于把显示时间缩短为原来的 1 / (1 + skip_weight)。
+		/// </returns>
+		[[nodiscard]] double score(const counters& c) const
+		{
+			return static_cast<double>(c.showing_time) / (1.0 + skip_weight * static_cast<double>(c.n_skips));
+		}
+		/// <summary>
+		/// 更新 item 在优先队列和随机抽取中的位置。
+		/// </summary>
+		void place(const key_t& key, const counters& c)
+		{
+			double s = score(c);
+			queue.set(key, s);
+			sampler.set(key, 1.0 / (1.0 + s / 60000.0));
+		}
+
+	public:
+		/// <param name="skip_weight">跳过次数的权重。为 0 时只按显示时间排序。</param>
+		/// <param name="seed">draw 使用的随机数种子。</param>
+		explicit resident_scheduler(double skip_weight = 1.0, uint64_t seed = 0)
+			: skip_weight(std::max(skip_weight, 0.0)), rng(seed) {}
+
+		/// <summary>
+		/// 重新设置 draw 使用的随机数种子。相同的种子和相同的操作序列总是抽到相同的词。
+		/// </summary>
+		void seed(uint64_t seed)
+		{
+			rng.seed(seed);
+		}
+
+		/// <summary>
+		/// 选中一个库，加入其中所有的 item。如果库已经被选中，则用库中的计数替换调度器中的计数。
+		/// </summary>
+		void add_library(const library& lib)
+		{
+			remove_library(lib.id);
+			auto& items = selected[lib.id];
+			items.reserve(lib.items.size());
+			queue.reserve(queue.size() + lib.items.size());
+			sampler.reserve(sampler.size() + lib.items.size());
+			for (const auto& [id, it] : lib.items)
+			{
+				counters c{ it.showing_time, it.n_skips };
+				items.emplace(id, c);
+				place({ lib.id, id }, c);
+			}
+		}
+		/// <summary>
+		/// 取消选中一个库，移除其中所有的 item。
+		/// </summary>
+		/// <returns>库是否被选中。</returns>
+		bool remove_library(id_t lib_id)
+		{
+			auto it = selected.find(lib_id);
+			if (it == selected.end())
+				return false;
+			for (const auto& [id, c] : it->second)
+			{
+				queue.erase({ lib_id, id });
+				sampler.erase({ lib_id, id });
+			}
+			selected.erase(it);
+			return true;
+		}
+		/// <returns>
+		/// 库是否被选中。
+		/// </returns>
+		[[nodiscard]] bool contains_library(id_t lib_id) const
+		{
+			return selected.count(lib_id);
+		}
+		/// <returns>
+		/// 所有选中的库的 id，升序。
+		/// </returns>
+		[[nodiscard]] std::vector<id_t> library_ids() const
+		{
+			std::vector<id_t> ret;
+			ret.reserve(selected.size());
+			for (const auto& [id, items] : selected)
+				ret.push_back(id);
+			return ret;
+		}
+		/// <returns>
+		/// 参与调度的 item 的个数。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			return queue.size();
+		}
+
+		/// <summary>
+		/// 添加或更新一个 item 的计数。如果库没有被选中，则忽略。
+		/// </summary>
+		void update(id_t lib_id, const item& it)
+		{
+			auto lib = selected.find(lib_id);
+			if (lib == selected.end())
+				return;
+			counters c{ it.showing_time, it.n_skips };
+			lib->second[it.id] = c;
+			place({ lib_id, it.id }, c);
+		}
+		/// <summary>
+		/// 移除一个 item。
+		/// </summary>
+		void remove(id_t lib_id, id_t item_id)
+		{
+			auto lib = selected.find(lib_id);
+			if (lib == selected.end() || !lib->second.erase(item_id))
+				return;
+			queue.erase({ lib_id, item_id });
+			sampler.erase({ lib_id, item_id });
+		}
+
+		/// <returns>
+		/// 下一个应当显示的词。如果没有词，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<key_t> next() const
+		{
+			if (queue.empty())
+				return std::nullopt;
+			return queue.top().second;
+		}
+		/// <summary>
+		/// 按优先级加权随机抽取一个词。期望 O(1)。
+		/// </summary>
+		/// <returns>抽到的词。如果没有词，返回 std::nullopt。</returns>
+		std::optional<key_t> draw()
+		{
+			return sampler.draw(rng);
+		}
+		/// <returns>
+		/// item 的计数。如果 item 不参与调度，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<counters> counters_of(id_t lib_id, id_t item_id) const
+		{
+			auto lib = selected.find(lib_id);
+			if (lib == selected.end())
+				return std::nullopt;
+			auto it = lib->second.find(item_id);
+			if (it == lib->second.end())
+				return std::nullopt;
+			return it->second;
+		}
+
+		/// <summary>
+		/// 记录一个词被显示了一段时间。
+		/// </summary>
+		/// <param name="milliseconds">显示的时间（毫秒）。</param>
+		/// <returns>更新后的计数。如果 item 不参与调度，返回 std::nullopt。</returns>
+		std::optional<counters> shown(id_t lib_id, id_t item_id, uint_t milliseconds)
+		{
+			auto lib = selected.find(lib_id);
+			if (lib == selected.end())
+				return std::nullopt;
+			auto it = lib->second.find(item_id);
+			if (it == lib->second.end())
+				return std::nullopt;
+			it->second.showing_time += milliseconds;
+			place({ lib_id, item_id }, it->second);
+			return it->second;
+		}
+		/// <summary>
+		/// 记录一个词被手动跳过。
+		/// </summary>
+		/// <returns>更新后的计数。如果 item 不参与调度，返回 std::nullopt。</returns>
+		std::optional<counters> skipped(id_t lib_id, id_t item_id)
+		{
+			auto lib = selected.find(lib_id);
+			if (lib == selected.end())
+				return std::nullopt;
+			auto it = lib->second.find(item_id);
+			if (it == lib->second.end())
+				return std::nullopt;
+			it->second.n_skips++;
+			place({ lib_id, item_id }, it->second);
+			return it->second;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,353 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "item.hpp"
+#include "library.hpp"
+#include "resident_scheduler.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 复习的到期队列，使用分层时间轮。时间以毫秒计，共 6 层，每层 256 个槽，覆盖 2^48 毫秒。
+	/// 加入和取消都是 O(1)；时间前进时只访问非空的槽，每个 item 至多在层间下移 6 次，因此取出到期的 item 均摊 O(1)，长时间休眠后追赶也不需要扫描所有 item。
+	/// 时间小幅回退时不回退时间轮，已经到期的 item 仍然到期；回退超过 rewind_threshold 时（例如修正了错误的系统时间），按新的时间重新放置未到期的 item，这是唯一需要 O(n) 的情况。
+	/// </summary>
+	class review_queue final
+	{
+	public:
+		using key_t = std::pair<id_t, id_t>; // (lib_id, item_id)
+
+	private:
+		static constexpr size_t n_levels = 6;
+		static constexpr size_t level_bits = 8;
+		static constexpr size_t n_slots = size_t(1) << level_bits;
+		static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+		struct entry
+		{
+			uint64_t due{};
+			size_t level{ npos }; // npos 表示已经到期，在 ready 中。
+			size_t slot{};
+			size_t index{}; // 在槽中的下标。
+			uint64_t seq{}; // 在 ready 中时的序号，用于识别已经取消的记录。
+		};
+		using node_t = std::pair<const key_t, entry>; // entries 中的节点，地址在删除前不变。
+		struct level
+		{
+			std::array<std::vector<node_t*>, n_slots> slots;
+			std::array<uint64_t, n_slots / 64> occupied{}; // 非空的槽。
+			size_t count{};
+		};
+
+		std::array<level, n_levels> levels;
+		std::unordered_map<key_t, entry, item_key_hash> entries;
+		std::deque<std::pair<key_t, uint64_t>> ready; // (key, seq)，按到期的顺序。
+		size_t n_ready{};
+		uint64_t next_seq{};
+		uint64_t current{}; // 不晚于这个时间的 item 都已到期。
+
+		[[nodiscard]] static size_t slot_of(uint64_t t, size_t l)
+		{
+			return static_cast<size_t>(t >> (l * level_bits)) & (n_slots - 1);
+		}
+		/// <returns>
+		/// x 的最低的 1 的位置。要求 x 非零。
+		/// </returns>
+		[[nodiscard]] static size_t lowest_bit(uint64_t x)
+		{
+			size_t n{};
+			if (!(x & 0xFFFFFFFFull)) { n += 32; x >>= 32; }
+			if (!(x & 0xFFFFull)) { n += 16; x >>= 16; }
+			if (!(x & 0xFFull)) { n += 8; x >>= 8; }
+			if (!(x & 0xFull)) { n += 4; x >>= 4; }
+			if (!(x & 0x3ull)) { n += 2; x >>= 2; }
+			if (!(x & 0x1ull)) { n += 1; }
+			return n;
+		}
+		/// <returns>
+		/// 层 l 中下标大于 after 的第一个非空的槽。如果没有，返回 npos。
+		/// </returns>
+		[[nodiscard]] size_t next_slot(size_t l, size_t after) const
+		{
+			const auto& occupied = levels[l].occupied;
+			size_t begin = after + 1;
+			for (size_t w = begin / 64; w < occupied.size(); w++)
+			{
+				uint64_t bits = occupied[w];
+				if (w == begin / 64)
+					bits &= begin % 64 ? ~0ull << (begin % 64) : ~0ull;
+				if (bits)
+					return w * 64 + lowest_bit(bits);
+			}
+			return npos;
+		}
+
+		void make_ready(node_t& node)
+		{
+			auto& e = node.second;
+			e.level = npos;
+			e.seq = next_seq++;
+			ready.emplace_back(node.first, e.seq);
+			n_ready++;
+		}
+		/// <summary>
+		/// 按 current 把 item 放入时间轮。已经到期的放入 ready。
+		/// </summary>
+		void place(node_t& node)
+		{
+			auto& e = node.second;
+			if (e.due <= current)
+			{
+				make_ready(node);
+				return;
+			}
+			// 放在与 current 的高位相同的最低的层上，这样槽的下标总是大于 current 在这一层的下标。
+			uint64_t x = e.due ^ current;
+			size_t l = 0;
+			while (l + 1 < n_levels && (x >> ((l + 1) * level_bits)))
+				l++;
+			auto& lv = levels[l];
+			size_t s = slot_of(e.due, l);
+			e.level = l;
+			e.slot = s;
+			e.index = lv.slots[s].size();
+			lv.slots[s].push_back(&node);
+			lv.occupied[s / 64] |= 1ull << (s % 64);
+			lv.count++;
+		}
+		/// <summary>
+		/// 把 item 从时间轮或 ready 中移除，不修改 entries。
+		/// </summary>
+		void unplace(entry& e)
+		{
+			if (e.level == npos)
+			{
+				n_ready--; // ready 中的记录在取出时按 seq 跳过。
+				return;
+			}
+			auto& lv = levels[e.level];
+			auto& slot = lv.slots[e.slot];
+			if (e.index != slot.size() - 1)
+			{
+				slot[e.index] = slot.back();
+				slot[e.index]->second.index = e.index;
+			}
+			slot.pop_back();
+			if (slot.empty())
+				lv.occupied[e.slot / 64] &= ~(1ull << (e.slot % 64));
+			lv.count--;
+		}
+
+	public:
+		uint64_t rewind_threshold{ 60 * 1000 }; // 时间回退超过这个值（毫秒）时回退时间轮。
+
+		/// <param name="now">当前时间（毫秒）。</param>
+		explicit review_queue(uint64_t now = 0) : current(now) {}
+
+		/// <returns>
+		/// 队列中 item 的个数，包括已经到期的。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			return entries.size();
+		}
+		/// <returns>
+		/// 已经到期、还没有取出的 item 的个数。
+		/// </returns>
+		[[nodiscard]] size_t due_count() const
+		{
+			return n_ready;
+		}
+		/// <returns>
+		/// 时间轮的当前时间（毫秒）。
+		/// </returns>
+		[[nodiscard]] uint64_t now() const
+		{
+			return current;
+		}
+		void clear()
+		{
+			for (auto& lv : levels)
+				lv = level();
+			entries.clear();
+			ready.clear();
+			n_ready = 0;
+		}
+
+		/// <summary>
+		/// 加入 item，或修改已有 item 的到期时间。
+		/// </summary>
+		/// <param name="due">到期时间（毫秒）。</param>
+		void schedule(const key_t& key, uint64_t due)
+		{
+			// 超出时间轮范围的时间限制在范围的末尾。
+			uint64_t limit = current | ((uint64_t(1) << (n_levels * level_bits)) - 1);
+			due = std::min(due, limit);
+			auto [it, inserted] = entries.try_emplace(key);
+			if (!inserted)
+				unplace(it->second);
+			it->second.due = due;
+			place(*it);
+		}
+		/// <summary>
+		/// 移除 item。
+		/// </summary>
+		/// <returns>是否存在。</returns>
+		bool cancel(const key_t& key)
+		{
+			auto it = entries.find(key);
+			if (it == entries.end())
+				return false;
+			unplace(it->second);
+			entries.erase(it);
+			return true;
+		}
+		/// <returns>
+		/// item 的到期时间。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<uint64_t> due_of(const key_t& key) const
+		{
+			auto it = entries.find(key);
+			if (it == entries.end())
+				return std::nullopt;
+			return it->second.due;
+		}
+
+		/// <summary>
+		/// 把时间前进到 now，使到期时间不晚于 now 的 item 到期。
+		/// </summary>
+		/// <returns>新到期的 item 的个数。</returns>
+		size_t advance(uint64_t now)
+		{
+			if (now + rewind_threshold < current)
+			{
+				// 时间明显回退，按新的时间重新放置未到期的 item。已经到期的保持到期。
+				for (auto& lv : levels)
+					lv = level();
+				current = now;
+				for (auto& node : entries)
+					if (node.second.level != npos)
+						place(node);
+				return 0;
+			}
+			size_t before = n_ready;
+			while (current < now)
+			{
+				// 最低的非空层中的槽总是最早的：低层的槽都在 current 所在的高层槽内，早于高层的所有槽。
+				size_t l = 0;
+				while (l < n_levels && !levels[l].count)
+					l++;
+				if (l == n_levels)
+				{
+					current = now;
+					break;
+				}
+				size_t s = next_slot(l, slot_of(current, l));
+				uint64_t high_bits = (l + 1) * level_bits;
+				uint64_t base = high_bits >= 64 ? 0 : (current >> high_bits) << high_bits;
+				uint64_t t = base | (uint64_t(s) << (l * level_bits));
+				if (t > now) // 在 now 之前没有事件，直接跳到 now，所有槽的位置仍然有效。
+				{
+					current = now;
+					break;
+				}
+
+				current = t;
+				auto& lv = levels[l];
+				std::vector<node_t*> nodes;
+				nodes.swap(lv.slots[s]);
+				lv.occupied[s / 64] &= ~(1ull << (s % 64));
+				lv.count -= nodes.size();
+				if (!l && nodes.size() > 1) // 同一毫秒到期的 item 按键排序，保证结果确定。
+					std::sort(nodes.begin(), nodes.end(), [](const node_t* a, const node_t* b) { return a->first < b->first; });
+				for (auto* node : nodes)
+					place(*node); // 到期的放入 ready，其他的下移到更低的层。
+				if (lv.slots[s].empty()) // 保留容量，避免反复分配。
+				{
+					nodes.clear();
+					lv.slots[s].swap(nodes);
+				}
+			}
+			return n_ready - before;
+		}
+		/// <summary>
+		/// 取出一个到期的 item。item 会从队列中移除，复习后应当重新加入。
+		/// </summary>
+		/// <returns>到期的 item。如果没有，返回 std::nullopt。</returns>
+		std::optional<key_t> pop_due()
+		{
+			while (!ready.empty())
+			{
+				auto [key, seq] = ready.front();
+				ready.pop_front();
+				auto it = entries.find(key);
+				if (it == entries.end() || it->second.level != npos || it->second.seq != seq)
+					continue; // 已经取消或重新加入。
+				entries.erase(it);
+				n_ready--;
+				return key;
+			}
+			return std::nullopt;
+		}
+		/// <returns>
+		/// 下一个需要调用 advance 的时间的下界。在这之前不会有新的 item 到期。如果队列中没有未到期的 item，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<uint64_t> next_wakeup() const
+		{
+			for (size_t l = 0; l < n_levels; l++)
+			{
+				if (!levels[l].count)
+					continue;
+				size_t s = next_slot(l, slot_of(current, l));
+				uint64_t high_bits = (l + 1) * level_bits;
+				uint64_t base = high_bits >= 64 ? 0 : (current >> high_bits) << high_bits;
+				return base | (uint64_t(s) << (l * level_bits));
+			}
+			return std::nullopt;
+		}
+	};
+
+	/// <summary>
+	/// 间隔重复的复习规则，与 SM-2 类似。记住时间隔乘以难度系数，忘记时间隔重置并降低难度系数。
+	/// </summary>
+	struct review_policy
+	{
+		uint_t first_interval{ 10 * 60 * 1000 }; // 第一次复习和忘记后的间隔（毫秒）。
+		uint_t second_interval{ 24 * 60 * 60 * 1000 }; // 第二次复习的间隔（毫秒）。
+		uint_t max_interval{ 365ull * 24 * 60 * 60 * 1000 };
+		uint_t initial_ease{ 2500 }; // 难度系数的初始值（千分之一）。
+		uint_t min_ease{ 1300 };
+		uint_t ease_step{ 150 }; // 记住时增加、忘记时减少的难度系数。
+
+		/// <summary>
+		/// 按复习结果更新 item 的复习状态。
+		/// </summary>
+		/// <param name="it">被复习的 item。</param>
+		/// <param name="remembered">是否记住。</param>
+		/// <param name="now">复习的时间（毫秒）。</param>
+		void apply(item& it, bool remembered, uint_t now) const
+		{
+			if (!it.review_ease)
+				it.review_ease = initial_ease;
+			if (remembered)
+			{
+				if (!it.n_reviews || !it.review_interval)
+					it.review_interval = first_interval;
+				else if (it.review_interval < second_interval)
+					it.review_interval = second_interval;
+				else
+					it.review_interval = it.review_interval / 1000 * it.review_ease;
+				it.review_ease += ease_step;
+			}
+			else
+			{
+				it.review_interval = first_interval;
+				it.review_ease = std::max(min_ease, it.review_ease > ease_step ? it.review_ease - ease_step : 0);
+				it.n_lapses++;
+			}
+			it.review_interval = std::min(it.review_interval, max_interval);
+			it.n_reviews++;
+			it.review_due = now + it.review_interval;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 固定容量的环形缓冲区。满后插入会覆盖最旧的元素，不会再分配内存。
+	/// </summary>
+	template <typename T>
+	class ring_buffer final
+	{
+	private:
+		std::vector<T> data;
+		size_t head{}; // 下一个写入的位置。
+		size_t count{};
+
+	public:
+		explicit ring_buffer(size_t capacity) : data(std::max<size_t>(capacity, 1)) {}
+
+		[[nodiscard]] size_t capacity() const
+		{
+			return data.size();
+		}
+		[[nodiscard]] size_t size() const
+		{
+			return count;
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return !count;
+		}
+		void clear()
+		{
+			head = count = 0;
+		}
+
+		/// <summary>
+		/// 插入元素。如果已满，覆盖最旧的元素。
+		/// </summary>
+		void push(T value)
+		{
+			data[head] = std::move(value);
+			head = (head + 1) % data.size();
+			count = std::min(count + 1, data.size());
+		}
+		/// <returns>
+		/// 倒数第 i 新的元素，i 为 0 时是最新的元素。要求 i 小于 size()。
+		/// </returns>
+		[[nodiscard]] const T& recent(size_t i) const
+		{
+			return data[(head + data.size() - 1 - i) % data.size()];
+		}
+		[[nodiscard]] T& recent(size_t i)
+		{
+			return data[(head + data.size() - 1 - i) % data.size()];
+		}
+		/// <returns>
+		/// 所有元素，从新到旧。
+		/// </returns>
+		[[nodiscard]] std::vector<T> to_vector() const
+		{
+			std::vector<T> ret;
+			ret.reserve(count);
+			for (size_t i = 0; i < count; i++)
+				ret.push_back(recent(i));
+			return ret;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "binary.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 追加写入的段文件（句子库、事件日志、语音库）的格式。段文件以 8 字节的文件头开始：4 字节的标识和 u32 版本号（小端序），之后是各自的记录。
+	/// 无法识别的文件头（损坏或由更新的版本写入）不会被当作空的段文件覆盖，打开的一方应当失败并保留文件。
+	/// </summary>
+	class segment_format final
+	{
+	public:
+		static constexpr size_t header_size = 8;
+
+		/// <summary>
+		/// 文件头的检查结果。
+		/// </summary>
+		enum class header_state
+		{
+			valid,
+			incomplete, // 文件头不完整（创建段文件时中断），其中没有记录，可以重新写入。
+			invalid, // 无法识别，不能修改。
+		};
+
+	private:
+		char magic[4]{};
+		uint32_t version{};
+
+	public:
+		/// <param name="magic">4 字节的标识。</param>
+		/// <param name="version">当前的版本号。其他版本的段文件都无法识别。</param>
+		constexpr segment_format(const char(&magic)[5], uint32_t version)
+			: magic{ magic[0], magic[1], magic[2], magic[3] }, version(version)
+		{
+		}
+
+		/// <returns>
+		/// 文件头的字节。
+		/// </returns>
+		[[nodiscard]] std::string header() const
+		{
+			std::string ret(magic, 4);
+			binary::put<uint32_t>(ret, version);
+			return ret;
+		}
+		/// <summary>
+		/// 检查段文件开头的文件头。
+		/// </summary>
+		/// <param name="content">段文件的内容，至少包括开头的 header_size 字节（文件更短时为整个文件）。</param>
+		[[nodiscard]] header_state check(std::string_view content) const
+		{
+			auto expected = header();
+			if (content.size() < header_size)
+				return expected.compare(0, content.size(), content) == 0 ? header_state::incomplete : header_state::invalid;
+			return content.compare(0, header_size, expected) == 0 ? header_state::valid : header_state::invalid;
+		}
+		/// <summary>
+		/// 打开段文件用于追加。
+		/// </summary>
+		/// <param name="writer">写入的流，之前打开的文件会被关闭。</param>
+		/// <param name="path">段文件。</param>
+		/// <param name="size">段文件中有效部分的字节数。为 0 时创建新的段文件（已有的内容被清空）并写入文件头。</param>
+		/// <returns>段文件的字节数。如果无法打开，抛出 std::runtime_error 异常。</returns>
+		uint64_t open_writer(std::ofstream& writer, const std::filesystem::path& path, uint64_t size) const
+		{
+			writer.close();
+			if (!size)
+			{
+				writer.open(path, std::ios::binary | std::ios::trunc);
+				auto h = header();
+				writer.write(h.data(), h.size());
+				size = header_size;
+			}
+			else
+				writer.open(path, std::ios::binary | std::ios::app);
+			if (!writer)
+				throw std::runtime_error("fail to open the segment file.");
+			return size;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,236 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "text.hpp"
+#include "library.hpp"
+#include "extractor.hpp"
+#include "double_array_trie.hpp"
+
+#include <cmath>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 基于词典的分词器，用于 zhs、zht、ja 等不使用空白分词的语言。
+	/// 对每段连续的文本，用双数组字典树找出所有在词典中的词，构成有向无环图，再用动态规划选出词频乘积最大的路径。不在词典中的连续字符被合并为一个未知片段。
+	/// 构造后只读，可以在多个线程中同时调用 segment_text。
+	/// </summary>
+	class segmenter final
+	{
+	public:
+		/// <summary>
+		/// 分词结果中的一段。
+		/// </summary>
+		struct segment
+		{
+			size_t offset{}; // 在原文中的位置（字符数）。
+			size_t length{};
+			bool known{}; // 是否是词典中的词。
+			id_t lib_id{}; // 仅在 known 为 true 时有效。
+			id_t item_id{}; // 仅在 known 为 true 时有效。
+		};
+
+	private:
+		struct entry
+		{
+			id_t lib_id{};
+			id_t item_id{};
+			double weight{};
+		};
+		std::unordered_map<std::u32string, entry> pending; // 尚未构造的词。
+		std::vector<entry> entries;
+		std::vector<double> log_probs; // 每个词的对数概率。
+		double log_prob_unknown{}; // 单个未知字符的对数概率。
+		double_array_trie trie;
+
+		static std::u32string fold(std::u32string_view s)
+		{
+			std::u32string ret(s);
+			for (auto& ch : ret)
+				ch = text::fold(ch);
+			return ret;
+		}
+
+	public:
+		size_t min_unknown_length{ 2 }; // unknown_tokenizer 输出的未知片段的最短长度。
+
+		/// <summary>
+		/// 添加一个词。同一个词被添加多次时，保留权重最大的一个。需要调用 build 后才能生效。
+		/// </summary>
+		/// <param name="word">词。</param>
+		/// <param name="lib_id">词所在的库。</param>
+		/// <param name="item_id">词对应的 item。</param>
+		/// <param name="weight">权重，即词频，应当为正数。</param>
+		void add(std::u32string_view word, id_t lib_id, id_t item_id, double weight = 1)
+		{
+			if (word.empty() || weight <= 0)
+				return;
+			auto& e = pending[fold(word)];
+			if (weight > e.weight)
+				e = { lib_id, item_id, weight };
+		}
+		/// <summary>
+		/// 添加库中所有 item 的一般式和变体。item 本身没有词频，以 1 + n_query 作为权重，即查询过的词更倾向于被切出。
+		/// </summary>
+		void add(const library& lib)
+		{
+			for (const auto& [id, it] : lib.items)
+			{
+				double weight = 1 + static_cast<double>(it.n_query);
+				add(it.origin, lib.id, id, weight);
+				for (const auto& v : it.variants)
+					add(v, lib.id, id, weight);
+			}
+		}
+		/// <summary>
+		/// 用已添加的词构造词典。之后可以继续 add，并再次 build。
+		/// </summary>
+		void build()
+		{
+			std::vector<std::pair<std::u32string, uint32_t>> keys;
+			keys.reserve(pending.size());
+			entries.clear();
+			entries.reserve(pending.size());
+			double total{};
+			double min_weight = 1;
+			for (const auto& [word, e] : pending)
+			{
+				keys.emplace_back(word, static_cast<uint32_t>(entries.size()));
+				entries.push_back(e);
+				total += e.weight;
+				min_weight = std::min(min_weight, e.weight);
+			}
+			total = std::max(total, 1.0);
+
+			log_probs.resize(entries.size());
+			for (size_t i = 0; i < entries.size(); i++)
+				log_probs[i] = std::log(entries[i].weight / total);
+			// 未知字符比最罕见的词更不可能出现，使得能匹配词典时总是优先匹配。
+			log_prob_unknown = std::log(min_weight / total) - 1;
+
+			trie.build(std::move(keys));
+		}
+
+	private:
+		/// <summary>
+		/// 动态规划时使用的缓冲区，在一次 segment_text 调用中复用。
+		/// </summary>
+		struct workspace
+		{
+			std::vector<double> score; // score[i] 是从 i 开始的后缀的最大对数概率。
+			std::vector<uint32_t> route; // route[i] 的低位是从 i 开始的词的长度，最高位表示是否是词典中的词。
+			std::vector<uint32_t> values; // 与 route 对应的词的下标。
+			std::u32string folded;
+		};
+		/// <summary>
+		/// 对一段不含空白和标点的文本分词，结果追加到 ret 中。
+		/// </summary>
+		void segment_run(std::u32string_view folded, size_t base_offset, std::vector<segment>& ret, workspace& ws) const
+		{
+			size_t n = folded.length();
+			auto& score = ws.score;
+			auto& route = ws.route;
+			auto& values = ws.values;
+			score.assign(n + 1, 0);
+			route.assign(n + 1, 0);
+			values.assign(n + 1, 0);
+			constexpr uint32_t known_bit = 1u << 31;
+			for (size_t i = n; i-- > 0;)
+			{
+				score[i] = log_prob_unknown + score[i + 1];
+				route[i] = 1;
+				// 非 CJK 字符（如夹杂的拉丁字母、数字）不会被拆开，整体作为一个未知片段或一个词。
+				if (!text::is_cjk(folded[i]))
+				{
+					size_t j = i + 1;
+					while (j < n && !text::is_cjk(folded[j]))
+						j++;
+					if (i == 0 || text::is_cjk(folded[i - 1]))
+					{
+						score[i] = log_prob_unknown + score[j];
+						route[i] = static_cast<uint32_t>(j - i);
+					}
+				}
+				trie.common_prefix_search(folded.substr(i), [&](size_t len, uint32_t value)
+					{
+						// 拉丁字母组成的词只能完整匹配，不能匹配单词的前缀。
+						if (i + len < n && !text::is_cjk(folded[i + len - 1]) && !text::is_cjk(folded[i + len]))
+							return;
+						double s = log_probs[value] + score[i + len];
+						if (s > score[i])
+						{
+							score[i] = s;
+							route[i] = static_cast<uint32_t>(len) | known_bit;
+							values[i] = value;
+						}
+					});
+			}
+
+			for (size_t i = 0; i < n;)
+			{
+				size_t len = route[i] & ~known_bit;
+				if (route[i] & known_bit)
+				{
+					const auto& e = entries[values[i]];
+					ret.push_back({ base_offset + i, len, true, e.lib_id, e.item_id });
+				}
+				else if (!ret.empty() && !ret.back().known && ret.back().offset + ret.back().length == base_offset + i
+					&& text::is_cjk(folded[i]) && text::is_cjk(folded[ret.back().offset - base_offset]))
+					ret.back().length += len; // 合并连续的未知字符。
+				else
+					ret.push_back({ base_offset + i, len, false });
+				i += len;
+			}
+		}
+
+	public:
+		/// <summary>
+		/// 对文本分词。空白和标点不会出现在结果中。
+		/// </summary>
+		/// <param name="content">文本。</param>
+		/// <returns>按位置排序的分词结果。</returns>
+		[[nodiscard]] std::vector<segment> segment_text(std::u32string_view content) const
+		{
+			std::vector<segment> ret;
+			workspace ws;
+			auto& folded = ws.folded;
+			size_t i = 0;
+			while (i < content.length())
+			{
+				if (!text::is_word_char(content[i]))
+				{
+					i++;
+					continue;
+				}
+				size_t j = i;
+				while (j < content.length() && text::is_word_char(content[j]))
+					j++;
+				folded.assign(content.substr(i, j - i));
+				for (auto& ch : folded)
+					ch = text::fold(ch);
+				segment_run(folded, i, ret, ws);
+				i = j;
+			}
+			return ret;
+		}
+		/// <summary>
+		/// 返回一个分词器，只输出未知片段，可以作为 raw_item_extractor 的 tokenizer。返回的分词器引用了这个对象，使用期间不可销毁或修改这个对象。
+		/// </summary>
+		[[nodiscard]] raw_item_extractor::tokenizer_t unknown_tokenizer() const
+		{
+			return [this](std::u32string_view content, const raw_item_extractor::emit_t& emit)
+			{
+				std::u32string word;
+				for (const auto& seg : segment_text(content))
+				{
+					if (seg.known || seg.length < min_unknown_length)
+						continue;
+					word.assign(content.substr(seg.offset, seg.length));
+					for (auto& ch : word)
+						ch = text::fold(ch);
+					emit(word);
+				}
+			};
+		}
+	};
+}
\ No newline at end of file
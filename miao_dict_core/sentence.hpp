@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	class sentence final : public serializable_base
+	{
+	public:
+		// 版本标记
+		static constexpr int latest_ver_tag = 1;
+		int ver_tag = latest_ver_tag;
+
+		// 数据域
+		id_t id{}; // 全局 id，意思相同的句子在不同的库中共享一个 id。
+		std::vector<std::tuple<id_t, std::u32string>> content; // (lib_id, content)
+
+	public:
+		/// <returns>
+		/// 指定库中的句子内容。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<std::u32string> content_of(id_t lib_id) const
+		{
+			for (const auto& t : content)
+				if (std::get<0>(t) == lib_id)
+					return std::get<1>(t);
+			return std::nullopt;
+		}
+
+		[[nodiscard]] virtual Json::Value to_json() const override
+		{
+			Json::Value root;
+			root["id"] = id;
+			root["content"].resize(0);
+			for (const auto& t : content)
+			{
+				Json::Value node;
+				node["lib_id"] = std::get<0>(t);
+				node["content"] = utf_conv<char32_t, char>::convert(std::get<1>(t));
+				root["content"].append(node);
+			}
+			return root;
+		}
+		virtual void from_json(const Json::Value& value) override
+		{
+			ver_tag = 0;
+			try
+			{
+				id = value["id"].asUInt64();
+				content.resize(value["content"].size());
+				for (size_t i = 0; i < content.size(); i++)
+				{
+					const Json::Value& node = value["content"][static_cast<Json::ArrayIndex>(i)];
+					content[i] = { node["lib_id"].asUInt64(),
+						std::get<std::u32string>(Json::value_cast(node["content"])) };
+				}
+				ver_tag = 1;
+			}
+			catch (...)
+			{
+				if (!ver_tag)
+					throw deserialize_error("fail to translate the json into sentence.");
+			}
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,445 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "binary.hpp"
+#include "segment_file.hpp"
+#include "mapped_file.hpp"
+#include "sentence.hpp"
+#include "tinylfu_cache.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 全局句子库。句子以追加的方式保存在 sentence 目录下的若干段文件（0.dat、1.dat、……）中，段文件超过一定大小后换用新的段文件，因此大量句子只需要少量文件。
+	/// 打开时按记录头中的内容哈希校验每条记录并建立索引，句子内容在需要时才从文件中读取和解码，并按访问频率缓存常用的内容（W-TinyLFU），一次性读取大量句子不会冲掉常用的句子。所有成员函数都是线程安全的。
+	/// </summary>
+	/// <remarks>
+	/// 段文件以 8 字节的文件头开始（"MDSN" 和 u32 版本号），之后是若干记录。每条记录依次是：内容长度（u32）、句子 id（u64）、库 id（u64）、内容哈希（u64）、UTF-8 编码的内容。整数均为小端序。
+	/// 同一句子 id 和库 id 的记录出现多次时，以最后一条为准。内容哈希不符的记录（如断电后末尾未写入的零）及之后的部分被截去。
+	/// </remarks>
+	class sentence_store final
+	{
+	private:
+		static constexpr segment_format format{ "MDSN", 1 };
+		static constexpr size_t file_header_size = segment_format::header_size;
+		static constexpr size_t record_header_size = 4 + 8 + 8 + 8;
+		static constexpr size_t cache_entry_overhead = 96; // 缓存中每个句子除内容外占用的字节数的估计值。
+		static constexpr uint64_t max_read_gap = 64 << 10; // 批量读取时，间隔不超过这个字节数的句子合并为一次读取。
+
+	public:
+		uint64_t max_segment_size{ 64ull << 20 }; // 段文件的最大字节数。
+
+	private:
+		struct location
+		{
+			uint32_t segment{};
+			uint64_t offset{}; // 内容在段文件中的位置。
+			uint32_t length{}; // 内容的字节数。
+			id_t lib_id{};
+		};
+		struct key
+		{
+			id_t id{};
+			id_t lib_id{};
+			bool operator==(const key& rhs) const
+			{
+				return id == rhs.id && lib_id == rhs.lib_id;
+			}
+		};
+		struct key_hash
+		{
+			size_t operator()(const key& k) const
+			{
+				return std::hash<id_t>()(k.id * 0x9E3779B97F4A7C15ull ^ k.lib_id);
+			}
+		};
+
+		mutable std::mutex mutex;
+		std::filesystem::path dir;
+		std::unordered_map<id_t, std::vector<location>> index; // 句子 id 到各个库中内容位置的映射。
+		std::unordered_multimap<uint64_t, id_t> by_hash; // 内容哈希到句子 id 的映射，用于去重。
+		id_t next_id{};
+
+		std::ofstream writer;
+		uint32_t writer_segment{};
+		uint64_t writer_size{};
+		bool writer_dirty{};
+		std::vector<std::unique_ptr<std::ifstream>> readers; // 按段编号。
+
+		struct key_weigh
+		{
+			size_t operator()(const key&, const std::u32string& content) const
+			{
+				return content.size() * sizeof(char32_t) + cache_entry_overhead;
+			}
+		};
+		tinylfu_cache<key, std::u32string, key_hash, key_weigh> cache{ 4 << 20, key_weigh(), 256 };
+
+		static uint64_t hash(id_t lib_id, std::string_view utf8)
+		{
+			std::string prefix;
+			binary::put<uint64_t>(prefix, lib_id);
+			return binary::fnv1a(utf8, binary::fnv1a(prefix));
+		}
+		std::filesystem::path segment_path(uint32_t segment) const
+		{
+			return dir / (std::to_string(segment) + ".dat");
+		}
+
+		/// <summary>
+		/// 读取一个段文件中的所有记录。段文件被映射到内存中，句子内容只用于校验记录头中的哈希，不会被解码。遇到不完整或哈希不符（如断电后末尾的零）的记录时停止。
+		/// </summary>
+		/// <returns>有效部分的长度。文件头不完整（创建段文件时中断）时返回 0；文件头无法识别（损坏或由更新的版本写入）时返回 std::nullopt。</returns>
+		std::optional<uint64_t> scan_segment(uint32_t segment)
+		{
+			mapped_file file(segment_path(segment));
+			auto buf = file.view();
+			auto state = format.check(buf);
+			if (state == segment_format::header_state::invalid)
+				return std::nullopt;
+			if (state == segment_format::header_state::incomplete)
+				return 0;
+
+			uint64_t pos = file_header_size;
+			while (pos + record_header_size <= buf.size())
+			{
+				const char* p = buf.data() + pos;
+				uint32_t length = binary::get<uint32_t>(p);
+				id_t id = binary::get<uint64_t>(p + 4);
+				id_t lib_id = binary::get<uint64_t>(p + 12);
+				uint64_t h = binary::get<uint64_t>(p + 20);
+				if (pos + record_header_size + length > buf.size())
+					break;
+				if (hash(lib_id, buf.substr(pos + record_header_size, length)) != h)
+					break;
+				record(id, { segment, pos + record_header_size, length, lib_id }, h);
+				pos += record_header_size + length;
+			}
+			return pos;
+		}
+		/// <summary>
+		/// 在索引中记录一条句子内容的位置。
+		/// </summary>
+		void record(id_t id, const location& loc, uint64_t h)
+		{
+			auto& locs = index[id];
+			bool replaced{};
+			for (auto& l : locs)
+				if (l.lib_id == loc.lib_id)
+				{
+					l = loc;
+					replaced = true;
+				}
+			if (!replaced)
+				locs.push_back(loc);
+			auto [l, r] = by_hash.equal_range(h);
+			if (std::find_if(l, r, [id](const auto& p) { return p.second == id; }) == r)
+				by_hash.emplace(h, id);
+			next_id = std::max(next_id, id + 1);
+			cache.erase({ id, loc.lib_id });
+		}
+		void open_writer(uint32_t segment, uint64_t size)
+		{
+			writer_segment = segment;
+			writer_size = format.open_writer(writer, segment_path(segment), size);
+			writer_dirty = true;
+		}
+		id_t append(id_t id, id_t lib_id, std::string_view utf8, uint64_t h)
+		{
+			if (writer_size + record_header_size + utf8.size() > max_segment_size && writer_size > file_header_size)
+				open_writer(writer_segment + 1, 0);
+
+			std::string buf;
+			buf.reserve(record_header_size + utf8.size());
+			binary::put<uint32_t>(buf, static_cast<uint32_t>(utf8.size()));
+			binary::put<uint64_t>(buf, id);
+			binary::put<uint64_t>(buf, lib_id);
+			binary::put<uint64_t>(buf, h);
+			buf.append(utf8);
+			writer.write(buf.data(), buf.size());
+			if (!writer)
+				throw std::runtime_error("fail to write sentence segment.");
+			writer_dirty = true;
+
+			record(id, { writer_segment, writer_size + record_header_size, static_cast<uint32_t>(utf8.size()), lib_id }, h);
+			writer_size += buf.size();
+			return id;
+		}
+		/// <summary>
+		/// 从段文件中读取一段字节。
+		/// </summary>
+		/// <returns>成功返回 true，否则返回 false。</returns>
+		bool read_bytes(uint32_t segment, uint64_t offset, std::string& buf)
+		{
+			if (segment == writer_segment && writer_dirty)
+			{
+				writer.flush();
+				writer_dirty = false;
+			}
+			if (readers.size() <= segment)
+				readers.resize(segment + 1);
+			auto& reader = readers[segment];
+			if (!reader)
+				reader = std::make_unique<std::ifstream>(segment_path(segment), std::ios::binary);
+			reader->clear();
+			reader->seekg(offset);
+			return static_cast<bool>(reader->read(buf.data(), buf.size()));
+		}
+		std::optional<std::u32string> read(const location& loc)
+		{
+			std::string buf(loc.length, '\0');
+			if (!read_bytes(loc.segment, loc.offset, buf))
+				return std::nullopt;
+			return utf_conv<char, char32_t>::convert(buf);
+		}
+		[[nodiscard]] const location* locate(id_t id, id_t lib_id) const
+		{
+			auto it = index.find(id);
+			if (it == index.end())
+				return nullptr;
+			for (const auto& loc : it->second)
+				if (loc.lib_id == lib_id)
+					return &loc;
+			return nullptr;
+		}
+		std::optional<std::u32string> get_locked(id_t id, id_t lib_id)
+		{
+			if (auto p = cache.get({ id, lib_id }))
+				return *p;
+			auto loc = locate(id, lib_id);
+			if (!loc)
+				return std::nullopt;
+			auto ret = read(*loc);
+			if (ret)
+				cache.put({ id, lib_id }, *ret);
+			return ret;
+		}
+		std::optional<id_t> find_locked(id_t lib_id, std::u32string_view content, uint64_t h)
+		{
+			auto [l, r] = by_hash.equal_range(h);
+			for (auto it = l; it != r; ++it)
+				if (auto t = get_locked(it->second, lib_id); t && *t == content)
+					return it->second;
+			return std::nullopt;
+		}
+
+	public:
+		sentence_store() = default;
+		sentence_store(const sentence_store&) = delete;
+		sentence_store& operator=(const sentence_store&) = delete;
+
+		/// <summary>
+		/// 打开指定目录下的句子库，目录需要已经存在。之前打开的句子库会被关闭。末尾不完整的记录（例如写入时程序崩溃）会被截去。
+		/// </summary>
+		/// <param name="path">句子目录。</param>
+		/// <returns>成功返回 true，否则返回 false。段文件的文件头无法识别（损坏或由更新的版本写入）时失败，文件不会被修改。</returns>
+		bool open(std::filesystem::path path)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			close_locked();
+			path.make_preferred();
+			dir = path;
+			if (!std::filesystem::is_directory(dir))
+				return false;
+
+			try
+			{
+				// 依次扫描所有段文件，截去每个段末尾不完整的记录，之后向最后一个段追加。无法识别的段文件不被修改，打开失败。
+				uint32_t segment = 0;
+				uint64_t size = 0;
+				for (uint32_t i = 0; std::filesystem::exists(segment_path(i)); i++)
+				{
+					segment = i;
+					auto valid = scan_segment(i);
+					if (!valid)
+					{
+						close_locked();
+						return false;
+					}
+					size = *valid;
+					if (size < std::filesystem::file_size(segment_path(i)))
+						std::filesystem::resize_file(segment_path(i), size);
+				}
+				open_writer(segment, size < file_header_size ? 0 : size);
+			}
+			catch (const std::exception&)
+			{
+				close_locked();
+				return false;
+			}
+			return true;
+		}
+	private:
+		void close_locked()
+		{
+			if (writer.is_open())
+				writer.close();
+			readers.clear();
+			index.clear();
+			by_hash.clear();
+			cache.clear();
+			next_id = 0;
+			writer_segment = 0;
+			writer_size = 0;
+			writer_dirty = false;
+		}
+	public:
+		/// <summary>
+		/// 将缓冲的写入刷新到文件。
+		/// </summary>
+		void flush()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (writer.is_open())
+				writer.flush();
+			writer_dirty = false;
+		}
+
+		/// <returns>
+		/// 句子的数量。
+		/// </returns>
+		[[nodiscard]] size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return index.size();
+		}
+		/// <summary>
+		/// 查找指定库中内容完全相同的句子。
+		/// </summary>
+		/// <returns>句子 id。如果不存在，返回 std::nullopt。</returns>
+		[[nodiscard]] std::optional<id_t> find(id_t lib_id, std::u32string_view content)
+		{
+			std::string utf8 = utf_conv<char32_t, char>::convert(content);
+			std::lock_guard<std::mutex> lock(mutex);
+			return find_locked(lib_id, content, hash(lib_id, utf8));
+		}
+		/// <summary>
+		/// 添加一个句子。如果指定库中已经存在内容完全相同的句子，则直接返回它的 id。
+		/// </summary>
+		/// <param name="lib_id">句子所在的库。</param>
+		/// <param name="content">句子内容。</param>
+		/// <returns>句子的全局 id。</returns>
+		id_t add(id_t lib_id, std::u32string_view content)
+		{
+			std::string utf8 = utf_conv<char32_t, char>::convert(content);
+			uint64_t h = hash(lib_id, utf8);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!writer.is_open())
+				throw std::runtime_error("call open() before add.");
+			if (auto id = find_locked(lib_id, content, h))
+				return *id;
+			return append(next_id, lib_id, utf8, h);
+		}
+		/// <summary>
+		/// 为已存在的句子添加或替换另一个库中的内容（例如翻译）。
+		/// </summary>
+		/// <param name="id">句子 id。</param>
+		/// <param name="lib_id">内容所在的库。</param>
+		/// <param name="content">句子内容。</param>
+		/// <returns>句子存在返回 true，否则返回 false。</returns>
+		bool set_content(id_t id, id_t lib_id, std::u32string_view content)
+		{
+			std::string utf8 = utf_conv<char32_t, char>::convert(content);
+			uint64_t h = hash(lib_id, utf8);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!writer.is_open())
+				throw std::runtime_error("call open() before set_content.");
+			if (!index.count(id))
+				return false;
+			append(id, lib_id, utf8, h);
+			return true;
+		}
+		/// <returns>
+		/// 句子在指定库中的内容。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<std::u32string> get(id_t id, id_t lib_id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return get_locked(id, lib_id);
+		}
+		/// <summary>
+		/// 批量获取句子内容。缓存中没有的句子按在段文件中的位置排序，相邻的句子合并为一次读取。
+		/// </summary>
+		/// <param name="keys">若干 (句子 id, 库 id)。</param>
+		/// <returns>与 keys 对应的内容。不存在的为 std::nullopt。</returns>
+		[[nodiscard]] std::vector<std::optional<std::u32string>> get_many(const std::vector<std::pair<id_t, id_t>>& keys)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<std::optional<std::u32string>> ret(keys.size());
+			std::vector<std::pair<const location*, size_t>> misses; // (位置, 在 keys 中的下标)
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				if (auto p = cache.get({ keys[i].first, keys[i].second }))
+					ret[i] = *p;
+				else if (auto loc = locate(keys[i].first, keys[i].second))
+					misses.emplace_back(loc, i);
+			}
+			std::sort(misses.begin(), misses.end(), [](const auto& a, const auto& b)
+				{
+					return std::tie(a.first->segment, a.first->offset) < std::tie(b.first->segment, b.first->offset);
+				});
+
+			std::string buf;
+			for (size_t l = 0, r; l < misses.size(); l = r)
+			{
+				// 合并同一段中间隔较小的句子。
+				const auto* first = misses[l].first;
+				uint64_t end = first->offset + first->length;
+				for (r = l + 1; r < misses.size(); r++)
+				{
+					const auto* loc = misses[r].first;
+					if (loc->segment != first->segment || loc->offset > end + max_read_gap)
+						break;
+					end = std::max(end, loc->offset + loc->length);
+				}
+				buf.assign(static_cast<size_t>(end - first->offset), '\0');
+				if (!read_bytes(first->segment, first->offset, buf))
+					continue;
+				for (size_t i = l; i < r; i++)
+				{
+					const auto* loc = misses[i].first;
+					auto content = utf_conv<char, char32_t>::convert(
+						std::string_view(buf).substr(static_cast<size_t>(loc->offset - first->offset), loc->length));
+					const auto& k = keys[misses[i].second];
+					cache.put({ k.first, k.second }, content);
+					ret[misses[i].second] = std::move(content);
+				}
+			}
+			return ret;
+		}
+
+		/// <summary>
+		/// 设置缓存的内存预算（字节）。
+		/// </summary>
+		void set_cache_budget(size_t bytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			cache.set_budget(bytes);
+		}
+		/// <returns>
+		/// 缓存的命中率、内存占用等统计信息。
+		/// </returns>
+		[[nodiscard]] tinylfu_cache<key, std::u32string, key_hash, key_weigh>::stats cache_stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return cache.statistics();
+		}
+		/// <returns>
+		/// 句子在所有库中的内容。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<sentence> get(id_t id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = index.find(id);
+			if (it == index.end())
+				return std::nullopt;
+			sentence ret;
+			ret.id = id;
+			auto locs = it->second;
+			for (const auto& loc : locs)
+				if (auto t = get_locked(id, loc.lib_id))
+					ret.content.emplace_back(loc.lib_id, std::move(*t));
+			return ret;
+		}
+	};
+}
\ No newline at end of file
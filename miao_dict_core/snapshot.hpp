@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 可以原子地读取和替换的 std::shared_ptr，用于发布不可变的快照：写者构造新的对象后整体替换，读者取得的 shared_ptr 在释放前一直有效，最后一个读者释放后旧的对象才被回收。
+	/// 读者只需要增加一次引用计数，不会等待写者构造新的对象。
+	/// </summary>
+	template <typename T>
+	class atomic_shared_ptr final
+	{
+	private:
+#if __stdge20
+		std::atomic<std::shared_ptr<T>> ptr;
+#else
+		std::shared_ptr<T> ptr; // 只通过 std::atomic_load 等函数访问。
+#endif
+
+	public:
+		atomic_shared_ptr() = default;
+		explicit atomic_shared_ptr(std::shared_ptr<T> p) : ptr(std::move(p)) {}
+		atomic_shared_ptr(const atomic_shared_ptr&) = delete;
+		atomic_shared_ptr& operator=(const atomic_shared_ptr&) = delete;
+
+		[[nodiscard]] std::shared_ptr<T> load() const
+		{
+#if __stdge20
+			return ptr.load(std::memory_order_acquire);
+#else
+			return std::atomic_load_explicit(&ptr, std::memory_order_acquire);
+#endif
+		}
+		void store(std::shared_ptr<T> p)
+		{
+#if __stdge20
+			ptr.store(std::move(p), std::memory_order_release);
+#else
+			std::atomic_store_explicit(&ptr, std::move(p), std::memory_order_release);
+#endif
+		}
+		/// <summary>
+		/// 如果当前值是 expected，则替换为 desired。否则把 expected 更新为当前值。
+		/// </summary>
+		/// <returns>是否替换成功。</returns>
+		bool compare_exchange(std::shared_ptr<T>& expected, std::shared_ptr<T> desired)
+		{
+#if __stdge20
+			return ptr.compare_exchange_strong(expected, std::move(desired), std::memory_order_acq_rel);
+#else
+			return std::atomic_compare_exchange_strong_explicit(&ptr, &expected, std::move(desired),
+				std::memory_order_acq_rel, std::memory_order_acquire);
+#endif
+		}
+	};
+}
\ No newline at end of file
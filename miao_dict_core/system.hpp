@@ -3,6 +3,22 @@
 #include "include.hpp"
 #include "config.hpp"
 #include "library.hpp"
+#include "extractor.hpp"
+#include "segmenter.hpp"
+#include "sentence_store.hpp"
+#include "aho_corasick.hpp"
+#include "review_queue.hpp"
+#include "learning_events.hpp"
+#include "event_log.hpp"
+#include "pronunciation_store.hpp"
+#include "query_cache.hpp"
+#include "snapshot.hpp"
+#include "write_queue.hpp"
+#include "load_task.hpp"
+#include "directory_scan.hpp"
+#include "checksum_index.hpp"
+#include "file_watcher.hpp"
+#include "dictionary_image.hpp"
 
 namespace miao::core
 {
@@ -45,6 +61,19 @@ namespace miao::core
 		}
 		~system()
 		{
+			unwatch();
+			stop_loader();
+			if (_snapshot.load())
+			{
+				try
+				{
+					commit_counters(); // 上次提交后的学习计数写回 item，与事件日志一致。
+				}
+				catch (const std::exception&) // 析构函数不能抛出异常。
+				{
+				}
+			}
+			_writer.flush(); // 写入所有延迟的文件。
 			__address_instance = nullptr;
 		}
 		system(const system&) = delete;
@@ -58,8 +87,10 @@ namespace miao::core
 		/// </summary>
 		void construct()
 		{
-			auto cfg = config::view();
-			set_working_dir(cfg->working_dir());
+			set_working_dir(config::current()->working_dir);
+
+			// 汇总后的学习事件追加到各个库的事件日志中。
+			_events.add_sink([this](const std::vector<learning_event>& events) { log_events(events); });
 		}
 
 	private:
@@ -100,6 +131,13 @@ namespace miao::core
 		{
 			return root_dir() / "sentence";
 		}
+		/// <returns>
+		/// 工作目录/miao_dict/image。
+		/// </returns>
+		std::filesystem::path image_dir() const
+		{
+			return root_dir() / "image";
+		}
 
 	private:
 		/// <summary>
@@ -147,16 +185,42 @@ namespace miao::core
 			return true;
 		}
 		/// <summary>
-		/// 列出目录下所有的 json 文件，按字典序排序。不会递归搜索。
+		/// 目录下的一个编号文件。
+		/// </summary>
+		struct numbered_file
+		{
+			id_t id{};
+			std::filesystem::path path;
+			bool sharded{}; // 是否在分片目录中。
+		};
+		/// <summary>
+		/// 列出目录下所有形如 "id.json" 的文件，包括分片目录（名字为两位十六进制数字的子目录）中的文件，按 id 从小到大排序。同一 id 同时存在于目录和分片目录中时，只保留分片目录中的。如果无法读取目录，抛出 std::runtime_error 异常。
 		/// </summary>
 		/// <param name="path">目录。</param>
-		static std::vector<std::filesystem::path> list_json_files(std::filesystem::path path)
+		static std::vector<numbered_file> list_numbered_files(const std::filesystem::path& path)
 		{
-			std::vector<std::filesystem::path> ret;
-			for (auto& p : std::filesystem::directory_iterator(path))
-				if (!p.is_directory() && p.path().extension() == ".json")
-					ret.push_back(p.path());
-			std::sort(ret.begin(), ret.end());
+			std::vector<numbered_file> ret;
+			for (const auto& e : directory_scan::list(path))
+			{
+				if (!e.is_directory)
+				{
+					if (auto id = directory_scan::parse_numbered(e.name, ".json"))
+						ret.push_back({ *id, path / e.name, false });
+					continue;
+				}
+				if (!directory_scan::is_shard_name(e.name))
+					continue;
+				auto shard = path / e.name;
+				for (const auto& se : directory_scan::list(shard))
+					if (!se.is_directory)
+						if (auto id = directory_scan::parse_numbered(se.name, ".json"))
+							ret.push_back({ *id, shard / se.name, true });
+			}
+			std::sort(ret.begin(), ret.end(), [](const numbered_file& a, const numbered_file& b)
+				{
+					return a.id != b.id ? a.id < b.id : a.sharded > b.sharded;
+				});
+			ret.erase(std::unique(ret.begin(), ret.end(), [](const numbered_file& a, const numbered_file& b) { return a.id == b.id; }), ret.end());
 			return ret;
 		}
 		/// <summary>
@@ -166,12 +230,86 @@ namespace miao::core
 		static std::vector<std::filesystem::path> list_directories(std::filesystem::path path)
 		{
 			std::vector<std::filesystem::path> ret;
-			for (auto& p : std::filesystem::directory_iterator(path))
-				if (p.is_directory())
-					ret.push_back(p.path());
+			for (const auto& e : directory_scan::list(path))
+				if (e.is_directory)
+					ret.push_back(path / e.name);
 			std::sort(ret.begin(), ret.end());
 			return ret;
 		}
+		/// <summary>
+		/// 创建目录下的所有分片目录，并把不在分片目录中的编号文件移动到对应的分片目录中。如果分片目录中已经有同一 id 的文件，删除目录中的文件：分片后只会写入分片目录，分片目录中的总是较新的。
+		/// </summary>
+		/// <param name="path">目录。</param>
+		/// <returns>全部成功返回 true，否则返回 false。失败时已经移动的文件仍然可以被 list_numbered_files 列出。</returns>
+		static bool shard_directory(const std::filesystem::path& path)
+		{
+			try
+			{
+				atomic_file::directory_batch batch;
+				for (id_t i = 0; i < 256; i++)
+					if (!demand_directory(path / directory_scan::shard_name(i)))
+						return false;
+				for (const auto& e : directory_scan::list(path))
+				{
+					if (e.is_directory)
+						continue;
+					auto id = directory_scan::parse_numbered(e.name, ".json");
+					if (!id)
+						continue;
+					auto shard = path / directory_scan::shard_name(*id);
+					std::error_code ec;
+					if (std::filesystem::exists(shard / e.name, ec))
+						std::filesystem::remove(path / e.name, ec);
+					else
+						std::filesystem::rename(path / e.name, shard / e.name, ec); // 同一文件系统中的重命名是原子的。
+					if (ec)
+						return false;
+					batch.add(shard);
+				}
+				batch.add(path);
+				return batch.commit();
+			}
+			catch (const std::runtime_error&)
+			{
+				return false;
+			}
+		}
+	public:
+		/// <summary>
+		/// 库的 item 和片段文件的总数达到这个值时，在加载时改为分片保存：文件保存在 items/ab/12345.json 这样的位置，其中 ab 是 id 的最低字节的十六进制表示，每个目录中的文件个数减少到约 1/256。分片后不会改回。
+		/// </summary>
+		size_t shard_threshold{ 4096 };
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="kind">"items" 或 "passages"。</param>
+		/// <param name="id">item 或片段的 id。</param>
+		/// <param name="sharded">库是否分片保存。</param>
+		/// <returns>
+		/// 库中一个 item 或片段的文件。
+		/// </returns>
+		std::filesystem::path numbered_path(id_t lib_id, std::string_view kind, id_t id, bool sharded) const
+		{
+			auto dir = library_dir(lib_id) / kind;
+			if (sharded)
+				dir /= directory_scan::shard_name(id);
+			return dir / (std::to_string(id) + ".json");
+		}
+		/// <param name="lib_id">库 id。</param>
+		/// <returns>
+		/// 表示库已经分片保存的标记文件。
+		/// </returns>
+		std::filesystem::path sharded_marker(id_t lib_id) const
+		{
+			return library_dir(lib_id) / ".sharded";
+		}
+		/// <param name="lib_id">库 id。</param>
+		/// <returns>
+		/// 库的校验和索引。
+		/// </returns>
+		std::filesystem::path checksums_path(id_t lib_id) const
+		{
+			return library_dir(lib_id) / "checksums.idx";
+		}
+
 	public:
 		/// <summary>
 		/// 在文件系统中初始化 miao_dict 系统。仅在第一次使用 miao_dict 时调用。如果重复调用且 force 指定为 true，只保证已经存在的系统不受影响，不保证文件夹下其他文件不受影响。
@@ -198,69 +336,377 @@ namespace miao::core
 			return true;
 		}
 
+	public:
+		/// <summary>
+		/// 已加载的库的不可变快照。取得后可以在任意线程中读取，不受之后的加载和修改影响。
+		/// </summary>
+		struct library_set
+		{
+			std::map<id_t, std::shared_ptr<const library>> libraries; // 库 id 到库的映射。总存在一个本地库。
+			std::map<id_t, std::shared_ptr<const headword_index>> headwords; // 各个库的词形索引。
+			std::map<id_t, std::shared_ptr<pronunciation_store>> pronunciations; // 各个库的语音库。无法打开的不在其中。
+			std::map<id_t, std::shared_ptr<std::mutex>> locks; // 各个库的写锁，在快照之间共享。
+			std::set<id_t> sharded; // item 和片段分片保存的库。
+
+			/// <returns>
+			/// 库。如果不存在，返回 nullptr。
+			/// </returns>
+			[[nodiscard]] const library* find(id_t lib_id) const
+			{
+				auto it = libraries.find(lib_id);
+				return it == libraries.end() ? nullptr : it->second.get();
+			}
+			/// <returns>
+			/// item。如果库或 item 不存在，返回 nullptr。
+			/// </returns>
+			[[nodiscard]] const item* find(id_t lib_id, id_t item_id) const
+			{
+				auto lib = find(lib_id);
+				if (!lib)
+					return nullptr;
+				auto it = lib->items.find(item_id);
+				return it == lib->items.end() ? nullptr : &it->second;
+			}
+		};
+
 	private:
 		/// <summary>
-		/// 库 id 到库引用的映射。如果加载成功，这个映射一定非空，因为总存在一个本地库。该变量作为系统是否已初始化的判断依据。
+		/// 延迟写入的文件。修改在内存中生效后，对应的文件在后台线程中写入，调用者不需要等待磁盘。需要在其他成员之后析构，以便写入所有文件。
+		/// </summary>
+		write_queue _writer;
+		/// <summary>
+		/// 当前的快照。加载和修改都在新的快照上进行（只复制被修改的库），完成后整体替换，因此读者不会看到修改了一半的库，也不需要等待写者。旧的快照在最后一个读者释放后回收。为空表示还没有加载，该变量作为系统是否已初始化的判断依据。
+		/// </summary>
+		atomic_shared_ptr<const library_set> _snapshot;
+		/// <summary>
+		/// 加载和创建库时独占地持有，修改库时共享地持有。修改不同的库时只持有各自的写锁，可以并行进行。
+		/// </summary>
+		mutable std::shared_mutex _structure_mutex;
+
+		/// <summary>
+		/// 一个库的写者。共享地持有 _structure_mutex，并持有库的写锁。
+		/// </summary>
+		struct library_writer
+		{
+			std::shared_lock<std::shared_mutex> structure;
+			std::shared_ptr<std::mutex> mutex;
+			std::unique_lock<std::mutex> lock;
+			std::shared_ptr<const library_set> snap; // 取得写锁后的快照，其中的这个库在释放写锁前不会被其他写者替换。
+			const library* lib{}; // 为空表示库不存在，此时不持有库的写锁。
+		};
+		/// <summary>
+		/// 开始修改一个库。正在加载的库等到新读取的库加入快照后再修改，这样修改不会被读取前的内容覆盖，也不会写入分片前的路径。如果还没有加载，抛出 std::runtime_error 异常。
 		/// </summary>
-		std::map<id_t, std::shared_ptr<library>> libraries;
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="caller">调用者的名字，用于异常信息。</param>
+		library_writer begin_write(id_t lib_id, const char* caller)
+		{
+			library_writer w;
+			w.structure = std::shared_lock<std::shared_mutex>(_structure_mutex);
+			_loaded_cv.wait(w.structure, [this, lib_id]() { return !_pending_libraries.count(lib_id); });
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error(std::string("call load() before ") + caller + ".");
+			auto it = snap->locks.find(lib_id);
+			if (it == snap->locks.end())
+				return w;
+			w.mutex = it->second;
+			w.lock = std::unique_lock<std::mutex>(*w.mutex);
+			w.snap = _snapshot.load(); // 等待写锁期间可能发布了新的版本。
+			w.lib = w.snap->find(lib_id);
+			return w;
+		}
+		/// <summary>
+		/// 发布只替换了一个库的快照。需要持有这个库的写锁。其他库的写者可能同时发布，因此在最新的快照上替换，失败时重试。
+		/// </summary>
+		/// <param name="lib">新的库。</param>
+		/// <param name="words">新的词形索引。为空表示不变。</param>
+		void publish_library(std::shared_ptr<const library> lib, std::shared_ptr<const headword_index> words = nullptr)
+		{
+			auto cur = _snapshot.load();
+			while (true)
+			{
+				auto next = std::make_shared<library_set>(*cur);
+				if (words)
+					next->headwords[lib->id] = words;
+				next->libraries[lib->id] = lib;
+				if (_snapshot.compare_exchange(cur, std::move(next)))
+					return;
+			}
+		}
+		/// <returns>
+		/// 库的词形索引。
+		/// </returns>
+		static std::shared_ptr<const headword_index> make_headwords(const library& lib)
+		{
+			auto ret = std::make_shared<headword_index>();
+			ret->add_library(lib);
+			return ret;
+		}
 	public:
+		/// <returns>
+		/// 当前的快照。如果还没有加载，返回空指针。
+		/// </returns>
+		std::shared_ptr<const library_set> snapshot() const
+		{
+			return _snapshot.load();
+		}
 		/// <summary>
-		/// 加载所有库和附属信息到内存中。如果这个对象已经加载的信息非空，则无论函数是否成功，都将被全部抛弃。
+		/// 加载所有库和附属信息到内存中，在当前线程中进行，结束后返回。本地库总是最先可用，其他库逐个加入快照，加载期间读者可以使用已经加载的库。加载失败时之前加载的信息被抛弃。
 		/// </summary>
 		/// <returns>如果加载成功，返回 true；否则返回 false。</returns>
 		bool load()
 		{
-			// 创建基本的文件夹。
-			if (!init(true))
-				return false;
+			load_task task;
+			return run_load(task);
+		}
+		/// <summary>
+		/// 在后台线程中加载所有库和附属信息。每个库在读取完成后立即加入快照，可以开始使用，不需要等待其他库。之前还没有结束的加载会被取消。
+		/// </summary>
+		/// <param name="callback">进度的回调，在加载线程中调用。</param>
+		/// <returns>加载的句柄，可以用于查询进度、等待或取消。</returns>
+		std::shared_ptr<load_task> load_async(load_task::callback_t callback = {})
+		{
+			std::lock_guard<std::mutex> lock(_loader_mutex);
+			if (_loading)
+				_loading->cancel();
+			if (_loader.joinable())
+				_loader.join();
+
+			auto task = std::make_shared<load_task>(std::move(callback));
+			_loading = task;
+			_loader = std::thread([this, task]() { run_load(*task); });
+			return task;
+		}
 
-			// 抛弃全部已经加载到内存中的库及附属信息。
-			libraries.clear();
+	private:
+		std::mutex _loader_mutex; // 保护 _loading 和 _loader。
+		std::shared_ptr<load_task> _loading; // 最近一次异步加载。
+		std::thread _loader; // 异步加载的线程。
+		std::mutex _load_mutex; // 加载之间互斥。
+		std::set<id_t> _pending_libraries; // 正在加载、还没有加入快照的库，不能修改。由 _structure_mutex 保护。
+		std::condition_variable_any _loaded_cv; // _pending_libraries 中有库被移除。
 
-			// 加载本地库。
-			if (!demand_library(0))
-				return false;
-			libraries[0] = std::make_shared<library>(load_library(0));
-			libraries[0]->lang = config::view()->preferred_lang();
-			libraries[0]->tag = U"local";
-			libraries[0]->to_file(library_dir(0) / "library.json");
+		/// <summary>
+		/// 取消并等待异步加载。
+		/// </summary>
+		void stop_loader()
+		{
+			std::lock_guard<std::mutex> lock(_loader_mutex);
+			if (_loading)
+				_loading->cancel();
+			if (_loader.joinable())
+				_loader.join();
+		}
+		/// <summary>
+		/// 把一个已经读取的库加入快照，并加入匹配、复习、学习计数和事件日志。
+		/// </summary>
+		/// <param name="lib">库。</param>
+		/// <param name="first">是否是这次加载的第一个库（本地库）。如果是，替换之前加载的所有信息。</param>
+		void publish_loaded(std::shared_ptr<const library> lib, bool first)
+		{
+			id_t id = lib->id;
+			auto words = make_headwords(*lib);
+			auto store = std::make_shared<pronunciation_store>();
+			if (!store->open(library_dir(id) / "pronunciations"))
+				store.reset();
+			auto log = std::make_shared<event_log>();
+			if (!log->open(library_dir(id) / "events", id))
+				log.reset();
+			bool sharded = std::filesystem::exists(sharded_marker(id));
+
+			std::unique_lock<std::shared_mutex> lock(_structure_mutex);
+			auto next = first ? std::make_shared<library_set>() : std::make_shared<library_set>(*_snapshot.load());
+			next->libraries[id] = lib;
+			next->headwords[id] = std::move(words);
+			next->locks[id] = std::make_shared<std::mutex>();
+			if (sharded)
+				next->sharded.insert(id);
+			else
+				next->sharded.erase(id);
+			if (store)
+				next->pronunciations[id] = std::move(store);
 
-			// 加载其他库。
-			auto lib_dirs = list_directories(library_dir());
-			for (const auto& p : lib_dirs)
+			// 在后台构造匹配所有词的自动机。
+			if (first)
+				_matcher.clear();
+			_matcher.add_library(*lib);
+
+			// 安排已经开始复习的词。
 			{
-				id_t id{};
-				try
+				std::lock_guard<std::mutex> lock(_reviews_mutex);
+				if (first)
+					_reviews = review_queue(now_ms());
+				for (const auto& [item_id, it] : lib->items)
+					if (it.review_due)
+						_reviews.schedule({ id, item_id }, it.review_due);
+			}
+
+			// 以文件中的计数作为学习计数的初始值。
+			_events.seed(*lib);
+
+			// 丢弃按旧的库构造的分词器。
+			{
+				std::lock_guard<std::mutex> lock(_segmenters_mutex);
+				if (first)
+					_segmenters.clear();
+				else
+					_segmenters.erase(id);
+			}
+
+			// 打开事件日志。
+			{
+				std::lock_guard<std::mutex> lock(_logs_mutex);
+				if (first)
+					_logs.clear();
+				if (log)
+					_logs[id] = std::move(log);
+			}
+
+			// 发布新的快照，之后作废受影响的查询结果。
+			_pending_libraries.erase(id);
+			_snapshot.store(std::move(next));
+			if (first)
+				_queries.clear();
+			else
+				_queries.invalidate_library(id);
+			_loaded_cv.notify_all();
+		}
+		/// <summary>
+		/// 加载所有库。结束时调用 task.finish。
+		/// </summary>
+		bool run_load(load_task& task)
+		{
+			std::lock_guard<std::mutex> load_lock(_load_mutex);
+			bool published = false;
+			auto finish = [this, &task](bool success)
+			{
+				std::unique_lock<std::shared_mutex> lock(_structure_mutex);
+				_pending_libraries.clear();
+				lock.unlock();
+				_loaded_cv.notify_all();
+				task.finish(success);
+				return success;
+			};
+			auto fail = [this, &finish]()
+			{
+				std::unique_lock<std::shared_mutex> lock(_structure_mutex);
+				_snapshot.store(nullptr);
+				lock.unlock();
+				return finish(false);
+			};
+
+			try
+			{
+				task.start(load_stage::prepare, 0, 0);
+
+				// 之前登记的文件写入后才能读取。
+				_writer.flush();
+
+				// 创建基本的文件夹。
+				if (!init(true))
+					return fail();
+
+				// 打开句子库。
+				if (!_sentences.open(sentence_dir()))
+					return fail();
+
+				// 列出所有库，本地库在最前。
+				std::vector<id_t> ids{ 0 };
+				for (const auto& p : list_directories(library_dir()))
 				{
-					id = std::stoi(p.filename());
+					auto id = directory_scan::parse_numbered(p.filename().native(), "");
+					if (id && *id && p.filename() == std::to_string(*id)) // 不是库 id 的目录名（如 "007"）被跳过。
+						ids.push_back(*id);
 				}
-				catch (const std::invalid_argument&)
+				std::sort(ids.begin() + 1, ids.end());
 				{
-					continue;
+					std::unique_lock<std::shared_mutex> lock(_structure_mutex); // 等待正在进行的修改结束，之后的修改等到库加入快照。
+					_pending_libraries.insert(ids.begin(), ids.end());
 				}
+				_writer.flush(); // 标记前登记的修改写入后才能检查和读取，分片也不会遗留旧路径的文件。
+				task.begin(ids.size());
 
-				if (!id)
-					continue;
-				if (!demand_library(id))
-					continue;
-				libraries[id] = std::make_shared<library>(load_library(id));
+				// 加载本地库。
+				{
+					library_files files;
+					if (!demand_library(0, &task, &files))
+						return fail();
+					auto local = std::make_shared<library>(load_library(0, &task, &files));
+					local->lang = config::current()->preferred_lang;
+					local->tag = U"local";
+					std::shared_ptr<const library> saved = local;
+					_writer.enqueue(library_dir(0) / "library.json", [saved](const std::filesystem::path& p) { saved->to_file(p); });
+					publish_loaded(std::move(saved), true);
+					published = true;
+					task.publish(0);
+				}
+
+				// 加载其他库。
+				for (size_t i = 1; i < ids.size(); i++)
+				{
+					id_t id = ids[i];
+					library_files files;
+					if (!demand_library(id, &task, &files))
+					{
+						std::unique_lock<std::shared_mutex> lock(_structure_mutex);
+						_pending_libraries.erase(id);
+						lock.unlock();
+						_loaded_cv.notify_all();
+						continue;
+					}
+					publish_loaded(std::make_shared<const library>(load_library(id, &task, &files)), false);
+					task.publish(id);
+				}
+			}
+			catch (const load_cancelled&) // 已经加入快照的库仍然可用。本地库还没有加入时，之前加载的信息不变。
+			{
+				return finish(false);
+			}
+			catch (const std::exception&) // 包括 std::bad_alloc 等。加载线程中的异常不能逃出，否则等待的调用者不会被唤醒。
+			{
+				if (published)
+					return finish(false);
+				return fail();
 			}
 
-			return true;
+			return finish(true);
 		}
 
 	private:
+		[[nodiscard]] static std::u8string_view as_u8(std::string_view content)
+		{
+			return { reinterpret_cast<const char8_t*>(content.data()), content.size() };
+		}
+		/// <summary>
+		/// 用 str 原子地重写文件，成功后 content 替换为写入的内容。
+		/// </summary>
+		/// <returns>是否写入成功。失败时文件和 content 都不变。</returns>
+		static bool rewrite(const std::filesystem::path& p, const std::u8string& str, std::string& content)
+		{
+			try
+			{
+				atomic_file::write(p, { reinterpret_cast<const char*>(str.data()), str.length() });
+			}
+			catch (const std::runtime_error&)
+			{
+				return false;
+			}
+			content.assign(reinterpret_cast<const char*>(str.data()), str.length());
+			return true;
+		}
 		/// <summary>
 		/// 要求指定路径是一个合法的存有 item 的文件。该函数会尝试修复文件中缺失的信息（如新版本中的信息），并在尝试修复后会重写这个文件。
 		/// </summary>
 		/// <param name="p">指定路径。</param>
+		/// <param name="content">已经读取的文件内容。重写文件后替换为写入的内容。</param>
 		/// <returns>如果返回 true，则保证此时文件内容能够完全被正确加载。否则返回 false。</returns>
-		bool demand_item(std::filesystem::path p)
+		bool demand_item(const std::filesystem::path& p, std::string& content)
 		{
 			item ti;
 			try
 			{
-				ti.from_file(p);
+				ti.from_string(as_u8(content));
 			}
 			catch (const parse_error&) // 认为该文件损坏，直接失败。
 			{
@@ -276,16 +722,11 @@ namespace miao::core
 			}
 
 			bool need_repair = ti.ver_tag != ti.latest_ver_tag;
-			try
-			{
-				id_t nid = std::stoi(p.filename().replace_extension());
-				need_repair |= ti.id != nid;
-				ti.id = nid; // 修复 id。
-			}
-			catch (const std::invalid_argument&) // 文件名不表示一个有效 id。
-			{
+			auto nid = directory_scan::parse_numbered(p.filename().native(), ".json");
+			if (!nid) // 文件名不表示一个有效 id。
 				return false;
-			}
+			need_repair |= ti.id != *nid;
+			ti.id = *nid; // 修复 id。
 
 			if (ti.ver_tag < 1)
 			{
@@ -293,22 +734,31 @@ namespace miao::core
 					return false;
 				ti.ver_tag = 1;
 			}
+			if (ti.ver_tag < 2) // 还没有开始复习。
+			{
+				ti.ver_tag = 2;
+			}
+			if (ti.ver_tag < 3) // 还没有发音。
+			{
+				ti.ver_tag = 3;
+			}
 
-			if (need_repair)
-				ti.to_file(p); // 重写入。
+			if (need_repair && !rewrite(p, ti.to_string(), content)) // 重写入。无法写入时文件仍然是原来的内容。
+				return false;
 			return true;
 		}
 		/// <summary>
 		/// 要求指定路径是一个合法的存有 passage 的文件。该函数会尝试修复文件中缺失的信息（如新版本中的信息），并在尝试修复后会重写这个文件。
 		/// </summary>
 		/// <param name="p">指定路径。</param>
+		/// <param name="content">已经读取的文件内容。重写文件后替换为写入的内容。</param>
 		/// <returns>如果返回 true，则保证此时文件内容能够完全被正确加载。否则返回 false。</returns>
-		bool demand_passage(std::filesystem::path p)
+		bool demand_passage(const std::filesystem::path& p, std::string& content)
 		{
 			passage tp;
 			try
 			{
-				tp.from_file(p);
+				tp.from_string(as_u8(content));
 			}
 			catch (const parse_error&) // 认为该文件损坏，直接失败。
 			{
@@ -324,16 +774,11 @@ namespace miao::core
 			}
 
 			bool need_repair = tp.ver_tag != tp.latest_ver_tag;
-			try
-			{
-				id_t nid = std::stoi(p.filename().replace_extension());
-				need_repair |= tp.id != nid;
-				tp.id = nid; // 修复 id。
-			}
-			catch (const std::invalid_argument&) // 文件名不表示一个有效 id。
-			{
+			auto nid = directory_scan::parse_numbered(p.filename().native(), ".json");
+			if (!nid) // 文件名不表示一个有效 id。
 				return false;
-			}
+			need_repair |= tp.id != *nid;
+			tp.id = *nid; // 修复 id。
 
 			if (tp.ver_tag < 1)
 			{
@@ -346,28 +791,23 @@ namespace miao::core
 				tp.ver_tag = 2;
 			}
 
-			if (need_repair)
-				tp.to_file(p); // 重写入。
+			if (need_repair && !rewrite(p, tp.to_string(), content)) // 重写入。无法写入时文件仍然是原来的内容。
+				return false;
 			return true;
 		}
 		/// <summary>
 		/// 要求指定路径是一个合法的存有 raw_item 的文件。该函数会尝试修复文件中缺失的信息，并在尝试修复后会重写这个文件。
 		/// </summary>
 		/// <param name="p">指定路径。</param>
+		/// <param name="content">已经读取的文件内容。重写文件后替换为写入的内容。</param>
 		/// <returns>如果返回 true，则保证此时文件内容能够完全被正确加载。否则返回 false。</returns>
-		bool demand_raw_items(std::filesystem::path p)
+		bool demand_raw_items(const std::filesystem::path& p, std::string& content)
 		{
 			Json::Value v;
 			bool need_repair = false;
 			try
 			{
-				std::ifstream ifs(p);
-				ifs.seekg(0, std::ios::end);
-				size_t len = ifs.tellg();
-				ifs.seekg(0, std::ios::beg);
-				std::vector<char8_t> buf(len + 1);
-				ifs.read(reinterpret_cast<char*>(buf.data()), len);
-				v = Json::read(buf.data());
+				v = Json::read(as_u8(content));
 			}
 			catch (...) // 无法解析。
 			{
@@ -409,25 +849,22 @@ namespace miao::core
 				}
 			}
 
-			if (need_repair) // 重写入。
-			{
-				std::ofstream fs(p);
-				std::u8string str = Json::write(v);
-				fs.write(reinterpret_cast<char*>(str.data()), str.length());
-			}
+			if (need_repair && !rewrite(p, Json::write(v), content)) // 重写入。
+				return false;
 			return true;
 		}
 		/// <summary>
 		/// 要求指定路径是一个合法的存有库配置的文件。该函数会尝试修复文件中缺失的信息，并在尝试修复后会重写这个文件。
 		/// </summary>
 		/// <param name="p">指定路径。</param>
+		/// <param name="content">已经读取的文件内容。重写文件后替换为写入的内容。</param>
 		/// <returns>如果返回 true，则保证此时文件内容能够完全被正确加载。否则返回 false。</returns>
-		bool demand_library_config(std::filesystem::path p)
+		bool demand_library_config(const std::filesystem::path& p, std::string& content)
 		{
 			library tl;
 			try
 			{
-				tl.from_file(p);
+				tl.from_string(as_u8(content));
 			}
 			catch (const parse_error&) // 认为该文件损坏，重新创建。
 			{
@@ -443,16 +880,11 @@ namespace miao::core
 			}
 
 			bool need_repair = tl.ver_tag != tl.latest_ver_tag;
-			try
-			{
-				id_t nid = std::stoi(p.parent_path().filename());
-				need_repair |= tl.id != nid;
-				tl.id = nid; // 修复 id。
-			}
-			catch (const std::invalid_argument&) // 路径名不表示一个有效 id。
-			{
+			auto nid = directory_scan::parse_numbered(p.parent_path().filename().native(), "");
+			if (!nid) // 路径名不表示一个有效 id。
 				return false;
-			}
+			need_repair |= tl.id != *nid;
+			tl.id = *nid; // 修复 id。
 
 			if (tl.ver_tag < 1)
 			{
@@ -461,16 +893,28 @@ namespace miao::core
 				tl.ver_tag = 1;
 			}
 
-			if (need_repair)
-				tl.to_file(p); // 重写入。
+			if (need_repair && !rewrite(p, tl.to_string(), content)) // 重写入。无法写入时文件仍然是原来的内容。
+				return false;
 			return true;
 		}
+	public:
+		/// <summary>
+		/// 检查通过的库文件的内容，由 demand_library 读取，交给 load_library 解析，这样加载时每个文件只读取一次。
+		/// </summary>
+		struct library_files
+		{
+			std::vector<std::pair<id_t, std::string>> items, passages; // 按 id 从小到大排序。
+			std::string raw_items, config;
+		};
+	private:
 		/// <summary>
 		/// 要求指定路径是一个合法的库路径。该函数会尝试修复库中缺失的信息（如缺失的目录、文件）。
 		/// </summary>
 		/// <param name="id">指定路径</param>
+		/// <param name="task">加载的句柄，用于报告进度和取消。可以为空。</param>
+		/// <param name="files">检查通过的文件的内容写入这里。可以为空。</param>
 		/// <returns>如果返回 true，则保证此时库能够完全被正确加载。否则返回 false。</returns>
-		bool demand_library(id_t id)
+		bool demand_library(id_t id, load_task* task = nullptr, library_files* files = nullptr)
 		{
 			auto lib_dir = library_dir(id);
 			if (!demand_directory(lib_dir))
@@ -481,46 +925,114 @@ namespace miao::core
 				return false;
 			if (!demand_directory(lib_dir / "passages"))
 				return false;
+			if (!demand_directory(lib_dir / "events"))
+				return false;
 
 			if (!demand_file(lib_dir / "raw_items.json"))
 				return false;
 			if (!demand_file(lib_dir / "library.json"))
 				return false;
 
-			auto items_path = list_json_files(lib_dir / "items");
-			for (const auto& p : items_path)
-				demand_item(p);
+			std::vector<numbered_file> items_files, passages_files;
+			try
+			{
+				items_files = list_numbered_files(lib_dir / "items");
+				passages_files = list_numbered_files(lib_dir / "passages");
+
+				// 文件较多时改为分片保存。中途失败时，下次加载会继续移动剩下的文件。
+				bool sharded = std::filesystem::exists(sharded_marker(id));
+				if (sharded || items_files.size() + passages_files.size() >= shard_threshold)
+				{
+					auto flat = [](const numbered_file& f) { return !f.sharded; };
+					bool moved = std::any_of(items_files.begin(), items_files.end(), flat) || std::any_of(passages_files.begin(), passages_files.end(), flat);
+					if (!shard_directory(lib_dir / "items") || !shard_directory(lib_dir / "passages"))
+						return false;
+					if (!sharded)
+						atomic_file::write(sharded_marker(id), {});
+					if (moved)
+					{
+						items_files = list_numbered_files(lib_dir / "items");
+						passages_files = list_numbered_files(lib_dir / "passages");
+					}
+				}
+			}
+			catch (const std::runtime_error&)
+			{
+				return false;
+			}
+			if (task)
+				task->start(load_stage::check, id, items_files.size() + passages_files.size());
+
+			// 与校验和索引一致的文件上次检查时是完好的，只计算校验和，不再解析。其余的文件完整地检查，检查通过后记录到新的索引中。
+			// 每个文件只读取一次：修复从读到的内容开始，重写后 content 就是新的内容。
+			checksum_index previous, checked;
+			previous.load(checksums_path(id));
+			std::string content;
+			auto check = [&](checksum_index::file_kind kind, id_t file_id, const std::filesystem::path& p, int ver_tag, auto&& demand)
+			{
+				if (!checksum_index::read_file(p, content))
+					content.clear(); // 按空文件检查，能否修复由 demand 决定。
+				else if (previous.verify(kind, file_id, content, ver_tag))
+				{
+					checked.record(kind, file_id, content, ver_tag);
+					return true;
+				}
+				if (!demand(p, content))
+					return false;
+				checked.record(kind, file_id, content, ver_tag);
+				return true;
+			};
+
+			for (const auto& f : items_files)
+			{
+				if (task)
+					task->step();
+				if (check(checksum_index::file_kind::item, f.id, f.path, item::latest_ver_tag, [this](const std::filesystem::path& p, std::string& c) { return demand_item(p, c); }) && files)
+					files->items.emplace_back(f.id, std::move(content));
+			}
 
-			auto passages_path = list_json_files(lib_dir / "passages");
-			for (const auto& p : passages_path)
-				demand_passage(p);
+			for (const auto& f : passages_files)
+			{
+				if (task)
+					task->step();
+				if (check(checksum_index::file_kind::passage, f.id, f.path, passage::latest_ver_tag, [this](const std::filesystem::path& p, std::string& c) { return demand_passage(p, c); }) && files)
+					files->passages.emplace_back(f.id, std::move(content));
+			}
 
-			if (!demand_raw_items(lib_dir / "raw_items.json"))
+			if (!check(checksum_index::file_kind::raw_items, 0, lib_dir / "raw_items.json", raw_item::latest_ver_tag, [this](const std::filesystem::path& p, std::string& c) { return demand_raw_items(p, c); }))
 				return false;
+			if (files)
+				files->raw_items = std::move(content);
 
-			demand_library_config(lib_dir / "library.json");
+			std::string config;
+			checksum_index::read_file(lib_dir / "library.json", config); // 无法读取时按损坏的文件重新创建。
+			demand_library_config(lib_dir / "library.json", config);
+			if (files)
+				files->config = std::move(config);
+
+			if (checked != previous)
+			{
+				try
+				{
+					checked.save(checksums_path(id));
+				}
+				catch (const std::runtime_error&) // 索引只用于加快检查，无法写入时下次加载完整地检查。
+				{
+				}
+			}
 
 			return true;
 		}
 
 		/// <summary>
-		/// 给定存有 raw_item 的文件，加载所有的 raw_item。如果产生解析错误，会直接抛出异常；对于所有不正常的 raw_item，会直接跳过。需要先调用 demand_raw_items。
+		/// 给定存有 raw_item 的文件内容，加载所有的 raw_item。如果产生解析错误，会直接抛出异常；对于所有不正常的 raw_item，会直接跳过。需要先调用 demand_raw_items。
 		/// </summary>
-		/// <param name="p">指定文件的路径。</param>
+		/// <param name="content">文件的内容。</param>
 		/// <returns>存有 raw_item 的数组。</returns>
-		std::vector<raw_item> load_raw_items(std::filesystem::path p)
+		std::vector<raw_item> load_raw_items(std::string_view content)
 		{
 			std::vector<raw_item> ret;
-			Json::Value v;
-			{
-				std::ifstream ifs(p);
-				ifs.seekg(0, std::ios::end);
-				size_t len = ifs.tellg();
-				ifs.seekg(0, std::ios::beg);
-				std::vector<char8_t> buf(len + 1);
-				ifs.read(reinterpret_cast<char*>(buf.data()), len);
-				v = Json::read(buf.data());
-			}
+			Json::Value v = Json::read(as_u8(content));
 
 			for (Json::ArrayIndex i = 0; i < v["raw_items"].size(); i++)
 			{
@@ -545,25 +1057,51 @@ namespace miao::core
 		/// 加载指定的库。应当先调用 demand_library。
 		/// </summary>
 		/// <param name="id">库 id。</param>
+		/// <param name="task">加载的句柄，用于报告进度和取消。可以为空。</param>
+		/// <param name="files">demand_library 检查通过的文件内容，item 和片段的内容在解析时被移走。为空时从磁盘读取库中的文件。</param>
 		/// <returns>被加载的库对象。</returns>
-		library load_library(id_t id)
+		library load_library(id_t id, load_task* task = nullptr, library_files* files = nullptr)
 		{
 			auto lib_dir = library_dir(id);
 			library ret;
 
-			ret.from_file(lib_dir / "library.json");
+			library_files read;
+			if (!files)
+			{
+				auto read_all = [](const std::vector<numbered_file>& list, std::vector<std::pair<id_t, std::string>>& out)
+				{
+					for (const auto& f : list)
+					{
+						std::string content;
+						if (checksum_index::read_file(f.path, content))
+							out.emplace_back(f.id, std::move(content));
+					}
+				};
+				read_all(list_numbered_files(lib_dir / "items"), read.items);
+				read_all(list_numbered_files(lib_dir / "passages"), read.passages);
+				checksum_index::read_file(lib_dir / "raw_items.json", read.raw_items);
+				checksum_index::read_file(lib_dir / "library.json", read.config);
+				files = &read;
+			}
+
+			ret.from_string(as_u8(files->config));
 
 			ret.items.clear();
-			auto items_path = list_json_files(lib_dir / "items");
-			for (const auto& p : items_path)
+			if (task)
+				task->start(load_stage::read, id, files->items.size() + files->passages.size());
+
+			for (auto& f : files->items)
 			{
+				if (task)
+					task->step();
+				std::string content = std::move(f.second); // 解析后释放。
 				try
 				{
 					item ti;
-					ti.from_file(p);
+					ti.from_string(as_u8(content));
 					if (ti.ver_tag != ti.latest_ver_tag)
 						continue;
-					ret.items[ti.id] = ti;
+					ret.items.insert_or_assign(ti.id, std::move(ti));
 				}
 				catch (...)
 				{
@@ -571,16 +1109,18 @@ namespace miao::core
 				}
 			}
 
-			auto passages_path = list_json_files(lib_dir / "passages");
-			for (const auto& p : passages_path)
+			for (auto& f : files->passages)
 			{
+				if (task)
+					task->step();
+				std::string content = std::move(f.second); // 解析后释放。
 				try
 				{
 					passage tp;
-					tp.from_file(p);
+					tp.from_string(as_u8(content));
 					if (tp.ver_tag != tp.latest_ver_tag)
 						continue;
-					ret.passages.push_back(tp);
+					ret.passages.insert_or_assign(tp.id, std::move(tp));
 				}
 				catch (...)
 				{
@@ -588,11 +1128,25 @@ namespace miao::core
 				}
 			}
 
-			ret.raw_items = load_raw_items(lib_dir / "raw_items.json");
+			auto raw_items = std::make_shared<raw_item_index>();
+			raw_items->set_headwords(ret.items);
+			raw_items->assign(load_raw_items(files->raw_items));
+			ret.raw_items = std::move(raw_items);
 
 			return ret;
 		}
 
+	private:
+		/// <summary>
+		/// 快照和正在加载的库都没有使用的库 id。需要持有 _structure_mutex。
+		/// </summary>
+		id_t free_library_id(const library_set& snap) const
+		{
+			id_t ret = snap.libraries.crbegin()->first + 1;
+			if (!_pending_libraries.empty())
+				ret = std::max(ret, *_pending_libraries.crbegin() + 1);
+			return ret;
+		}
 	public:
 		/// <summary>
 		/// 返回一个未使用的库 id。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
@@ -600,9 +1154,39 @@ namespace miao::core
 		/// <returns></returns>
 		id_t get_free_library_id() const
 		{
-			if (libraries.empty())
+			std::shared_lock<std::shared_mutex> lock(_structure_mutex);
+			auto snap = _snapshot.load();
+			if (!snap)
 				throw std::runtime_error("call load() before get_free_library_id.");
-			return libraries.crbegin()->first + 1;
+			return free_library_id(*snap);
+		}
+		/// <summary>
+		/// 获取已加载的库，用于构造调度器等只读的用途。返回的库不会再被修改，之后的修改在新的库对象上进行。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="id">库 id。</param>
+		/// <returns>库对象。如果库不存在，返回 nullptr。</returns>
+		std::shared_ptr<const library> get_library(id_t id) const
+		{
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error("call load() before get_library.");
+			auto it = snap->libraries.find(id);
+			if (it == snap->libraries.end())
+				return nullptr;
+			return it->second;
+		}
+		/// <summary>
+		/// 列出所有已加载的库的 id，升序。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		std::vector<id_t> library_ids() const
+		{
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error("call load() before library_ids.");
+			std::vector<id_t> ret;
+			for (const auto& [id, lib] : snap->libraries)
+				ret.push_back(id);
+			return ret;
 		}
 		/// <summary>
 		/// 创建指定 id 的空库，如果库已经存在则失败。会生成所需要的文件。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
@@ -610,19 +1194,21 @@ namespace miao::core
 		/// <param name="id">库 id。如果是 std::nullopt，则使用 get_free_library_id 的结果。</param>
 		/// <param name="lang">语言标签。</param>
 		/// <param name="tag">库名。</param>
-		/// <returns>成功返回 true，失败返回 false。成功后，可以通过 libraries 进行访问。</returns>
+		/// <returns>成功返回 true，失败返回 false。成功后，可以通过 snapshot 进行访问。</returns>
 		bool create_library(std::optional<id_t> id, std::u32string_view lang, std::u32string_view tag)
 		{
-			if (libraries.empty())
+			std::unique_lock<std::shared_mutex> lock(_structure_mutex);
+			auto snap = _snapshot.load();
+			if (!snap)
 				throw std::runtime_error("call load() before create_library.");
 
 			library tl;
 			if (id)
 				tl.id = *id;
 			else
-				tl.id = get_free_library_id();
+				tl.id = free_library_id(*snap);
 
-			if (libraries.count(tl.id))
+			if (snap->libraries.count(tl.id) || _pending_libraries.count(tl.id)) // 正在加载的库也不能重新创建。
 				return false;
 
 			tl.lang = lang;
@@ -631,13 +1217,99 @@ namespace miao::core
 			if (!demand_library(tl.id))
 				return false;
 
-			tl.to_file(library_dir(tl.id) / "library.json");
+			_writer.enqueue_object(library_dir(tl.id) / "library.json", tl);
 
-			libraries[tl.id] = std::make_shared<library>(std::move(tl));
+			auto next = std::make_shared<library_set>(*snap);
+			auto store = std::make_shared<pronunciation_store>();
+			if (store->open(library_dir(tl.id) / "pronunciations"))
+				next->pronunciations[tl.id] = std::move(store);
+			{
+				std::lock_guard<std::mutex> lock(_logs_mutex);
+				auto log = std::make_shared<event_log>();
+				if (log->open(library_dir(tl.id) / "events", tl.id))
+					_logs[tl.id] = std::move(log);
+			}
+			id_t lib_id = tl.id;
+			next->headwords[lib_id] = std::make_shared<const headword_index>();
+			next->locks[lib_id] = std::make_shared<std::mutex>();
+			next->libraries[lib_id] = std::make_shared<const library>(std::move(tl));
+			_snapshot.store(std::move(next));
+			_queries.invalidate_library(lib_id);
 			return true;
 		}
 
-	public:
+	private:
+		/// <summary>
+		/// 新建、替换或移除库中的若干 item，写入文件，之后发布包含新的库的快照。
+		/// </summary>
+		/// <param name="w">库的写者。</param>
+		/// <param name="items">item 对象。</param>
+		/// <param name="removed">移除的 item 的 id。</param>
+		/// <param name="save">是否写入 item 的文件。从文件中重新读取的 item 不需要写回。</param>
+		/// <returns>库存在返回 true，否则返回 false。</returns>
+		bool update_items_locked(const library_writer& w, const std::vector<item>& items, const std::vector<id_t>& removed = {}, bool save = true)
+		{
+			if (!w.lib)
+				return false;
+			if (items.empty() && removed.empty())
+				return true;
+
+			id_t lib_id = w.lib->id;
+			auto lib = std::make_shared<library>(*w.lib); // 与旧的库共享内容，只复制被修改的部分。
+			auto words = std::make_shared<headword_index>(*w.snap->headwords.at(lib_id));
+			std::vector<std::pair<id_t, std::vector<std::u32string>>> removed_forms;
+			for (id_t item_id : removed)
+			{
+				auto prev = lib->items.find(item_id);
+				if (prev == lib->items.end())
+					continue;
+				words->remove(lib_id, prev->second);
+				_matcher.remove(lib_id, item_id);
+				removed_forms.emplace_back(item_id, headword_index::forms_of(prev->second));
+				lib->items.erase(item_id);
+			}
+			std::shared_ptr<raw_item_index> raw_items; // 有新的词时才复制。
+			bool raw_items_changed = false;
+			bool sharded = w.snap->sharded.count(lib_id);
+			for (const auto& it : items)
+			{
+				if (save)
+					_writer.enqueue_object(numbered_path(lib_id, "items", it.id, sharded), it);
+				if (auto prev = lib->items.find(it.id); prev != lib->items.end())
+					words->remove(lib_id, prev->second);
+				lib->items.insert_or_assign(it.id, it);
+				words->add(lib_id, it);
+				_matcher.update(lib_id, it);
+				if (lib->raw_items->covers(it))
+					continue;
+				if (!raw_items)
+					raw_items = std::make_shared<raw_item_index>(*lib->raw_items);
+				raw_items_changed |= raw_items->add_headwords(it); // 新的词不再是 raw_item。
+			}
+			if (raw_items)
+				lib->raw_items = std::move(raw_items);
+			if (raw_items_changed)
+				save_raw_items(lib);
+			{
+				std::lock_guard<std::mutex> lock(_reviews_mutex);
+				for (const auto& it : items)
+					if (it.review_due)
+						_reviews.schedule({ lib_id, it.id }, it.review_due);
+					else
+						_reviews.cancel({ lib_id, it.id });
+				for (const auto& [item_id, forms] : removed_forms)
+					_reviews.cancel({ lib_id, item_id });
+			}
+			_events.seed(lib_id, items); // 汇总器中的总数以新的 item 为准。
+
+			publish_library(std::move(lib), std::move(words));
+			for (const auto& it : items) // 在发布之后作废，之后的查询一定使用新的快照。
+				_queries.invalidate_item(lib_id, it.id, headword_index::forms_of(it));
+			for (const auto& [item_id, forms] : removed_forms)
+				_queries.invalidate_item(lib_id, item_id, forms);
+			return true;
+		}
+	public:
 		/// <summary>
 		/// 新建或替换库中的 item。如果库不存在则失败。会生成所需要的文件。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
 		/// </summary>
@@ -646,17 +1318,745 @@ namespace miao::core
 		/// <returns>成功返回 true，失败返回 false。</returns>
 		bool update_item(id_t lib_id, const item& it)
 		{
-			if (libraries.empty())
-				throw std::runtime_error("call load() before update_item.");
+			return update_items_locked(begin_write(lib_id, "update_item"), { it });
+		}
+		/// <summary>
+		/// 新建或替换库中的若干 item，只复制一次库并发布一次快照。修改多个 item 时应当使用这个函数。修改不同的库可以在不同的线程中并行进行。如果库不存在则失败。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="items">item 对象。</param>
+		/// <returns>成功返回 true，失败返回 false。</returns>
+		bool update_items(id_t lib_id, const std::vector<item>& items)
+		{
+			return update_items_locked(begin_write(lib_id, "update_items"), items);
+		}
+		/// <summary>
+		/// 等待此前所有修改对应的文件写入完成。修改在函数返回时已经对读者可见，但文件在后台写入；需要确保文件已经写入时（例如复制工作目录前）调用。析构时会自动调用。
+		/// </summary>
+		/// <returns>如果自上次调用以来所有写入都成功，返回 true；否则返回 false。</returns>
+		bool flush()
+		{
+			return _writer.flush();
+		}
+		/// <returns>
+		/// 延迟写入的次数、被合并的次数等统计信息。
+		/// </returns>
+		write_queue::stats write_stats() const
+		{
+			return _writer.statistics();
+		}
+
+	private:
+		mutable std::mutex _watcher_mutex; // 保护 _watcher。
+		std::unique_ptr<file_watcher> _watcher; // 监视库目录。为空表示没有监视。
+
+		/// <summary>
+		/// 一个库中被外部修改的文件。
+		/// </summary>
+		struct touched_files
+		{
+			std::map<id_t, std::filesystem::path> items; // item id 到通知中的文件。
+			std::map<id_t, std::filesystem::path> passages; // 片段 id 到通知中的文件。
+			bool raw_items{};
+		};
+		/// <summary>
+		/// 把外部对一个库的文件的修改应用到快照中。只重新读取这些文件；与内存中相同的内容（如本进程写入的文件）和等待本进程写入的文件被跳过，读取的内容不会被写回。
+		/// 读取的 item 的学习计数由 update_items_locked 重新写入汇总器，之后 commit_counters 在外部修改的计数上累加。
+		/// </summary>
+		void reload_files(id_t lib_id, const touched_files& files)
+		{
+			auto w = begin_write(lib_id, "reload_files");
+			if (!w.lib) // 库不在快照中，需要调用 load。
+				return;
+			bool sharded = w.snap->sharded.count(lib_id);
+
+			// 文件被删除或被移动到分片目录时，读取 id 对应的其他位置。都不存在时表示被删除。
+			auto locate = [&](std::string_view kind, id_t id, const std::filesystem::path& p) -> std::optional<std::filesystem::path>
+			{
+				std::error_code ec;
+				for (const auto& candidate : { p, numbered_path(lib_id, kind, id, sharded), numbered_path(lib_id, kind, id, !sharded) })
+					if (std::filesystem::is_regular_file(candidate, ec))
+						return candidate;
+				return std::nullopt;
+			};
+
+			std::vector<item> items;
+			std::vector<id_t> removed_items;
+			for (const auto& [item_id, p] : files.items)
+			{
+				if (_writer.is_pending(numbered_path(lib_id, "items", item_id, sharded))) // 本进程的修改较新。
+					continue;
+				auto current = w.lib->items.find(item_id);
+				auto path = locate("items", item_id, p);
+				if (!path)
+				{
+					if (current != w.lib->items.end())
+						removed_items.push_back(item_id);
+					continue;
+				}
+				item ti;
+				try
+				{
+					ti.from_file(*path);
+				}
+				catch (const std::runtime_error&) // 文件可能还没有写完，写完时会再次收到通知。
+				{
+					continue;
+				}
+				if (ti.ver_tag != ti.latest_ver_tag) // 旧版本的文件在下次加载时修复。
+					continue;
+				ti.id = item_id;
+				if (current != w.lib->items.end() && current->second.to_json() == ti.to_json())
+					continue;
+				items.push_back(std::move(ti));
+			}
+			if (!items.empty() || !removed_items.empty())
+			{
+				update_items_locked(w, items, removed_items, false);
+				w.snap = _snapshot.load(); // 仍然持有写锁，快照中是刚刚发布的库。
+				w.lib = w.snap->find(lib_id);
+			}
+
+			std::shared_ptr<library> lib; // 修改片段或 raw_item 时才复制，复制时共享内容。
+			auto edit = [&]() -> library&
+			{
+				if (!lib)
+					lib = std::make_shared<library>(*w.lib);
+				return *lib;
+			};
+			for (const auto& [passage_id, p] : files.passages)
+			{
+				if (_writer.is_pending(numbered_path(lib_id, "passages", passage_id, sharded)))
+					continue;
+				const auto& passages = w.lib->passages;
+				auto current = passages.find(passage_id);
+				auto path = locate("passages", passage_id, p);
+				if (!path)
+				{
+					if (current != passages.end())
+						edit().passages.erase(passage_id);
+					continue;
+				}
+				passage tp;
+				try
+				{
+					tp.from_file(*path);
+				}
+				catch (const std::runtime_error&)
+				{
+					continue;
+				}
+				if (tp.ver_tag != tp.latest_ver_tag)
+					continue;
+				tp.id = passage_id;
+				if (current != passages.end() && current->second.to_json() == tp.to_json())
+					continue;
+				edit().passages.insert_or_assign(passage_id, std::move(tp));
+			}
+
+			auto raw_items_path = library_dir(lib_id) / "raw_items.json";
+			if (files.raw_items && !_writer.is_pending(raw_items_path))
+			{
+				try
+				{
+					std::string content;
+					checksum_index::read_file(raw_items_path, content); // 无法读取时内容为空，解析失败。
+					auto loaded = load_raw_items(content);
+					std::vector<std::pair<std::u32string, uint_t>> on_disk, in_memory;
+					for (const auto& ri : loaded)
+						on_disk.emplace_back(ri.origin, ri.frequency);
+					w.lib->raw_items->for_each([&in_memory](const std::u32string& origin, uint_t frequency)
+						{
+							in_memory.emplace_back(origin, frequency);
+							return true;
+						});
+					if (on_disk != in_memory)
+					{
+						auto raw_items = std::make_shared<raw_item_index>(*w.lib->raw_items);
+						raw_items->assign(std::move(loaded));
+						edit().raw_items = std::move(raw_items);
+					}
+				}
+				catch (...) // 无法解析，文件可能还没有写完。
+				{
+				}
+			}
+
+			if (lib)
+				publish_library(std::move(lib));
+		}
+		/// <summary>
+		/// 处理监视线程报告的变化。
+		/// </summary>
+		void on_files_changed(const std::vector<file_watcher::change>& changes, bool overflowed)
+		{
+			if (overflowed) // 丢失了部分通知，只能重新加载。
+			{
+				load_async();
+				return;
+			}
+
+			// 库目录/库 id/raw_items.json，库目录/库 id/items(/分片)/id.json，库目录/库 id/passages(/分片)/id.json。
+			std::map<id_t, touched_files> touched;
+			auto root = library_dir();
+			for (const auto& c : changes)
+			{
+				std::vector<std::filesystem::path> parts;
+				for (const auto& part : c.path.lexically_relative(root))
+					parts.push_back(part);
+				if (parts.size() < 2 || parts.size() > 4)
+					continue;
+				auto lib_id = directory_scan::parse_numbered(parts[0].native(), "");
+				if (!lib_id)
+					continue;
+				if (parts.size() == 2)
+				{
+					if (parts[1] == "raw_items.json")
+						touched[*lib_id].raw_items = true;
+					continue;
+				}
+				if (parts[1] != "items" && parts[1] != "passages")
+					continue;
+				if (parts.size() == 4 && !directory_scan::is_shard_name(parts[2].native()))
+					continue;
+				auto id = directory_scan::parse_numbered(parts.back().native(), ".json");
+				if (!id)
+					continue;
+				auto& files = touched[*lib_id];
+				(parts[1] == "items" ? files.items : files.passages)[*id] = c.path;
+			}
+
+			for (const auto& [lib_id, files] : touched)
+			{
+				try
+				{
+					reload_files(lib_id, files);
+				}
+				catch (const std::exception&) // 还没有加载，或无法读取文件。异常不能离开监视线程，否则进程被终止。
+				{
+				}
+			}
+		}
+	public:
+		/// <summary>
+		/// 开始监视库目录，把外部（如其他编辑工具、同步工具）对已加载的库中 item、片段和 raw_items.json 的修改应用到快照中，不需要重新加载。连续的修改被合并，只重新读取变化的文件，不会重新扫描整个目录树。Windows 和 Linux 以外的平台不支持。
+		/// 新建的库和系统丢失通知时需要重新加载；后者会自动开始异步加载。
+		/// </summary>
+		/// <param name="debounce">没有新的修改这么长时间后才应用。</param>
+		/// <returns>成功返回 true；当前平台不支持或无法监视时返回 false。</returns>
+		bool watch(std::chrono::milliseconds debounce = std::chrono::milliseconds(200))
+		{
+			std::lock_guard<std::mutex> lock(_watcher_mutex);
+			_watcher.reset();
+			auto watcher = std::make_unique<file_watcher>();
+			watcher->debounce = debounce;
+			watcher->max_delay = std::max(watcher->max_delay, debounce);
+			bool ok = watcher->start(library_dir(),
+				[this](const std::vector<file_watcher::change>& changes, bool overflowed) { on_files_changed(changes, overflowed); },
+				[](const std::filesystem::path& dir) // 语音库和事件日志不会被外部修改。
+				{
+					auto name = dir.filename();
+					return name != "pronunciations" && name != "events";
+				});
+			if (ok)
+				_watcher = std::move(watcher);
+			return ok;
+		}
+		/// <summary>
+		/// 停止监视库目录。还没有应用的修改被丢弃。
+		/// </summary>
+		void unwatch()
+		{
+			std::lock_guard<std::mutex> lock(_watcher_mutex);
+			_watcher.reset();
+		}
+		[[nodiscard]] bool watching() const
+		{
+			std::lock_guard<std::mutex> lock(_watcher_mutex);
+			return _watcher != nullptr;
+		}
+
+		/// <summary>
+		/// 用当前快照中的所有库生成新的词典映像（dictionary_image），保存在映像目录中。其他进程可以打开映像直接查询，不需要加载。已经打开映像的进程可以通过代数发现新的映像并重新映射。总是应当在加载库后调用，否则抛出 std::runtime_error 异常；无法写入时也抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <returns>新的映像的代数。</returns>
+		uint64_t publish_image()
+		{
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error("call load() before publish_image.");
+			if (!demand_directory(image_dir()))
+				throw std::runtime_error("fail to create the image directory.");
+			return dictionary_image::publish(image_dir(), snap->libraries);
+		}
+
+	private:
+		query_cache _queries; // 查询结果的缓存。
+	public:
+		/// <summary>
+		/// 查询词语。查询和 item 的一般式、变体、注音都经过规范化（大小写、全角半角、空白）后比较，结果被缓存，相同的查询再次进行时只需要一次哈希查找；item 更新或库创建后，受影响的结果会被作废。查询在快照上进行，不等待写者。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="text">查询的内容。</param>
+		/// <param name="lib_ids">查询的库。为空表示所有库。</param>
+		/// <returns>匹配的 item，按库 id 和 item id 排序。翻译中为空的含义由翻译指向的 item 的一般式补全。</returns>
+		query_cache::result_t query(std::u32string_view text, std::vector<id_t> lib_ids = {})
+		{
+			if (!_snapshot.load())
+				throw std::runtime_error("call load() before query.");
 
-			if (!libraries.count(lib_id))
+			auto q = headword_index::normalize(text);
+			auto selection = query_cache::normalize_selection(std::move(lib_ids));
+			if (auto cached = _queries.find(q, selection))
+				return *cached;
+
+			uint64_t generation = _queries.generation_of(q); // 先取得代数再取得快照，之后发布的修改一定会使结果不被写入。
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error("call load() before query.");
+			std::vector<headword_index::key_t> keys;
+			for (const auto& [lib_id, words] : snap->headwords)
+			{
+				if (!selection.empty() && !std::binary_search(selection.begin(), selection.end(), lib_id))
+					continue;
+				const auto& found = words->find(q);
+				keys.insert(keys.end(), found.begin(), found.end());
+			}
+			std::sort(keys.begin(), keys.end());
+			auto hits = std::make_shared<std::vector<query_cache::hit>>();
+			std::vector<headword_index::key_t> dependencies;
+			for (const auto& [lib_id, item_id] : keys)
+			{
+				auto it = snap->find(lib_id, item_id);
+				if (!it)
+					continue;
+
+				query_cache::hit h{ lib_id, *it };
+				dependencies.emplace_back(lib_id, item_id);
+				for (auto& [trans_id, trans_lib_id, tag, meaning] : h.it.translations)
+				{
+					if (!meaning.empty())
+						continue;
+					dependencies.emplace_back(trans_lib_id, trans_id);
+					if (auto ti = snap->find(trans_lib_id, trans_id))
+						meaning = ti->origin;
+				}
+				hits->push_back(std::move(h));
+			}
+			_queries.store(q, selection, generation, hits, std::move(dependencies));
+			return hits;
+		}
+		/// <returns>
+		/// 查询结果缓存的命中次数等统计信息。
+		/// </returns>
+		query_cache::stats query_stats() const
+		{
+			return _queries.statistics();
+		}
+
+	private:
+		std::mutex _reviews_mutex; // 保护 _reviews。
+		review_queue _reviews; // 所有已经开始复习的词。
+	public:
+		review_policy review_rule; // 复习的规则。
+
+		/// <returns>
+		/// 当前时间（自 1970 年起的毫秒数），用于复习的时间。
+		/// </returns>
+		static uint_t now_ms()
+		{
+			return static_cast<uint_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count());
+		}
+		/// <summary>
+		/// 取出已经到期的词。取出的词在复习前不会再次出现。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="max_count">最多取出的个数。</param>
+		/// <returns>到期的词，形如 (lib_id, item_id)，先到期的在前。</returns>
+		std::vector<std::pair<id_t, id_t>> due_items(size_t max_count)
+		{
+			if (!_snapshot.load())
+				throw std::runtime_error("call load() before due_items.");
+
+			std::lock_guard<std::mutex> lock(_reviews_mutex);
+			_reviews.advance(now_ms());
+			std::vector<std::pair<id_t, id_t>> ret;
+			while (ret.size() < max_count)
+			{
+				auto key = _reviews.pop_due();
+				if (!key)
+					break;
+				ret.push_back(*key);
+			}
+			return ret;
+		}
+		/// <summary>
+		/// 记录一次复习的结果，按 review_rule 更新词的复习状态，写入文件并安排下次复习。没有开始复习的词从这次开始复习。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="item_id">item id。</param>
+		/// <param name="remembered">是否记住。</param>
+		/// <returns>成功返回 true，库或 item 不存在返回 false。</returns>
+		bool review_item(id_t lib_id, id_t item_id, bool remembered)
+		{
+			auto w = begin_write(lib_id, "review_item");
+			auto it = w.snap ? w.snap->find(lib_id, item_id) : nullptr;
+			if (!it)
 				return false;
 
-			auto& lib = libraries[lib_id];
-			auto path = library_dir(lib->id) / "items" / (std::to_string(it.id) + ".json");
-			demand_item(path);
-			it.to_file(path);
-			lib->items[it.id] = it;
+			item ti = *it;
+			review_rule.apply(ti, remembered, now_ms());
+			return update_items_locked(w, { ti });
+		}
+
+	private:
+		item_matcher _matcher; // 匹配所有已加载的词。
+	public:
+		/// <returns>
+		/// 匹配所有已加载的库中的词的自动机，用于在文本中标出已知的词。库加载或 item 更新后会在后台重新构造。
+		/// </returns>
+		item_matcher& matcher()
+		{
+			return _matcher;
+		}
+
+	private:
+		std::mutex _logs_mutex; // 保护 _logs。
+		std::map<id_t, std::shared_ptr<event_log>> _logs; // 各个库的事件日志。需要在 _events 之后析构，以便写入最后一批事件。
+
+		/// <summary>
+		/// 在汇总器的后台线程中调用，把事件追加到所属库的日志中。
+		/// </summary>
+		void log_events(const std::vector<learning_event>& events)
+		{
+			std::map<id_t, std::vector<learning_event>> by_lib;
+			for (const auto& e : events)
+				by_lib[e.lib_id].push_back(e);
+
+			std::lock_guard<std::mutex> lock(_logs_mutex);
+			for (const auto& [lib_id, list] : by_lib)
+			{
+				auto it = _logs.find(lib_id);
+				if (it == _logs.end())
+					continue;
+				try
+				{
+					it->second->append(list);
+				}
+				catch (const std::runtime_error&)
+				{
+					// 日志无法写入时只丢失历史，计数仍然由汇总器保存。
+				}
+			}
+		}
+	public:
+		/// <returns>
+		/// 指定库的事件日志，可以用于统计或重新计算计数。如果库不存在或日志无法打开，返回空指针。在 load 后可用。
+		/// </returns>
+		std::shared_ptr<event_log> events_of(id_t lib_id)
+		{
+			std::lock_guard<std::mutex> lock(_logs_mutex);
+			auto it = _logs.find(lib_id);
+			if (it == _logs.end())
+				return nullptr;
+			return it->second;
+		}
+
+	private:
+		event_aggregator _events; // 学习计数的汇总。
+	public:
+		/// <returns>
+		/// 学习事件的汇总器。显示、跳过、查询等计数应当通过它记录，可以在任意线程中不加锁地记录和读取，用 commit_counters 写回文件。在 load 后可用。
+		/// </returns>
+		event_aggregator& events()
+		{
+			return _events;
+		}
+		/// <summary>
+		/// 把上次调用后汇总的学习计数的增量累加到 item 上并写入文件。析构时会调用一次，退出前的计数不会丢失。每个库只发布一次快照，写入一个库时不妨碍其他库的修改。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <returns>写入的 item 的个数。</returns>
+		size_t commit_counters()
+		{
+			if (!_snapshot.load())
+				throw std::runtime_error("call load() before commit_counters.");
+
+			_events.flush();
+			std::map<id_t, std::vector<std::pair<id_t, learning_counters>>> changed;
+			for (const auto& [key, delta] : _events.take_deltas())
+				changed[key.first].emplace_back(key.second, delta);
+
+			size_t ret{};
+			for (const auto& [lib_id, deltas] : changed)
+			{
+				auto w = begin_write(lib_id, "commit_counters");
+				if (!w.lib)
+					continue;
+				std::vector<item> items;
+				for (const auto& [item_id, delta] : deltas)
+				{
+					auto it = w.lib->items.find(item_id);
+					if (it == w.lib->items.end())
+						continue;
+
+					// 只累加增量，item 上其他途径的修改（update_item、外部修改后重新读取）被保留。
+					item ti = it->second;
+					delta.add_to(ti);
+					items.push_back(std::move(ti));
+				}
+				if (update_items_locked(w, items))
+					ret += items.size();
+			}
+			return ret;
+		}
+
+	private:
+		sentence_store _sentences; // 全局句子库。
+	public:
+		/// <returns>
+		/// 全局句子库。在 load 后可用。
+		/// </returns>
+		sentence_store& sentences()
+		{
+			return _sentences;
+		}
+		/// <summary>
+		/// 获取 item 的所有例句及其翻译。所有句子通过一次批量查询从句子库中读取。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="item_id">item id。</param>
+		/// <returns>按 item 中的顺序排列，每个元素形如 (例句, trans_id 库中的翻译)，不存在的内容为空串。如果库或 item 不存在，返回空列表。</returns>
+		std::vector<std::pair<std::u32string, std::u32string>> item_sentences(id_t lib_id, id_t item_id)
+		{
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error("call load() before item_sentences.");
+
+			auto it = snap->find(lib_id, item_id);
+			if (!it)
+				return {};
+
+			std::vector<std::pair<id_t, id_t>> keys;
+			for (const auto& [id, trans_id] : it->sentences)
+			{
+				keys.emplace_back(id, lib_id);
+				keys.emplace_back(id, trans_id);
+			}
+			auto contents = _sentences.get_many(keys);
+			std::vector<std::pair<std::u32string, std::u32string>> ret;
+			for (size_t i = 0; i < contents.size(); i += 2)
+				ret.emplace_back(contents[i].value_or(std::u32string()), contents[i + 1].value_or(std::u32string()));
+			return ret;
+		}
+		/// <summary>
+		/// 将库中所有片段按库的语言切分为句子，加入全局句子库。内容相同的句子只会保存一次。之后把句子关联到句子中出现的本库 item 上（trans_id 为 0，即本地库），并写入被修改的 item。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <returns>成功返回 true，库不存在返回 false。</returns>
+		bool extract_sentences(id_t lib_id)
+		{
+			auto w = begin_write(lib_id, "extract_sentences");
+			if (!w.lib)
+				return false;
+
+			auto lib = std::make_shared<library>(*w.lib);
+			auto ac = _matcher.wait();
+			std::map<id_t, std::set<id_t>> links; // item id 到句子 id 的映射。
+			for (const auto& [passage_id, p] : lib->passages)
+			{
+				std::u32string_view content = p.content;
+				text::split_sentences(content, lib->lang, [&](size_t offset, size_t length)
+					{
+						auto sentence = content.substr(offset, length);
+						id_t sid = _sentences.add(lib->id, sentence);
+						ac->scan(sentence, [&](const aho_corasick::hit& h)
+							{
+								if (h.lib_id == lib->id)
+									links[h.item_id].insert(sid);
+							});
+					});
+			}
+			_sentences.flush();
+
+			std::vector<std::pair<id_t, std::vector<std::u32string>>> forms; // 被修改的 item 的规范形式。
+			for (const auto& [item_id, sids] : links)
+			{
+				auto it = lib->items.find(item_id);
+				if (it == lib->items.end())
+					continue;
+				const auto& sentences = it->second.sentences;
+				std::vector<id_t> added;
+				for (id_t sid : sids)
+					if (std::find_if(sentences.begin(), sentences.end(),
+						[sid](const auto& t) { return std::get<0>(t) == sid; }) == sentences.end())
+						added.push_back(sid);
+				if (added.empty())
+					continue;
+				auto& ti = lib->items.edit(item_id); // 只复制这个 item 和到它的路径。
+				for (id_t sid : added)
+					ti.sentences.emplace_back(sid, 0);
+				_writer.enqueue_object(numbered_path(lib->id, "items", ti.id, w.snap->sharded.count(lib->id)), ti);
+				forms.emplace_back(ti.id, headword_index::forms_of(ti));
+			}
+
+			if (forms.empty())
+				return true;
+			publish_library(std::move(lib));
+			for (const auto& [item_id, f] : forms)
+				_queries.invalidate_item(lib_id, item_id, f);
+			return true;
+		}
+
+	public:
+		/// <returns>
+		/// 指定库的语音库。如果库不存在或语音库无法打开，返回空指针。在 load 后可用。
+		/// </returns>
+		std::shared_ptr<pronunciation_store> pronunciations_of(id_t lib_id)
+		{
+			auto snap = _snapshot.load();
+			if (!snap)
+				return nullptr;
+			auto it = snap->pronunciations.find(lib_id);
+			if (it == snap->pronunciations.end())
+				return nullptr;
+			return it->second;
+		}
+		/// <summary>
+		/// 获取 item 的所有发音。音频数据直接指向映射的段文件，不复制。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="item_id">item id。</param>
+		/// <returns>按 item 中的顺序排列的音频片段，跳过不存在的片段。如果库或 item 不存在，返回空列表。</returns>
+		std::vector<pronunciation_store::clip> pronunciations(id_t lib_id, id_t item_id)
+		{
+			auto snap = _snapshot.load();
+			if (!snap)
+				throw std::runtime_error("call load() before pronunciations.");
+
+			auto store = snap->pronunciations.find(lib_id);
+			auto it = snap->find(lib_id, item_id);
+			if (store == snap->pronunciations.end() || !it)
+				return {};
+			return store->second->get(it->pronunciations);
+		}
+
+	private:
+		/// <summary>
+		/// 登记将库中的 raw_item 写入 raw_items.json。
+		/// </summary>
+		/// <param name="lib">库。登记后不可修改。</param>
+		void save_raw_items(std::shared_ptr<const library> lib)
+		{
+			_writer.enqueue(library_dir(lib->id) / "raw_items.json", [raw_items = lib->raw_items](const std::filesystem::path& p)
+				{
+					Json::Value v;
+					v["raw_items"].resize(0);
+					raw_items->for_each([&v](const std::u32string& origin, uint_t frequency)
+						{
+							raw_item ri;
+							ri.origin = origin;
+							ri.frequency = frequency;
+							v["raw_items"].append(ri.to_json());
+							return true;
+						});
+
+					std::u8string str = Json::write(v);
+					atomic_file::write(p, { reinterpret_cast<const char*>(str.data()), str.length() });
+				});
+		}
+		std::mutex _segmenters_mutex; // 保护 _segmenters。
+		/// <summary>
+		/// 各个库最近构造的分词器，以及构造时库中的 item。item 没有改变时（如连续添加片段）复用，不需要重新构造词典和双数组字典树。
+		/// </summary>
+		std::map<id_t, std::pair<persistent_map<id_t, item>, std::shared_ptr<const segmenter>>> _segmenters;
+
+		/// <returns>
+		/// 由库中的 item 构造的分词器。item 与上次构造时相同则直接返回上次的分词器。
+		/// </returns>
+		std::shared_ptr<const segmenter> segmenter_of(const library& lib)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_segmenters_mutex);
+				auto it = _segmenters.find(lib.id);
+				if (it != _segmenters.end() && it->second.first.shares_root(lib.items))
+					return it->second.second;
+			}
+			auto seg = std::make_shared<segmenter>();
+			seg->add(lib);
+			seg->build();
+			std::lock_guard<std::mutex> lock(_segmenters_mutex);
+			_segmenters[lib.id] = { lib.items, seg };
+			return seg;
+		}
+		/// <summary>
+		/// 按库的语言配置 raw_item 的提取器。已经是 item 的词（一般式或变体）会被跳过；对于 zhs、zht、ja 库，使用基于词典的分词器，只提取词典中没有的片段。
+		/// </summary>
+		/// <param name="extractor">被配置的提取器。</param>
+		/// <param name="lib">库。使用提取器期间不可修改。</param>
+		/// <returns>提取器使用的分词器，使用提取器期间应当持有。不需要分词器时为空。</returns>
+		std::shared_ptr<const segmenter> configure_extractor(raw_item_extractor& extractor, const library& lib)
+		{
+			extractor.filter = [&lib](std::u32string_view word)
+			{
+				return !lib.raw_items->is_headword(word);
+			};
+			if (!text::is_cjk_lang(lib.lang))
+				return nullptr;
+			auto seg = segmenter_of(lib);
+			extractor.tokenizer = seg->unknown_tokenizer();
+			return seg;
+		}
+	public:
+		/// <summary>
+		/// 从库的所有片段中重新提取 raw_item，替换库中原有的 raw_item 并写入文件。已经是 item 的词（一般式或变体）会被跳过。对于 zhs、zht、ja 库，使用基于词典的分词器，只提取词典中没有的片段。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <returns>成功返回 true，库不存在返回 false。</returns>
+		bool extract_raw_items(id_t lib_id)
+		{
+			auto w = begin_write(lib_id, "extract_raw_items");
+			if (!w.lib)
+				return false;
+
+			auto lib = std::make_shared<library>(*w.lib);
+			{
+				raw_item_extractor extractor;
+				auto seg = configure_extractor(extractor, *lib);
+				auto raw_items = std::make_shared<raw_item_index>(*lib->raw_items);
+				raw_items->assign(extractor.extract(lib->passages));
+				lib->raw_items = std::move(raw_items);
+			}
+			save_raw_items(lib);
+			publish_library(std::move(lib));
+
+			return true;
+		}
+		/// <summary>
+		/// 向库中添加一个片段并写入文件，之后只从这个片段中提取 raw_item，合并到库中已有的 raw_item 上。总是应当在加载库后调用，否则抛出 std::runtime_error 异常。
+		/// </summary>
+		/// <param name="lib_id">库 id。</param>
+		/// <param name="p">片段。如果 id 已经存在则失败。</param>
+		/// <returns>成功返回 true，失败返回 false。</returns>
+		bool add_passage(id_t lib_id, const passage& p)
+		{
+			auto w = begin_write(lib_id, "add_passage");
+			if (!w.lib)
+				return false;
+			if (w.lib->passages.count(p.id))
+				return false;
+
+			auto lib = std::make_shared<library>(*w.lib);
+			_writer.enqueue_object(numbered_path(lib->id, "passages", p.id, w.snap->sharded.count(lib->id)), p);
+			lib->passages.insert_or_assign(p.id, p);
+
+			{
+				raw_item_extractor extractor;
+				auto seg = configure_extractor(extractor, *lib);
+				auto raw_items = std::make_shared<raw_item_index>(*lib->raw_items);
+				raw_items->merge(extractor.extract(std::vector<std::u32string_view>{ p.content }));
+				lib->raw_items = std::move(raw_items);
+			}
+			save_raw_items(lib);
+			publish_library(std::move(lib));
 
 			return true;
 		}
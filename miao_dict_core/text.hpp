@@ -0,0 +1,227 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+namespace miao::core::text
+{
+	/// <returns>
+	/// 是否是空白字符。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_space(char32_t ch)
+	{
+		return ch == U' ' || ch == U'\t' || ch == U'\n' || ch == U'\r' || ch == U'\v' || ch == U'\f'
+			|| ch == 0x85 || ch == 0xA0 || ch == 0x1680
+			|| (ch >= 0x2000 && ch <= 0x200A) || ch == 0x2028 || ch == 0x2029 || ch == 0x202F || ch == 0x205F
+			|| ch == 0x3000 || ch == 0xFEFF;
+	}
+	/// <returns>
+	/// 是否是汉字、假名或谚文。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_cjk(char32_t ch)
+	{
+		return (ch >= 0x3040 && ch <= 0x30FF) // 平假名、片假名。
+			|| (ch >= 0x3400 && ch <= 0x4DBF) // 扩展 A。
+			|| (ch >= 0x4E00 && ch <= 0x9FFF) // 基本区。
+			|| (ch >= 0xAC00 && ch <= 0xD7AF) // 谚文音节。
+			|| (ch >= 0xF900 && ch <= 0xFAFF) // 兼容汉字。
+			|| (ch >= 0xFF66 && ch <= 0xFF9F) // 半角片假名。
+			|| (ch >= 0x20000 && ch <= 0x3FFFF); // 扩展 B 及以后。
+	}
+	/// <returns>
+	/// 是否是标点或符号。只覆盖常用区段。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_punct(char32_t ch)
+	{
+		if (ch < 0x80)
+			return (ch >= U'!' && ch <= U'/') || (ch >= U':' && ch <= U'@')
+				|| (ch >= U'[' && ch <= U'`') || (ch >= U'{' && ch <= U'~');
+		return (ch >= 0xA1 && ch <= 0xBF) || ch == 0xD7 || ch == 0xF7
+			|| (ch >= 0x2010 && ch <= 0x2027) || (ch >= 0x2030 && ch <= 0x205E) // 通用标点。
+			|| (ch >= 0x2190 && ch <= 0x2BFF) // 箭头、数学符号、几何图形等。
+			|| (ch >= 0x3001 && ch <= 0x303F) // CJK 标点。
+			|| ch == 0x30FB // 中点。
+			|| (ch >= 0xFE30 && ch <= 0xFE4F) // CJK 兼容标点。
+			|| (ch >= 0xFF01 && ch <= 0xFF0F) || (ch >= 0xFF1A && ch <= 0xFF20)
+			|| (ch >= 0xFF3B && ch <= 0xFF40) || (ch >= 0xFF5B && ch <= 0xFF65); // 全角标点。
+	}
+	/// <returns>
+	/// 是否是组成词的字符，即既不是空白也不是标点或控制字符。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_word_char(char32_t ch)
+	{
+		return ch >= 0x20 && ch != 0x7F && !is_space(ch) && !is_punct(ch);
+	}
+	/// <returns>
+	/// 是否是数字（包括全角数字）。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_digit(char32_t ch)
+	{
+		return (ch >= U'0' && ch <= U'9') || (ch >= 0xFF10 && ch <= 0xFF19);
+	}
+	/// <summary>
+	/// 将全角 ASCII 转换为半角，并将拉丁字母转换为小写。只处理 ASCII、Latin-1 和全角区段，其他字符保持不变。
+	/// </summary>
+	[[nodiscard]] constexpr char32_t fold(char32_t ch)
+	{
+		if (ch >= 0xFF01 && ch <= 0xFF5E)
+			ch -= 0xFEE0;
+		if ((ch >= U'A' && ch <= U'Z') || (ch >= 0xC0 && ch <= 0xDE && ch != 0xD7))
+			ch += 0x20;
+		return ch;
+	}
+
+	/// <returns>
+	/// 预设语言类型是否不使用空白分词，即 zhs、zht 和 ja。
+	/// </returns>
+	[[nodiscard]] inline bool is_cjk_lang(std::u32string_view lang)
+	{
+		return lang == U"zhs" || lang == U"zht" || lang == U"ja";
+	}
+
+	/// <summary>
+	/// 按空白和标点切分文本，对每个词调用 emit。词会先经过 fold 处理。汉字、假名等连续的 CJK 字符会被作为单独的一段输出，不与相邻的拉丁字母合并。纯数字的词会被跳过。
+	/// </summary>
+	/// <param name="content">源文本。</param>
+	/// <param name="emit">形如 void(std::u32string_view) 的回调。传入的视图只在回调期间有效。</param>
+	template <typename emit_t>
+	void split_words(std::u32string_view content, emit_t&& emit)
+	{
+		std::u32string buf;
+		bool cjk_run{};
+		bool all_digit{ true };
+		auto flush = [&]()
+		{
+			if (!buf.empty() && !all_digit)
+				emit(std::u32string_view(buf));
+			buf.clear();
+			all_digit = true;
+		};
+		for (size_t i = 0; i < content.length(); i++)
+		{
+			char32_t ch = content[i];
+			if (!is_word_char(ch))
+			{
+				// 词内的撇号和连字符，如 don't、well-known。
+				if ((ch == U'\'' || ch == 0x2019 || ch == U'-') && !buf.empty() && !cjk_run
+					&& i + 1 < content.length() && is_word_char(content[i + 1]) && !is_cjk(content[i + 1]))
+				{
+					buf.push_back(ch == 0x2019 ? U'\'' : ch);
+					continue;
+				}
+				flush();
+				continue;
+			}
+			bool cjk = is_cjk(ch);
+			if (!buf.empty() && cjk != cjk_run)
+				flush();
+			cjk_run = cjk;
+			all_digit &= is_digit(ch);
+			buf.push_back(fold(ch));
+		}
+		flush();
+	}
+	/// <returns>
+	/// 是否是句末标点。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_sentence_end(char32_t ch)
+	{
+		return ch == U'.' || ch == U'!' || ch == U'?' || ch == 0x2026 // …
+			|| ch == 0x3002 || ch == 0xFF01 || ch == 0xFF1F || ch == 0xFF0E || ch == 0xFF61; // 。！？．｡
+	}
+	/// <returns>
+	/// 是否是可以跟在句末标点后的右引号或右括号。
+	/// </returns>
+	[[nodiscard]] constexpr bool is_closing(char32_t ch)
+	{
+		return ch == U'"' || ch == U'\'' || ch == U')' || ch == U']' || ch == 0x2019 || ch == 0x201D
+			|| ch == 0x300D || ch == 0x300F || ch == 0x3011 || ch == 0xFF09 || ch == 0xFF3D || ch == 0x300B || ch == 0x3009;
+	}
+
+	/// <summary>
+	/// 将文本切分为句子，对每个句子调用 emit(位置, 长度)。句子两端的空白不计入句子，空句子会被跳过。
+	/// 对于 zhs、zht、ja，在句末标点（及其后的右引号）处切分；对于其他语言，要求句末标点后是空白，并且下一个词不以小写字母开头，同时排除常见的缩写（如 Mr.、e.g.）和单个大写字母的姓名缩写。换行总是结束一个句子。
+	/// </summary>
+	/// <param name="content">源文本。</param>
+	/// <param name="lang">预设语言类型。</param>
+	/// <param name="emit">形如 void(size_t, size_t) 的回调。</param>
+	template <typename emit_t>
+	void split_sentences(std::u32string_view content, std::u32string_view lang, emit_t&& emit)
+	{
+		const bool cjk = is_cjk_lang(lang);
+		auto output = [&](size_t l, size_t r)
+		{
+			while (l < r && is_space(content[l]))
+				l++;
+			while (r > l && is_space(content[r - 1]))
+				r--;
+			if (l < r)
+				emit(l, r - l);
+		};
+		// 判断以 end 结尾的词是否是缩写。
+		auto is_abbreviation = [&](size_t end)
+		{
+			size_t begin = end;
+			while (begin > 0 && (is_word_char(content[begin - 1]) || content[begin - 1] == U'.'))
+				begin--;
+			std::u32string word;
+			for (size_t i = begin; i < end; i++)
+				word.push_back(fold(content[i]));
+			if (word.length() == 1 && content[begin] >= U'A' && content[begin] <= U'Z') // 姓名缩写。
+				return true;
+			static const std::unordered_set<std::u32string> abbreviations{
+				U"mr", U"mrs", U"ms", U"dr", U"prof", U"sr", U"jr", U"st", U"vs", U"etc", U"no", U"fig",
+				U"e.g", U"i.e", U"cf", U"approx", U"dept", U"est", U"inc", U"ltd", U"co", U"mt", U"u.s" };
+			return abbreviations.count(word) > 0;
+		};
+
+		size_t start = 0;
+		size_t i = 0;
+		while (i < content.length())
+		{
+			char32_t ch = content[i];
+			if (ch == U'\n' || ch == 0x2029)
+			{
+				output(start, i);
+				start = ++i;
+				continue;
+			}
+			if (!is_sentence_end(ch))
+			{
+				i++;
+				continue;
+			}
+
+			size_t end = i + 1;
+			while (end < content.length() && (is_sentence_end(content[end]) || is_closing(content[end])))
+				end++;
+			if (cjk)
+			{
+				output(start, end);
+				start = i = end;
+				continue;
+			}
+
+			// 其他语言：句末标点后必须是空白或文本结尾。
+			if (end < content.length() && !is_space(content[end]))
+			{
+				i = end;
+				continue;
+			}
+			size_t next = end;
+			while (next < content.length() && is_space(content[next]) && content[next] != U'\n')
+				next++;
+			bool split = true;
+			if (ch == U'.' && end == i + 1 && is_abbreviation(i))
+				split = false;
+			if (next < content.length() && content[next] >= U'a' && content[next] <= U'z')
+				split = false;
+			if (split)
+			{
+				output(start, end);
+				start = end;
+			}
+			i = end;
+		}
+		output(start, content.length());
+	}
+}
\ No newline at end of file
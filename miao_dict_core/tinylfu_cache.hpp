@@ -0,0 +1,345 @@
+﻿#pragma once
+
+#include "include.hpp"
+
+#include <list>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 估计元素最近出现频率的 Count-Min Sketch。每行的计数器为 4 位，最大为 15；增加的次数达到采样大小后所有计数器减半，使过去的频率逐渐失效。
+	/// </summary>
+	class frequency_sketch final
+	{
+	private:
+		static constexpr size_t n_rows = 4;
+		static constexpr uint64_t seeds[n_rows]{ 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull };
+
+		std::vector<uint64_t> table; // 每个 uint64_t 中有 16 个计数器。
+		size_t width_mask{}; // 每行的计数器个数减一，个数总是 2 的幂。
+		size_t sample_size{};
+		size_t additions{};
+
+		[[nodiscard]] size_t index_of(uint64_t h, size_t row) const
+		{
+			uint64_t z = (h + seeds[row]) * 0xBF58476D1CE4E5B9ull;
+			z ^= z >> 31;
+			return row * (width_mask + 1) + static_cast<size_t>(z & width_mask);
+		}
+		[[nodiscard]] uint32_t counter(size_t i) const
+		{
+			return static_cast<uint32_t>((table[i / 16] >> (i % 16 * 4)) & 0xF);
+		}
+
+	public:
+		explicit frequency_sketch(size_t width = 64)
+		{
+			resize(width);
+		}
+		/// <summary>
+		/// 清空并按新的宽度重新分配。
+		/// </summary>
+		/// <param name="width">每行的计数器个数，应当与缓存中元素的个数相当。</param>
+		void resize(size_t width)
+		{
+			size_t n = 64;
+			while (n < width)
+				n <<= 1;
+			table.assign(n_rows * n / 16, 0);
+			width_mask = n - 1;
+			sample_size = 10 * n;
+			additions = 0;
+		}
+
+		/// <returns>
+		/// 哈希值为 h 的元素的频率估计值，不超过 15。
+		/// </returns>
+		[[nodiscard]] uint32_t frequency(uint64_t h) const
+		{
+			uint32_t ret = 15;
+			for (size_t r = 0; r < n_rows; r++)
+				ret = std::min(ret, counter(index_of(h, r)));
+			return ret;
+		}
+		/// <summary>
+		/// 记录哈希值为 h 的元素出现一次。只增加最小的计数器（保守更新），减小高估。
+		/// </summary>
+		void increment(uint64_t h)
+		{
+			size_t idx[n_rows];
+			uint32_t min = 15;
+			for (size_t r = 0; r < n_rows; r++)
+			{
+				idx[r] = index_of(h, r);
+				min = std::min(min, counter(idx[r]));
+			}
+			if (min == 15)
+				return;
+			for (size_t r = 0; r < n_rows; r++)
+				if (counter(idx[r]) == min)
+					table[idx[r] / 16] += 1ull << (idx[r] % 16 * 4);
+			if (++additions >= sample_size)
+			{
+				for (auto& w : table)
+					w = (w >> 1) & 0x7777777777777777ull;
+				additions /= 2;
+			}
+		}
+	};
+
+	/// <summary>
+	/// 按权重（例如字节数）限制大小的 W-TinyLFU 缓存。新元素先进入占预算 1% 的 LRU 窗口；被挤出窗口的元素只有在频率估计高于主区中将被淘汰的元素时才能进入主区，因此一次性的大量扫描不会冲掉常用的元素。主区是分段 LRU，再次访问的元素进入占主区 80% 的保护段。
+	/// 不是线程安全的。
+	/// </summary>
+	/// <typeparam name="key_t">键。</typeparam>
+	/// <typeparam name="value_t">值。</typeparam>
+	/// <typeparam name="hash_t">键的哈希。</typeparam>
+	/// <typeparam name="weigh_t">size_t(const key_t&amp;, const value_t&amp;)，元素的权重。</typeparam>
+	template <typename key_t, typename value_t, typename hash_t = std::hash<key_t>, typename weigh_t = std::function<size_t(const key_t&, const value_t&)>>
+	class tinylfu_cache final
+	{
+	public:
+		/// <summary>
+		/// 缓存的统计信息。
+		/// </summary>
+		struct stats
+		{
+			uint64_t hits{};
+			uint64_t misses{};
+			uint64_t evictions{}; // 主区中被淘汰的元素。
+			uint64_t rejections{}; // 被挤出窗口后没有进入主区的元素。
+			size_t entries{};
+			size_t weight{};
+			size_t budget{};
+
+			[[nodiscard]] double hit_rate() const
+			{
+				return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0;
+			}
+		};
+
+	private:
+		enum class region : uint8_t
+		{
+			window,
+			probation,
+			protect,
+		};
+		struct entry
+		{
+			key_t key;
+			value_t value;
+			size_t weight{};
+			uint64_t hash{};
+			region where{};
+		};
+		using list_t = std::list<entry>; // 最近访问的在前。
+
+		list_t window, probation, protect;
+		size_t window_weight{}, probation_weight{}, protect_weight{};
+		std::unordered_map<key_t, typename list_t::iterator, hash_t> map;
+		frequency_sketch sketch;
+		hash_t hasher;
+		weigh_t weigh;
+
+		size_t budget{};
+		size_t window_budget{};
+		size_t protect_budget{};
+		size_t average_weight;
+		stats counters;
+
+		[[nodiscard]] uint64_t hash_of(const key_t& key) const
+		{
+			return static_cast<uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+		}
+		[[nodiscard]] size_t main_budget() const
+		{
+			return budget - window_budget;
+		}
+		list_t& list_of(region r)
+		{
+			return r == region::window ? window : r == region::probation ? probation : protect;
+		}
+		size_t& weight_of(region r)
+		{
+			return r == region::window ? window_weight : r == region::probation ? probation_weight : protect_weight;
+		}
+		/// <summary>
+		/// 把元素移动到指定区域的最前面。
+		/// </summary>
+		void move_to(typename list_t::iterator it, region r)
+		{
+			weight_of(it->where) -= it->weight;
+			weight_of(r) += it->weight;
+			list_of(r).splice(list_of(r).begin(), list_of(it->where), it);
+			it->where = r;
+		}
+		void remove(typename list_t::iterator it)
+		{
+			weight_of(it->where) -= it->weight;
+			map.erase(it->key);
+			list_of(it->where).erase(it);
+		}
+		void on_access(typename list_t::iterator it)
+		{
+			switch (it->where)
+			{
+			case region::window:
+				move_to(it, region::window);
+				break;
+			case region::probation:
+				move_to(it, region::protect);
+				while (protect_weight > protect_budget && protect.size() > 1)
+					move_to(std::prev(protect.end()), region::probation);
+				break;
+			case region::protect:
+				move_to(it, region::protect);
+				break;
+			}
+		}
+		/// <summary>
+		/// 把超出窗口预算的元素移入主区，必要时淘汰主区或候选元素。
+		/// </summary>
+		void evict()
+		{
+			while (window_weight > window_budget && !window.empty())
+			{
+				auto candidate = std::prev(window.end());
+				uint32_t candidate_freq = sketch.frequency(candidate->hash);
+				bool admitted = candidate->weight <= main_budget();
+				while (admitted && probation_weight + protect_weight + candidate->weight > main_budget())
+				{
+					auto& victims = probation.empty() ? protect : probation;
+					if (victims.empty())
+					{
+						admitted = false;
+						break;
+					}
+					auto victim = std::prev(victims.end());
+					if (candidate_freq <= sketch.frequency(victim->hash))
+					{
+						admitted = false;
+						break;
+					}
+					remove(victim);
+					counters.evictions++;
+				}
+				if (admitted)
+					move_to(candidate, region::probation);
+				else
+				{
+					remove(candidate);
+					counters.rejections++;
+				}
+			}
+		}
+
+	public:
+		/// <param name="budget">权重的预算。</param>
+		/// <param name="weigh">元素的权重。</param>
+		/// <param name="average_weight">元素权重的估计值，用于确定频率估计的大小。</param>
+		explicit tinylfu_cache(size_t budget, weigh_t weigh = weigh_t(), size_t average_weight = 1)
+			: weigh(std::move(weigh)), average_weight(std::max<size_t>(average_weight, 1))
+		{
+			set_budget(budget);
+		}
+
+		/// <summary>
+		/// 设置权重的预算，超出的元素会被淘汰。
+		/// </summary>
+		void set_budget(size_t budget)
+		{
+			this->budget = budget;
+			window_budget = std::max<size_t>(budget / 100, std::min(budget, average_weight));
+			protect_budget = main_budget() * 4 / 5;
+			sketch.resize(budget / average_weight);
+			while (probation_weight + protect_weight > main_budget())
+			{
+				auto& victims = probation.empty() ? protect : probation;
+				remove(std::prev(victims.end()));
+				counters.evictions++;
+			}
+			while (protect_weight > protect_budget && !protect.empty())
+				move_to(std::prev(protect.end()), region::probation);
+			evict();
+		}
+
+		/// <summary>
+		/// 查找元素，并记录一次访问。
+		/// </summary>
+		/// <returns>元素的值。如果不存在，返回 nullptr。指针在下一次修改缓存前有效。</returns>
+		[[nodiscard]] const value_t* get(const key_t& key)
+		{
+			auto it = map.find(key);
+			sketch.increment(it == map.end() ? hash_of(key) : it->second->hash);
+			if (it == map.end())
+			{
+				counters.misses++;
+				return nullptr;
+			}
+			counters.hits++;
+			on_access(it->second);
+			return &it->second->value;
+		}
+		/// <summary>
+		/// 查找元素，不记录访问。
+		/// </summary>
+		[[nodiscard]] bool contains(const key_t& key) const
+		{
+			return map.count(key);
+		}
+		/// <summary>
+		/// 添加或替换元素。权重超过预算的元素不会被缓存。
+		/// </summary>
+		void put(const key_t& key, value_t value)
+		{
+			size_t w = weigh(key, value);
+			if (auto it = map.find(key); it != map.end())
+				remove(it->second);
+			if (w > budget)
+				return;
+			window.push_front({ key, std::move(value), w, hash_of(key), region::window });
+			window_weight += w;
+			map[key] = window.begin();
+			evict();
+		}
+		/// <summary>
+		/// 移除元素。频率估计不变。
+		/// </summary>
+		void erase(const key_t& key)
+		{
+			if (auto it = map.find(key); it != map.end())
+				remove(it->second);
+		}
+		/// <summary>
+		/// 移除所有元素并清空频率估计和统计信息。
+		/// </summary>
+		void clear()
+		{
+			map.clear();
+			window.clear();
+			probation.clear();
+			protect.clear();
+			window_weight = probation_weight = protect_weight = 0;
+			sketch.resize(budget / average_weight);
+			counters = stats();
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return map.size();
+		}
+		[[nodiscard]] size_t weight() const
+		{
+			return window_weight + probation_weight + protect_weight;
+		}
+		[[nodiscard]] stats statistics() const
+		{
+			stats ret = counters;
+			ret.entries = map.size();
+			ret.weight = weight();
+			ret.budget = budget;
+			return ret;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,208 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "random.hpp"
+
+namespace miao::core
+{
+	/// <summary>
+	/// 按权重随机抽取键。键按权重的二进制指数分桶，抽取时先按桶的总权重选桶，再在桶内均匀选取并以 权重 / 桶上界 的概率接受，不接受时在桶内重新选取，接受率不低于 1/2。
+	/// 桶的个数是常数，因此抽取的期望时间是 O(1)；修改权重只需要在桶之间移动一个元素，也是 O(1)。相同的种子和相同的操作序列总是给出相同的结果。
+	/// </summary>
+	template <typename key_t, typename hash_t = std::hash<key_t>>
+	class weighted_sampler final
+	{
+	private:
+		static constexpr int min_exp = -60;
+		static constexpr int max_exp = 60;
+		static constexpr size_t n_buckets = max_exp - min_exp + 1;
+
+		struct bucket
+		{
+			std::vector<std::pair<key_t, double>> members;
+			double sum{};
+			size_t n_updates{}; // 上次精确计算 sum 后的修改次数。
+		};
+		struct location
+		{
+			uint32_t bucket{};
+			size_t index{};
+		};
+
+		std::array<bucket, n_buckets> buckets;
+		std::unordered_map<key_t, location, hash_t> locations;
+		double total{};
+
+		/// <returns>
+		/// 权重所在的桶，桶 b 中的权重在 [2^(b + min_exp - 1), 2^(b + min_exp)) 上。
+		/// </returns>
+		[[nodiscard]] static uint32_t bucket_of(double weight)
+		{
+			int e;
+			std::frexp(weight, &e);
+			return static_cast<uint32_t>(std::clamp(e, min_exp, max_exp) - min_exp);
+		}
+		[[nodiscard]] static double clamp_weight(double weight)
+		{
+			return std::clamp(weight, std::ldexp(1.0, min_exp - 1), std::ldexp(1.0, max_exp - 1));
+		}
+		/// <summary>
+		/// 修改次数较多时重新累加桶的总权重，消除浮点误差。
+		/// </summary>
+		void touch(bucket& b)
+		{
+			if (++b.n_updates <= b.members.size() + 64)
+				return;
+			total -= b.sum;
+			b.sum = 0;
+			for (const auto& m : b.members)
+				b.sum += m.second;
+			total += b.sum;
+			b.n_updates = 0;
+		}
+		void remove_at(location loc)
+		{
+			auto& b = buckets[loc.bucket];
+			b.sum -= b.members[loc.index].second;
+			total -= b.members[loc.index].second;
+			if (loc.index != b.members.size() - 1)
+			{
+				b.members[loc.index] = std::move(b.members.back());
+				locations[b.members[loc.index].first].index = loc.index;
+			}
+			b.members.pop_back();
+			if (b.members.empty())
+			{
+				total -= b.sum;
+				b.sum = 0;
+				b.n_updates = 0;
+			}
+			else
+				touch(b);
+		}
+
+	public:
+		[[nodiscard]] size_t size() const
+		{
+			return locations.size();
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return locations.empty();
+		}
+		[[nodiscard]] bool contains(const key_t& key) const
+		{
+			return locations.count(key);
+		}
+		/// <returns>
+		/// 所有权重之和。
+		/// </returns>
+		[[nodiscard]] double total_weight() const
+		{
+			return total;
+		}
+		void clear()
+		{
+			for (auto& b : buckets)
+				b = bucket();
+			locations.clear();
+			total = 0;
+		}
+		void reserve(size_t n)
+		{
+			locations.reserve(n);
+		}
+
+		/// <returns>
+		/// 键的权重。如果不存在，返回 std::nullopt。
+		/// </returns>
+		[[nodiscard]] std::optional<double> weight_of(const key_t& key) const
+		{
+			auto it = locations.find(key);
+			if (it == locations.end())
+				return std::nullopt;
+			return buckets[it->second.bucket].members[it->second.index].second;
+		}
+		/// <summary>
+		/// 插入键或修改已有键的权重。权重不是正数时移除键。权重会被限制在 [2^-61, 2^59] 上。
+		/// </summary>
+		void set(const key_t& key, double weight)
+		{
+			if (!(weight > 0))
+			{
+				erase(key);
+				return;
+			}
+			weight = clamp_weight(weight);
+			uint32_t bi = bucket_of(weight);
+			auto it = locations.find(key);
+			if (it != locations.end())
+			{
+				if (it->second.bucket == bi) // 同一个桶内只修改权重。
+				{
+					auto& b = buckets[bi];
+					double& w = b.members[it->second.index].second;
+					b.sum += weight - w;
+					total += weight - w;
+					w = weight;
+					touch(b);
+					return;
+				}
+				remove_at(it->second);
+				it->second = { bi, buckets[bi].members.size() };
+			}
+			else
+				locations.emplace(key, location{ bi, buckets[bi].members.size() });
+			auto& b = buckets[bi];
+			b.members.emplace_back(key, weight);
+			b.sum += weight;
+			total += weight;
+		}
+		/// <summary>
+		/// 移除键。
+		/// </summary>
+		/// <returns>是否存在。</returns>
+		bool erase(const key_t& key)
+		{
+			auto it = locations.find(key);
+			if (it == locations.end())
+				return false;
+			location loc = it->second;
+			locations.erase(it);
+			remove_at(loc);
+			return true;
+		}
+
+		/// <summary>
+		/// 按权重随机抽取一个键。每个键被抽到的概率正比于它的权重。
+		/// </summary>
+		/// <returns>抽到的键。如果没有键，返回 std::nullopt。</returns>
+		[[nodiscard]] std::optional<key_t> draw(random_engine& rng) const
+		{
+			if (locations.empty())
+				return std::nullopt;
+			// 从权重大的桶开始找，通常很快结束。
+			double r = rng.uniform() * total;
+			const bucket* chosen = nullptr;
+			uint32_t bi = n_buckets;
+			for (uint32_t i = n_buckets; i-- > 0;)
+			{
+				if (buckets[i].members.empty())
+					continue;
+				chosen = &buckets[i];
+				bi = i;
+				if (r < buckets[i].sum)
+					break;
+				r -= buckets[i].sum;
+			}
+			// 由于浮点误差没有选中时，使用最后一个非空的桶。在选中的桶内反复抽取直到接受，使每个键被抽到的概率正比于权重。
+			double upper = std::ldexp(1.0, static_cast<int>(bi) + min_exp);
+			while (true)
+			{
+				const auto& m = chosen->members[rng.below(chosen->members.size())];
+				if (rng.uniform() * upper < m.second)
+					return m.first;
+			}
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,190 @@
+﻿#pragma once
+
+#include "include.hpp"
+#include "atomic_file.hpp"
+
+#include <condition_variable>
+
+namespace miao::core
+{
+	/// <summary>
+	/// 延迟写入文件的队列。调用者只登记要写入的文件和写入的方法，在后台线程中依次写入，调用者不需要等待磁盘。
+	/// 同一文件在写入前被多次登记时，只保留最后一次登记的内容，并且保持第一次登记时的位置。等待写入的文件个数达到 capacity 时，登记新的文件会等待后台线程写入。析构时写入所有等待中的文件。所有成员函数都是线程安全的。
+	/// </summary>
+	class write_queue final
+	{
+	public:
+		using writer_t = std::function<void(const std::filesystem::path&)>; // 写入指定的文件。失败时抛出 std::exception 异常。
+
+		/// <summary>
+		/// 队列的统计信息。
+		/// </summary>
+		struct stats
+		{
+			uint64_t enqueued{}; // 登记的次数。
+			uint64_t coalesced{}; // 被之后的登记替换而没有写入的次数。
+			uint64_t written{};
+			uint64_t failed{};
+			size_t pending{}; // 等待写入和正在写入的文件个数。
+		};
+
+		size_t capacity{ 1024 }; // 最多等待写入的文件个数。
+
+	private:
+		mutable std::mutex mutex;
+		std::condition_variable cv_work; // 有新的文件或需要停止。
+		std::condition_variable cv_space; // 有文件写入完成。
+		std::deque<std::filesystem::path> order; // 等待写入的文件，先登记的在前。
+		std::map<std::filesystem::path, writer_t> pending; // 与 order 中的文件一一对应。
+		size_t writing{}; // 正在写入的文件个数。
+		std::filesystem::path current; // 正在写入的文件。
+		bool syncing{}; // 正在同步写入的文件所在的目录。
+		bool failed_since_flush{};
+		bool stopping{};
+		stats counters;
+		std::thread worker;
+
+		void work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				cv_work.wait(lock, [this]() { return stopping || !order.empty(); });
+				if (order.empty()) // 只有在所有文件写入后才停止。
+					return;
+
+				// 连续写入的文件所在的目录在队列变空后只同步一次。
+				syncing = true;
+				lock.unlock();
+				{
+					atomic_file::directory_batch batch;
+					lock.lock();
+					while (!order.empty())
+					{
+						auto path = std::move(order.front());
+						order.pop_front();
+						auto node = pending.extract(path);
+						current = path;
+						writing++;
+						lock.unlock();
+
+						bool ok = true;
+						try
+						{
+							node.mapped()(path);
+						}
+						catch (const std::exception&)
+						{
+							ok = false;
+						}
+
+						lock.lock();
+						writing--;
+						current.clear();
+						if (ok)
+							counters.written++;
+						else
+						{
+							counters.failed++;
+							failed_since_flush = true;
+						}
+						cv_space.notify_all();
+					}
+					lock.unlock();
+					if (!batch.commit())
+					{
+						lock.lock();
+						failed_since_flush = true;
+						lock.unlock();
+					}
+				}
+				lock.lock();
+				syncing = false;
+				cv_space.notify_all();
+			}
+		}
+
+	public:
+		write_queue() : worker(&write_queue::work, this) {}
+		/// <summary>
+		/// 写入所有等待中的文件后返回。
+		/// </summary>
+		~write_queue()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			cv_work.notify_all();
+			worker.join();
+		}
+		write_queue(const write_queue&) = delete;
+		write_queue& operator=(const write_queue&) = delete;
+
+		/// <summary>
+		/// 登记写入一个文件。如果这个文件已经在等待写入，替换之前登记的方法。
+		/// </summary>
+		/// <param name="path">文件路径。</param>
+		/// <param name="writer">写入的方法，在后台线程中调用。应当持有要写入的内容的副本。</param>
+		void enqueue(std::filesystem::path path, writer_t writer)
+		{
+			path.make_preferred();
+			std::unique_lock<std::mutex> lock(mutex);
+			counters.enqueued++;
+			if (auto it = pending.find(path); it != pending.end())
+			{
+				it->second = std::move(writer);
+				counters.coalesced++;
+				return;
+			}
+			cv_space.wait(lock, [this]() { return order.size() < capacity; });
+			if (auto it = pending.find(path); it != pending.end()) // 等待期间其他线程登记了同一文件。
+			{
+				it->second = std::move(writer);
+				counters.coalesced++;
+				return;
+			}
+			pending.emplace(path, std::move(writer));
+			order.push_back(std::move(path));
+			cv_work.notify_one();
+		}
+		/// <summary>
+		/// 登记把可序列化的对象写入文件。对象被复制，之后的修改不影响写入的内容。
+		/// </summary>
+		template <typename T>
+		void enqueue_object(std::filesystem::path path, T obj)
+		{
+			enqueue(std::move(path), [obj = std::move(obj)](const std::filesystem::path& p) { obj.to_file(p); });
+		}
+		/// <summary>
+		/// 等待此前登记的所有文件写入完成。
+		/// </summary>
+		/// <returns>如果自上次调用以来所有写入都成功，返回 true；否则返回 false。</returns>
+		bool flush()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv_space.wait(lock, [this]() { return order.empty() && !writing && !syncing; });
+			bool ret = !failed_since_flush;
+			failed_since_flush = false;
+			return ret;
+		}
+
+		/// <returns>
+		/// 文件是否在等待写入或正在写入。
+		/// </returns>
+		[[nodiscard]] bool is_pending(std::filesystem::path path) const
+		{
+			path.make_preferred();
+			std::lock_guard<std::mutex> lock(mutex);
+			return pending.count(path) || current == path;
+		}
+
+		[[nodiscard]] stats statistics() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stats ret = counters;
+			ret.pending = order.size() + writing;
+			return ret;
+		}
+	};
+}
\ No newline at end of file
@@ -1,5 +1,121 @@
 ﻿#include <miao_dict_core/core.hpp>
 
-int main()
+#include "simulation.hpp"
+
+/// <summary>
+/// 输出用法。
+/// </summary>
+static void print_usage(std::ostream& os)
+{
+	os << "usage:\n"
+		<< "  miao_dict_cui simulate [--libraries N] [--items N] [--events N] [--seed N] [--mode resident|random|carousel|review|all]\n"
+		<< "  miao_dict_cui query WORD [--working-dir DIR]" << std::endl;
+}
+
+/// <summary>
+/// 用法：
+/// miao_dict_cui simulate [--libraries N] [--items N] [--events N] [--seed N] [--mode resident|random|carousel|review|all]
+/// miao_dict_cui query WORD [--working-dir DIR]：在词典映像中查询，还没有映像时加载工作目录并生成。
+/// 参数无法识别时输出用法，返回 1。
+/// </summary>
+int main(int argc, char* argv[])
 {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	if (!args.empty() && args[0] == "simulate")
+	{
+		if (args.size() % 2 == 0) // 选项缺少值。
+		{
+			print_usage(std::cerr);
+			return 1;
+		}
+		miao::cui::simulation::options opt;
+		for (size_t i = 1; i + 1 < args.size(); i += 2)
+		{
+			const auto& name = args[i];
+			const auto& value = args[i + 1];
+			try
+			{
+				if (name == "--libraries")
+					opt.n_libraries = std::stoull(value);
+				else if (name == "--items")
+					opt.n_items = std::stoull(value);
+				else if (name == "--events")
+					opt.n_events = std::stoull(value);
+				else if (name == "--seed")
+					opt.seed = std::stoull(value);
+				else if (name == "--mode" && (value == "resident" || value == "random" || value == "carousel" || value == "review" || value == "all"))
+					opt.mode = value;
+				else
+				{
+					std::cerr << "unknown option " << name << ' ' << value << std::endl;
+					print_usage(std::cerr);
+					return 1;
+				}
+			}
+			catch (const std::exception&)
+			{
+				std::cerr << "invalid value for " << name << std::endl;
+				return 1;
+			}
+		}
+
+		miao::cui::simulation sim(opt);
+		for (const auto& r : sim.run())
+			miao::cui::simulation::print(std::cout, r);
+		return 0;
+	}
+	if (args.size() >= 2 && args.size() % 2 == 0 && args[0] == "query")
+	{
+		std::filesystem::path working_dir = ".";
+		for (size_t i = 2; i + 1 < args.size(); i += 2)
+		{
+			if (args[i] == "--working-dir")
+				working_dir = args[i + 1];
+			else
+			{
+				std::cerr << "unknown option " << args[i] << std::endl;
+				print_usage(std::cerr);
+				return 1;
+			}
+		}
+
+		// 打开其他进程生成的映像，不需要加载。
+		miao::core::dictionary_image image;
+		if (!image.attach(working_dir / "miao_dict" / "image"))
+		{
+			miao::core::system sys;
+			sys.set_working_dir(working_dir);
+			if (!sys.load())
+			{
+				std::cerr << "fail to load " << working_dir << std::endl;
+				return 1;
+			}
+			try
+			{
+				sys.publish_image();
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << e.what() << std::endl;
+				return 1;
+			}
+			if (!image.attach(sys.image_dir()))
+			{
+				std::cerr << "fail to open the dictionary image" << std::endl;
+				return 1;
+			}
+		}
+
+		for (const auto& it : image.query(miao::utf_conv<char, char32_t>::convert(args[1])))
+		{
+			std::cout << miao::utf_conv<char32_t, char>::convert(it.origin);
+			for (const auto& [id, lib_id, tag, meaning] : it.translations)
+				std::cout << '\t' << miao::utf_conv<char32_t, char>::convert(meaning);
+			std::cout << std::endl;
+		}
+		return 0;
+	}
+
+	print_usage(std::cerr);
+	return 1;
 }
\ No newline at end of file
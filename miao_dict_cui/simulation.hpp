@@ -0,0 +1,318 @@
+﻿#pragma once
+
+#include <miao_dict_core/core.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+#if __windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "Psapi.lib")
+#endif
+
+namespace miao::cui
+{
+	/// <summary>
+	/// 学习模式调度的模拟。在内存中生成指定规模的库，不访问磁盘，按固定的比例回放显示、跳过、暂停、朗读、查询和复习事件，统计吞吐量、选词延迟和内存。相同的参数和种子总是回放相同的事件序列，可以在不同的构建之间比较。
+	/// </summary>
+	class simulation final
+	{
+	public:
+		/// <summary>
+		/// 模拟的参数。
+		/// </summary>
+		struct options
+		{
+			size_t n_libraries{ 4 };
+			size_t n_items{ 250000 }; // 每个库中 item 的个数。
+			size_t n_events{ 2000000 };
+			uint64_t seed{ 1 };
+			std::string mode{ "all" }; // resident、random、carousel、review 或 all。
+		};
+		/// <summary>
+		/// 一种模式的结果。
+		/// </summary>
+		struct report
+		{
+			std::string mode;
+			size_t n_events{};
+			double seconds{};
+			std::vector<double> next_latency; // 每次选词的耗时（纳秒），已排序。
+			uint64_t checksum{}; // 选中的词的摘要，相同的种子应当相同。
+			size_t peak_memory{}; // 峰值内存（字节），无法获取时为 0。
+			bool process_wide{}; // 为 true 表示之前运行过其他模式，peak_memory 是进程到这种模式结束时的峰值，包括之前的模式（以及分配器保留的它们的内存）。
+		};
+
+	private:
+		using clock = std::chrono::steady_clock;
+		using key_t = std::pair<core::id_t, core::id_t>;
+
+		options opt;
+		std::vector<core::library> libraries;
+
+		/// <returns>
+		/// 进程的峰值内存（字节）。无法获取时返回 0。
+		/// </returns>
+		static size_t peak_memory()
+		{
+#if __windows
+			PROCESS_MEMORY_COUNTERS pmc{};
+			if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+				return pmc.PeakWorkingSetSize;
+			return 0;
+#else
+			std::ifstream ifs("/proc/self/status");
+			std::string line;
+			while (std::getline(ifs, line))
+				if (line.rfind("VmHWM:", 0) == 0)
+					return static_cast<size_t>(std::stoull(line.substr(6))) * 1024;
+			return 0;
+#endif
+		}
+		static void mix(uint64_t& checksum, const key_t& key)
+		{
+			checksum = (checksum ^ (key.first * 0x9E3779B97F4A7C15ull ^ key.second)) * 0x100000001B3ull;
+		}
+
+		/// <summary>
+		/// 生成合成的库。计数按长尾分布，使一部分词已经显示过很多次。
+		/// </summary>
+		void generate()
+		{
+			core::random_engine rng(opt.seed);
+			libraries.assign(opt.n_libraries, core::library());
+			for (size_t l = 0; l < opt.n_libraries; l++)
+			{
+				auto& lib = libraries[l];
+				lib.id = l;
+				lib.lang = U"en";
+				for (size_t i = 0; i < opt.n_items; i++)
+				{
+					core::item it;
+					it.id = i;
+					double u = rng.uniform();
+					it.showing_time = static_cast<core::uint_t>(u * u * u * 3600000);
+					it.n_skips = rng.below(8) ? 0 : rng.below(5);
+					it.n_flick = static_cast<core::uint_t>(u * u * 200);
+					it.n_pause = rng.below(10) ? 0 : rng.below(3);
+					it.n_query = rng.below(20) ? 0 : rng.below(10);
+					if (rng.below(2))
+					{
+						it.review_due = 1'700'000'000'000ull + rng.below(30ull * 24 * 60 * 60 * 1000);
+						it.review_interval = 24 * 60 * 60 * 1000;
+					}
+					lib.items.insert_or_assign(i, std::move(it));
+				}
+			}
+		}
+		[[nodiscard]] core::item& item_of(const key_t& key)
+		{
+			return libraries[key.first].items.edit(key.second);
+		}
+		/// <summary>
+		/// 开始一种模式：重新生成库。
+		/// </summary>
+		void begin_mode()
+		{
+			libraries.clear();
+			generate();
+		}
+		[[nodiscard]] report finish(std::string mode, size_t n_events, clock::time_point begin, std::vector<double> latency, uint64_t checksum) const
+		{
+			report ret;
+			ret.mode = std::move(mode);
+			ret.n_events = n_events;
+			ret.seconds = std::chrono::duration<double>(clock::now() - begin).count();
+			std::sort(latency.begin(), latency.end());
+			ret.next_latency = std::move(latency);
+			ret.checksum = checksum;
+			ret.peak_memory = peak_memory();
+			return ret;
+		}
+
+		/// <summary>
+		/// 常驻显示：显示 70%，跳过 20%，查询 10%。
+		/// </summary>
+		report run_resident(bool random)
+		{
+			core::random_engine rng(opt.seed ^ 0x5EED);
+			core::resident_scheduler scheduler(1.0, opt.seed);
+			for (const auto& lib : libraries)
+				scheduler.add_library(lib);
+
+			std::vector<double> latency;
+			latency.reserve(opt.n_events);
+			uint64_t checksum{};
+			auto begin = clock::now();
+			for (size_t i = 0; i < opt.n_events; i++)
+			{
+				auto t0 = clock::now();
+				auto key = random ? scheduler.draw() : scheduler.next();
+				latency.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count());
+				if (!key)
+					break;
+				mix(checksum, *key);
+
+				auto& it = item_of(*key);
+				uint64_t r = rng.below(10);
+				if (r < 7)
+				{
+					auto c = scheduler.shown(key->first, key->second, 1000 + rng.below(10000));
+					it.showing_time = c->showing_time;
+				}
+				else if (r < 9)
+				{
+					auto c = scheduler.skipped(key->first, key->second);
+					it.n_skips = c->n_skips;
+				}
+				else
+				{
+					key_t q{ rng.below(libraries.size()), rng.below(opt.n_items) };
+					item_of(q).n_query++;
+				}
+			}
+			return finish(random ? "random" : "resident", opt.n_events, begin, std::move(latency), checksum);
+		}
+		/// <summary>
+		/// 轮巡显示：切换 90%，暂停 7%，朗读 3%。选中每个库的前 1000 个词。
+		/// </summary>
+		report run_carousel()
+		{
+			core::random_engine rng(opt.seed ^ 0xCA55);
+			core::carousel_scheduler scheduler;
+			for (auto& lib : libraries)
+			{
+				size_t n{};
+				for (const auto& [id, it] : lib.items)
+				{
+					if (n++ >= 1000)
+						break;
+					scheduler.add(lib.id, it);
+				}
+			}
+
+			std::vector<double> latency;
+			latency.reserve(opt.n_events);
+			uint64_t checksum{};
+			auto begin = clock::now();
+			for (size_t i = 0; i < opt.n_events; i++)
+			{
+				auto t0 = clock::now();
+				auto e = scheduler.next();
+				latency.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count());
+				if (!e)
+					break;
+				mix(checksum, e->key);
+				checksum += e->dwell;
+
+				auto& it = item_of(e->key);
+				it.n_flick = scheduler.counters_of(e->key.first, e->key.second)->n_flick;
+				uint64_t r = rng.below(100);
+				if (r < 7)
+					it.n_pause = scheduler.paused(e->key.first, e->key.second)->n_pause;
+				else if (r < 10)
+					it.n_pronounce = scheduler.pronounced(e->key.first, e->key.second)->n_pronounce;
+			}
+			return finish("carousel", opt.n_events, begin, std::move(latency), checksum);
+		}
+		/// <summary>
+		/// 复习：时间每次前进 0 到 2 分钟，偶尔前进一天（休眠）或后退一分钟（时钟调整），取出到期的词并以 85% 的概率记住。
+		/// </summary>
+		report run_review()
+		{
+			core::random_engine rng(opt.seed ^ 0x4EF1);
+			core::review_policy policy;
+			uint64_t now = 1'700'000'000'000ull;
+			core::review_queue queue(now);
+			for (const auto& lib : libraries)
+				for (const auto& [id, it] : lib.items)
+					if (it.review_due)
+						queue.schedule({ lib.id, id }, it.review_due);
+
+			std::vector<double> latency;
+			latency.reserve(opt.n_events);
+			uint64_t checksum{};
+			auto begin = clock::now();
+			for (size_t i = 0; i < opt.n_events; i++)
+			{
+				uint64_t r = rng.below(10000);
+				if (r < 2)
+					now += 24 * 60 * 60 * 1000;
+				else if (r < 4)
+					now -= 60 * 1000;
+				else
+					now += rng.below(120 * 1000);
+
+				auto t0 = clock::now();
+				queue.advance(now);
+				auto key = queue.pop_due();
+				latency.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count());
+				if (!key)
+					continue;
+				mix(checksum, *key);
+
+				auto& it = item_of(*key);
+				policy.apply(it, rng.below(100) < 85, now);
+				queue.schedule(*key, it.review_due);
+			}
+			return finish("review", opt.n_events, begin, std::move(latency), checksum);
+		}
+
+	public:
+		explicit simulation(options opt) : opt(std::move(opt)) {}
+
+		/// <summary>
+		/// 运行指定的模式。每种模式都从重新生成的库开始，除峰值内存外的结果与运行的模式的组合无关。
+		/// 峰值内存是进程的峰值，只有第一种模式是单独统计的：之前的模式释放的内存可能仍由分配器保留，无法从进程的峰值中扣除。需要每种模式的峰值时，用 --mode 在各自的进程中运行。
+		/// </summary>
+		std::vector<report> run()
+		{
+			std::vector<report> ret;
+			bool all = opt.mode == "all";
+			auto run_mode = [&](const char* mode, auto&& body)
+			{
+				if (!all && opt.mode != mode)
+					return;
+				begin_mode();
+				ret.push_back(body());
+				ret.back().process_wide = ret.size() > 1;
+			};
+			run_mode("resident", [this]() { return run_resident(false); });
+			run_mode("random", [this]() { return run_resident(true); });
+			run_mode("carousel", [this]() { return run_carousel(); });
+			run_mode("review", [this]() { return run_review(); });
+			return ret;
+		}
+
+		/// <summary>
+		/// 输出一种模式的结果。
+		/// </summary>
+		static void print(std::ostream& os, const report& r)
+		{
+			auto percentile = [&r](double p)
+			{
+				if (r.next_latency.empty())
+					return 0.0;
+				size_t i = std::min(r.next_latency.size() - 1, static_cast<size_t>(p * r.next_latency.size()));
+				return r.next_latency[i];
+			};
+			std::ostringstream ss;
+			ss << std::fixed << std::setprecision(0);
+			ss << std::left << std::setw(10) << r.mode
+				<< " events " << r.n_events
+				<< "  throughput " << (r.seconds > 0 ? r.n_events / r.seconds : 0.0) << "/s"
+				<< "  next p50 " << percentile(0.5) << "ns"
+				<< " p99 " << percentile(0.99) << "ns"
+				<< " p99.9 " << percentile(0.999) << "ns"
+				<< " max " << (r.next_latency.empty() ? 0.0 : r.next_latency.back()) << "ns"
+				<< (r.process_wide ? "  process peak memory " : "  peak memory ") << r.peak_memory / (1024 * 1024) << "MiB"
+				<< "  checksum " << std::hex << r.checksum;
+			os << ss.str() << std::endl;
+		}
+	};
+}
\ No newline at end of file